@@ -0,0 +1,162 @@
+#ifndef AABB_H
+#define AABB_H
+
+#include "rtweekend.h"
+
+#include <algorithm>
+#include <utility>
+
+/**
+ * @file aabb.h
+ * @brief Axis-aligned bounding boxes
+ *
+ * This file defines the aabb class used by acceleration structures to
+ * quickly reject rays that cannot hit the geometry inside a box.
+ */
+
+/**
+ * @class aabb
+ * @brief Axis-aligned bounding box stored as one interval per axis
+ */
+class aabb
+{
+public:
+    interval x, y, z; ///< Extent of the box along each axis
+
+    /**
+     * @brief Default constructor - creates an empty box
+     */
+    aabb() {}
+
+    /**
+     * @brief Constructor from per-axis intervals
+     */
+    aabb(const interval &x, const interval &y, const interval &z) : x(x), y(y), z(z) {}
+
+    /**
+     * @brief Constructor from two corner points (in any order)
+     * @param a First corner
+     * @param b Opposite corner
+     */
+    aabb(const point3 &a, const point3 &b)
+        : x(std::min(a[0], b[0]), std::max(a[0], b[0])),
+          y(std::min(a[1], b[1]), std::max(a[1], b[1])),
+          z(std::min(a[2], b[2]), std::max(a[2], b[2]))
+    {
+    }
+
+    /**
+     * @brief Constructor for the union of two boxes
+     */
+    aabb(const aabb &box0, const aabb &box1)
+        : x(std::min(box0.x.min, box1.x.min), std::max(box0.x.max, box1.x.max)),
+          y(std::min(box0.y.min, box1.y.min), std::max(box0.y.max, box1.y.max)),
+          z(std::min(box0.z.min, box1.z.min), std::max(box0.z.max, box1.z.max))
+    {
+    }
+
+    /**
+     * @brief Get the interval of one axis
+     * @param n Axis index (0=x, 1=y, 2=z)
+     */
+    const interval &axis_interval(int n) const
+    {
+        if (n == 1)
+            return y;
+        if (n == 2)
+            return z;
+        return x;
+    }
+
+    /**
+     * @brief Grow the box to contain a point
+     */
+    void expand(const point3 &p)
+    {
+        x = interval(std::min(x.min, p[0]), std::max(x.max, p[0]));
+        y = interval(std::min(y.min, p[1]), std::max(y.max, p[1]));
+        z = interval(std::min(z.min, p[2]), std::max(z.max, p[2]));
+    }
+
+    /**
+     * @brief Check whether the box contains no points
+     */
+    bool is_empty() const
+    {
+        return x.min > x.max || y.min > y.max || z.min > z.max;
+    }
+
+    /**
+     * @brief Center point of the box
+     */
+    point3 centroid() const
+    {
+        return point3(0.5 * (x.min + x.max), 0.5 * (y.min + y.max), 0.5 * (z.min + z.max));
+    }
+
+    /**
+     * @brief Surface area of the box (0 for empty boxes)
+     *
+     * Used by the surface area heuristic to estimate how likely a random
+     * ray is to hit the box.
+     */
+    double surface_area() const
+    {
+        if (is_empty())
+            return 0;
+        double dx = x.size(), dy = y.size(), dz = z.size();
+        return 2 * (dx * dy + dy * dz + dz * dx);
+    }
+
+    /**
+     * @brief Index of the longest axis
+     */
+    int longest_axis() const
+    {
+        if (x.size() > y.size())
+            return x.size() > z.size() ? 0 : 2;
+        return y.size() > z.size() ? 1 : 2;
+    }
+
+    /**
+     * @brief Test whether a ray passes through the box (slab method)
+     * @param r The ray to test
+     * @param ray_t Interval along the ray to consider
+     * @return True if the ray overlaps the box within ray_t
+     *
+     * Uses the ray's precomputed reciprocal direction, and its direction
+     * signs to tell the near slab plane from the far one.
+     */
+    bool hit(const ray &r, interval ray_t) const
+    {
+        const point3 &ray_orig = r.origin();
+        const vec3 &inverse = r.inverse_direction();
+
+        for (int axis = 0; axis < 3; axis++)
+        {
+            const interval &ax = axis_interval(axis);
+            bool negative = r.direction_sign(axis);
+
+            auto t0 = ((negative ? ax.max : ax.min) - ray_orig[axis]) * inverse[axis];
+            auto t1 = ((negative ? ax.min : ax.max) - ray_orig[axis]) * inverse[axis];
+
+            if (t0 > ray_t.min)
+                ray_t.min = t0;
+            if (t1 < ray_t.max)
+                ray_t.max = t1;
+
+            // Equality is a hit so that flat boxes (axis-aligned triangles) are not culled
+            if (ray_t.max < ray_t.min)
+                return false;
+        }
+        return true;
+    }
+
+    static const aabb empty;    ///< Box containing no points
+    static const aabb universe; ///< Box containing all points
+};
+
+const aabb aabb::empty = aabb(interval::empty, interval::empty, interval::empty);
+const aabb aabb::universe = aabb(interval::universe, interval::universe, interval::universe);
+
+#endif
@@ -0,0 +1,460 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include "aabb.h"
+#include "mapped_file.h"
+#include "render_stats.h"
+#include "rtweekend.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+/**
+ * @file bvh.h
+ * @brief Flattened bounding volume hierarchy
+ *
+ * This file implements a bounding volume hierarchy (BVH) stored as a flat
+ * array of nodes in depth-first order. It is independent of the primitive
+ * type: it is built from a list of primitive bounding boxes and traversed
+ * with a callback that intersects one primitive. Meshes and scene-level
+ * containers use it as their acceleration structure.
+ *
+ * When primitives move, the hierarchy can be refit: node bounds are
+ * recomputed bottom-up while the tree topology is kept. Refitting is
+ * linear in the number of nodes, but the tree degrades as primitives
+ * drift away from where they were at build time, so owners rebuild once
+ * the SAH cost of the splits has grown past a threshold.
+ */
+
+/**
+ * @struct bvh_node
+ * @brief One node of a flattened BVH
+ *
+ * The left child of an interior node always directly follows it in the
+ * node array; the right child is stored at `offset`. For leaves, `offset`
+ * is the first entry of the leaf in the primitive order and `count` is
+ * the number of primitives.
+ */
+struct bvh_node
+{
+    aabb bbox;       ///< Bounds of everything below this node
+    uint32_t offset; ///< Right child (interior) or first primitive (leaf)
+    uint16_t count;  ///< Number of primitives (0 for interior nodes)
+    uint16_t axis;   ///< Split axis, used to visit the nearer child first
+
+    bool is_leaf() const { return count > 0; }
+};
+
+/**
+ * @class bvh_tree
+ * @brief Binned surface-area-heuristic BVH over abstract primitives
+ *
+ * build() returns the order in which primitives are referenced by the
+ * leaves. Owners store their primitives in that order, so leaves address
+ * contiguous ranges and traversal needs no index indirection.
+ */
+class bvh_tree
+{
+public:
+    mapped_array<bvh_node> nodes;   ///< Nodes in depth-first order (root at index 0)
+    int max_leaf_size = 4;          ///< Largest number of primitives per leaf
+    double rebuild_threshold = 1.3; ///< Split cost growth (relative to build time) that calls for a rebuild
+
+    static constexpr int max_build_depth = 64;  ///< Deepest node build() creates
+    static constexpr int traversal_stack = 128; ///< Pending nodes traverse() keeps on the call stack
+
+    /**
+     * @brief Build the hierarchy
+     * @param bounds Bounding box of every primitive
+     * @return Primitive indices in leaf order
+     */
+    std::vector<uint32_t> build(const std::vector<aabb> &bounds)
+    {
+        std::vector<build_ref> refs(bounds.size());
+        for (size_t i = 0; i < bounds.size(); i++)
+            refs[i] = {bounds[i], bounds[i].centroid(), uint32_t(i)};
+
+        std::vector<bvh_node> built;
+        if (refs.empty())
+        {
+            built.push_back({aabb::empty, 0, 0, 0});
+            nodes = std::move(built);
+            return {};
+        }
+
+        built.reserve(2 * refs.size());
+        build_recursive(built, refs, 0, refs.size(), 0);
+        nodes = std::move(built);
+        build_split_cost = mean_split_cost();
+        tree_depth = measure_depth();
+
+        std::vector<uint32_t> order(refs.size());
+        for (size_t i = 0; i < refs.size(); i++)
+            order[i] = refs[i].index;
+        return order;
+    }
+
+    /**
+     * @brief Recompute node bounds after primitives moved
+     * @param bounds Current bounding box of every primitive, in leaf order
+     *
+     * Children are stored after their parents, so a single reverse sweep
+     * over the node array updates every node after its children.
+     */
+    void refit(const std::vector<aabb> &bounds)
+    {
+        if (bounds.empty())
+            return;
+
+        bvh_node *writable = nodes.mutable_data();
+        for (size_t i = nodes.size(); i-- > 0;)
+        {
+            bvh_node &node = writable[i];
+            if (node.is_leaf())
+            {
+                aabb box;
+                for (uint32_t k = node.offset; k < node.offset + node.count; k++)
+                    box = aabb(box, bounds[k]);
+                node.bbox = box;
+            }
+            else
+            {
+                node.bbox = aabb(writable[i + 1].bbox, writable[node.offset].bbox);
+            }
+        }
+    }
+
+    /**
+     * @brief Install nodes built earlier, for example loaded from a cache file
+     * @param loaded Nodes in depth-first order
+     * @param split_cost mean_split_cost() of the tree when it was built
+     */
+    void assign(mapped_array<bvh_node> loaded, double split_cost)
+    {
+        nodes = std::move(loaded);
+        build_split_cost = split_cost;
+        tree_depth = measure_depth();
+    }
+
+    /**
+     * @brief Install nodes produced by another builder (see lbvh_builder)
+     * @param built Nodes in depth-first order, laid out as by build()
+     */
+    void assign(std::vector<bvh_node> built)
+    {
+        nodes = std::move(built);
+        build_split_cost = mean_split_cost();
+        tree_depth = measure_depth();
+    }
+
+    /**
+     * @brief Number of edges on the longest path from the root to a leaf
+     */
+    int depth() const { return tree_depth; }
+
+    /**
+     * @brief mean_split_cost() of the tree when it was last built
+     */
+    double built_split_cost() const { return build_split_cost; }
+
+    /**
+     * @brief Check whether refitting has degraded the tree too far
+     * @return True if mean_split_cost() exceeds its build-time value by rebuild_threshold
+     */
+    bool needs_rebuild() const { return mean_split_cost() > build_split_cost * rebuild_threshold; }
+
+    /**
+     * @brief Bytes used by the node array
+     */
+    size_t memory_bytes() const { return nodes.size() * sizeof(bvh_node); }
+
+    /**
+     * @brief Bounds of the whole hierarchy
+     */
+    aabb bounds() const { return nodes.empty() ? aabb::empty : nodes[0].bbox; }
+
+    /**
+     * @brief Find the closest primitive hit along a ray
+     * @param r The ray to trace
+     * @param ray_t Interval along the ray; max shrinks to the closest hit
+     * @param intersect Callback bool(uint32_t position, interval &ray_t) that
+     *        tests the primitive at a leaf-order position and shrinks ray_t
+     *        on a closer hit
+     * @return True if any primitive was hit
+     *
+     * At most one node per level is pending, so the stack lives on the
+     * call stack unless another builder or a cache file supplied a tree
+     * deeper than traversal_stack.
+     */
+    template <typename Intersect>
+    bool traverse(const ray &r, interval &ray_t, Intersect &&intersect) const
+    {
+        if (nodes.empty() || (nodes[0].count == 0 && nodes.size() == 1))
+            return false;
+
+        const bvh_node *node_data = nodes.data();
+        uint32_t local_stack[traversal_stack];
+        std::vector<uint32_t> deep_stack;
+        uint32_t *stack = local_stack;
+        if (tree_depth > traversal_stack)
+        {
+            deep_stack.resize(tree_depth);
+            stack = deep_stack.data();
+        }
+        int stack_size = 0;
+        uint32_t current = 0;
+        bool hit_anything = false;
+
+        while (true)
+        {
+            const bvh_node &node = node_data[current];
+            RT_STAT_INC(bvh_nodes);
+            if (node.bbox.hit(r, ray_t))
+            {
+                if (node.is_leaf())
+                {
+                    for (uint32_t k = node.offset; k < node.offset + node.count; k++)
+                        hit_anything |= intersect(k, ray_t);
+                }
+                else
+                {
+                    // Visit the child on the ray's side of the split first
+                    bool right_first = r.direction_sign(node.axis);
+                    stack[stack_size++] = right_first ? current + 1 : node.offset;
+                    current = right_first ? node.offset : current + 1;
+                    continue;
+                }
+            }
+
+            if (stack_size == 0)
+                break;
+            current = stack[--stack_size];
+        }
+        return hit_anything;
+    }
+
+    /**
+     * @brief Expected cost of tracing a ray through the hierarchy (SAH)
+     * @return Sum over nodes of area(node) / area(root) * node cost
+     *
+     * Interior nodes cost one box test, leaves one test per primitive.
+     */
+    double sah_cost() const
+    {
+        double root_area = nodes.empty() ? 0 : nodes[0].bbox.surface_area();
+        if (root_area <= 0)
+            return 0;
+
+        double cost = 0;
+        for (const auto &node : nodes)
+            cost += node.bbox.surface_area() / root_area * (node.is_leaf() ? node.count * intersection_cost : traversal_cost);
+        return cost;
+    }
+
+    /**
+     * @brief Average SAH cost of the splits in the tree
+     * @return Mean of (area(left) + area(right)) / area(node) over interior nodes
+     *
+     * This is the expected number of children a ray entering a node has
+     * to visit. It rises when refit children grow to overlap each other.
+     * Unlike sah_cost() it is normalized per node, so a few huge boxes
+     * (such as a ground sphere) do not hide the degradation of the rest.
+     */
+    double mean_split_cost() const
+    {
+        double total = 0;
+        size_t splits = 0;
+        for (size_t i = 0; i < nodes.size(); i++)
+        {
+            const bvh_node &node = nodes[i];
+            double area = node.bbox.surface_area();
+            if (node.is_leaf() || area <= 0)
+                continue;
+            total += (nodes[i + 1].bbox.surface_area() + nodes[node.offset].bbox.surface_area()) / area;
+            splits++;
+        }
+        return splits == 0 ? 0 : total / splits;
+    }
+
+private:
+    double build_split_cost = 0; ///< mean_split_cost() right after the last build
+    int tree_depth = 0;          ///< depth() of the installed nodes
+
+    static constexpr int bin_count = 16;             ///< SAH bins per axis
+    static constexpr double traversal_cost = 1.0;    ///< Relative cost of a box test
+    static constexpr double intersection_cost = 1.0; ///< Relative cost of a primitive test
+
+    /**
+     * @brief Primitive reference used during construction
+     */
+    struct build_ref
+    {
+        aabb bbox;
+        point3 centroid;
+        uint32_t index;
+    };
+
+    /**
+     * @brief Longest root-to-leaf path of the installed nodes
+     *
+     * Children follow their parents in the array, so one forward sweep
+     * assigns every node its depth.
+     */
+    int measure_depth() const
+    {
+        std::vector<int> level(nodes.size(), 0);
+        int deepest = 0;
+        for (size_t i = 0; i < nodes.size(); i++)
+        {
+            deepest = std::max(deepest, level[i]);
+            if (!nodes[i].is_leaf() && nodes[i].offset < nodes.size() && i + 1 < nodes.size())
+                level[i + 1] = level[nodes[i].offset] = level[i] + 1;
+        }
+        return deepest;
+    }
+
+    /**
+     * @brief Build the subtree over refs[begin, end)
+     * @param built Node array being filled
+     * @param depth Depth of the new node
+     * @return Index of the subtree's root node
+     *
+     * Degenerate input, such as many primitives with nearly coincident
+     * centroids, can make SAH splits peel off a few primitives at a time.
+     * Below max_build_depth - 16 the remaining primitives become a leaf,
+     * or are halved while they exceed the 16-bit leaf count, which takes
+     * at most 16 more levels.
+     */
+    uint32_t build_recursive(std::vector<bvh_node> &built, std::vector<build_ref> &refs, size_t begin, size_t end,
+                             int depth)
+    {
+        uint32_t node_index = uint32_t(built.size());
+        built.push_back({});
+
+        aabb bbox, centroid_bounds;
+        for (size_t i = begin; i < end; i++)
+        {
+            bbox = aabb(bbox, refs[i].bbox);
+            centroid_bounds.expand(refs[i].centroid);
+        }
+
+        size_t count = end - begin;
+        int axis = centroid_bounds.longest_axis();
+        bool splittable = centroid_bounds.axis_interval(axis).size() > 0 && depth < max_build_depth - 16;
+        size_t mid = begin;
+
+        if (count > size_t(max_leaf_size) && splittable)
+        {
+            mid = find_sah_split(refs, begin, end, bbox, centroid_bounds, axis);
+
+            // The SAH prefers a leaf for these primitives
+            if (mid == begin)
+            {
+                built[node_index] = {bbox, uint32_t(begin), uint16_t(count), 0};
+                return node_index;
+            }
+        }
+        else if (count <= 0xffff)
+        {
+            built[node_index] = {bbox, uint32_t(begin), uint16_t(count), 0};
+            return node_index;
+        }
+        else
+        {
+            // Too many coincident primitives for one leaf: split them in half
+            mid = begin + count / 2;
+        }
+
+        build_recursive(built, refs, begin, mid, depth + 1);
+        uint32_t right = build_recursive(built, refs, mid, end, depth + 1);
+        built[node_index] = {bbox, right, 0, uint16_t(axis)};
+        return node_index;
+    }
+
+    /**
+     * @brief SAH bin of a centroid, clamped to [0, bin_count - 1]
+     */
+    static int centroid_bin(double centroid, double min, double scale)
+    {
+        double position = (centroid - min) * scale;
+        return position > 0 ? int(std::min(position, double(bin_count - 1))) : 0;
+    }
+
+    /**
+     * @brief Partition refs[begin, end) with the best binned SAH split
+     * @return Partition point, or begin if a leaf is cheaper than any split
+     */
+    size_t find_sah_split(std::vector<build_ref> &refs, size_t begin, size_t end, const aabb &bbox,
+                          const aabb &centroid_bounds, int &axis) const
+    {
+        double best_cost = infinity;
+        int best_axis = -1, best_bin = -1;
+
+        for (int a = 0; a < 3; a++)
+        {
+            const interval &extent = centroid_bounds.axis_interval(a);
+            if (extent.size() <= 0)
+                continue;
+
+            // A denormal extent overflows the scale; such an axis cannot be binned
+            double scale = bin_count / extent.size();
+            if (!std::isfinite(scale))
+                continue;
+
+            aabb bin_bounds[bin_count];
+            size_t bin_counts[bin_count] = {};
+            for (size_t i = begin; i < end; i++)
+            {
+                int b = centroid_bin(refs[i].centroid[a], extent.min, scale);
+                bin_counts[b]++;
+                bin_bounds[b] = aabb(bin_bounds[b], refs[i].bbox);
+            }
+
+            // Sweep from the right to get the area and count of every right side
+            double right_area[bin_count];
+            size_t right_count[bin_count];
+            aabb accumulated;
+            size_t accumulated_count = 0;
+            for (int b = bin_count - 1; b > 0; b--)
+            {
+                accumulated = aabb(accumulated, bin_bounds[b]);
+                accumulated_count += bin_counts[b];
+                right_area[b] = accumulated.surface_area();
+                right_count[b] = accumulated_count;
+            }
+
+            accumulated = aabb();
+            accumulated_count = 0;
+            for (int b = 1; b < bin_count; b++)
+            {
+                accumulated = aabb(accumulated, bin_bounds[b - 1]);
+                accumulated_count += bin_counts[b - 1];
+                double cost = accumulated.surface_area() * accumulated_count + right_area[b] * right_count[b];
+                if (accumulated_count > 0 && right_count[b] > 0 && cost < best_cost)
+                {
+                    best_cost = cost;
+                    best_axis = a;
+                    best_bin = b;
+                }
+            }
+        }
+
+        double area = bbox.surface_area();
+        double leaf_cost = intersection_cost * (end - begin);
+        if (best_axis < 0 || (area > 0 && traversal_cost + intersection_cost * best_cost / area >= leaf_cost &&
+                              end - begin <= size_t(max_leaf_size) * 4))
+            return begin;
+
+        axis = best_axis;
+        const interval &extent = centroid_bounds.axis_interval(best_axis);
+        double scale = bin_count / extent.size();
+        auto middle = std::partition(refs.begin() + begin, refs.begin() + end, [&](const build_ref &ref) {
+            return centroid_bin(ref.centroid[best_axis], extent.min, scale) < best_bin;
+        });
+        return size_t(middle - refs.begin());
+    }
+};
+
+#endif
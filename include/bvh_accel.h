@@ -0,0 +1,243 @@
+#ifndef BVH_ACCEL_H
+#define BVH_ACCEL_H
+
+#include "bvh.h"
+#include "bvh_build.h"
+#include "compact_bvh.h"
+#include "hittable.h"
+#include "hittable_list.h"
+#include "rtweekend.h"
+#include "trace.h"
+
+#include <unordered_set>
+#include <vector>
+
+/**
+ * @file bvh_accel.h
+ * @brief Top-level BVH over hittable objects
+ *
+ * This file implements the upper level of the two-level acceleration
+ * structure: a BVH whose leaves are whole hittables such as spheres,
+ * meshes and instances. Meshes keep their own bottom-level BVH, and
+ * instances reuse it under a transformation.
+ */
+
+/**
+ * @class bvh_accel
+ * @brief Hittable container that finds the closest hit with a BVH
+ *
+ * Replaces the linear search of hittable_list for large scenes. The
+ * objects are stored in BVH leaf order; with sbvh_build, an object whose
+ * bounds were split between leaves is stored once per leaf. Objects may
+ * move between frames (for example sphere::set_center); update() then
+ * brings the hierarchy up to date.
+ *
+ * Unbounded objects such as planes are kept out of the hierarchy and
+ * tested before it, one plane test per ray; a hit on them shortens the
+ * ray, which prunes the traversal behind them.
+ */
+class bvh_accel : public hittable
+{
+public:
+    /**
+     * @brief How update() brought the hierarchy up to date
+     */
+    enum update_result
+    {
+        unchanged, ///< No object moved
+        refitted,  ///< Node bounds were refit, topology kept
+        rebuilt    ///< The tree was rebuilt because refitting degraded it too far
+    };
+
+    /**
+     * @brief Build the hierarchy over the objects of a list
+     * @param list Objects to add
+     * @param method Build algorithm, also used for rebuilds by update()
+     */
+    explicit bvh_accel(const hittable_list &list, bvh_build_method method = sah_build)
+        : bvh_accel(list.objects, method)
+    {
+    }
+
+    /**
+     * @brief Build the hierarchy over a set of objects
+     * @param objects Objects to add
+     * @param method Build algorithm, also used for rebuilds by update()
+     */
+    explicit bvh_accel(std::vector<shared_ptr<hittable>> objects, bvh_build_method method = sah_build)
+        : method(method)
+    {
+        for (auto &object : objects)
+            (object->is_bounded() ? this->objects : unbounded).push_back(std::move(object));
+        build();
+    }
+
+    /**
+     * @brief Number of distinct objects, including the unbounded ones outside the hierarchy
+     */
+    size_t object_count() const { return distinct_objects + unbounded.size(); }
+
+    /**
+     * @brief Update the hierarchy after objects moved
+     * @return What was done
+     *
+     * Compares every object's bounds with the bounds the tree was last
+     * updated with. If any changed, the tree is refit, and rebuilt only
+     * when its SAH cost has grown past bvh_tree::rebuild_threshold. A
+     * frame in which nothing moved costs one bounds query per object.
+     */
+    update_result update()
+    {
+        size_t moved = 0;
+        for (size_t k = 0; k < objects.size(); k++)
+        {
+            aabb box = objects[k]->bounding_box();
+            if (!same_box(box, object_bounds[k]))
+            {
+                object_bounds[k] = box;
+                moved++;
+            }
+        }
+        if (moved == 0)
+            return unchanged;
+
+        if (!compact.empty())
+        {
+            // Quantized nodes cannot be refit
+            build();
+            compress();
+            return rebuilt;
+        }
+
+        {
+            trace_scope scope("refit scene BVH", "accel");
+            bvh.refit(object_bounds);
+        }
+        if (!bvh.needs_rebuild())
+            return refitted;
+
+        build();
+        return rebuilt;
+    }
+
+    /**
+     * @brief Test ray intersection against all objects
+     * @param r The ray to test for intersection
+     * @param ray_t The interval along the ray to test for intersections
+     * @param rec Reference to hit_record to fill with the closest hit
+     * @return True if any object is hit within the interval
+     */
+    bool hit(const ray &r, interval ray_t, hit_record &rec) const override
+    {
+        bool hit_unbounded = false;
+        for (const auto &object : unbounded)
+        {
+            if (object->hit(r, ray_t, rec))
+            {
+                hit_unbounded = true;
+                ray_t.max = rec.t;
+            }
+        }
+
+        hit_record temp_rec;
+        auto intersect = [&](uint32_t k, interval &t_range) {
+            if (!objects[k]->hit(r, t_range, temp_rec))
+                return false;
+            t_range.max = temp_rec.t;
+            rec = temp_rec;
+            return true;
+        };
+        bool hit_bounded =
+            compact.empty() ? bvh.traverse(r, ray_t, intersect) : compact.traverse(r, ray_t, intersect);
+        return hit_unbounded || hit_bounded;
+    }
+
+    /**
+     * @brief Get the bounding box of all objects (aabb::universe if any is unbounded)
+     */
+    aabb bounding_box() const override { return unbounded.empty() ? hierarchy_bounds() : aabb::universe; }
+
+    /**
+     * @brief The container is unbounded if any of its objects is
+     */
+    bool is_bounded() const override { return unbounded.empty(); }
+
+    /**
+     * @brief Bounding box of the objects in the hierarchy (the unbounded ones excluded)
+     */
+    aabb hierarchy_bounds() const { return compact.empty() ? bvh.bounds() : compact.bounds(); }
+
+    /**
+     * @brief Replace the hierarchy by its quantized four-wide form (see compact_bvh)
+     *
+     * Intended for static scenes. The full-precision nodes are released, so
+     * an update() that finds moved objects rebuilds the tree from scratch.
+     */
+    void compress()
+    {
+        trace_scope scope("compress scene BVH", "accel");
+        compact.build(bvh);
+        bvh = bvh_tree();
+    }
+
+    /**
+     * @brief Bytes used by the nodes of the hierarchy, in whichever layout is active
+     */
+    size_t hierarchy_bytes() const { return compact.empty() ? bvh.memory_bytes() : compact.memory_bytes(); }
+
+private:
+    std::vector<shared_ptr<hittable>> objects;   ///< Objects in BVH leaf order (repeated where spatial splits share them)
+    size_t distinct_objects = 0;                 ///< Number of different objects in the hierarchy
+    std::vector<shared_ptr<hittable>> unbounded; ///< Objects tested outside the hierarchy (planes)
+    std::vector<aabb> object_bounds;             ///< Bounds of the objects when the tree was last updated
+    bvh_tree bvh;                                ///< Hierarchy over the objects
+    compact_bvh compact;                         ///< Quantized hierarchy (replaces bvh after compress())
+    bvh_build_method method;                     ///< Algorithm used to build bvh
+
+    /**
+     * @brief Exact comparison of two boxes
+     */
+    static bool same_box(const aabb &a, const aabb &b)
+    {
+        return a.x.min == b.x.min && a.x.max == b.x.max && a.y.min == b.y.min && a.y.max == b.y.max &&
+               a.z.min == b.z.min && a.z.max == b.z.max;
+    }
+
+    /**
+     * @brief Build the BVH and store objects in leaf order
+     */
+    void build()
+    {
+        trace_scope scope("build scene BVH", "accel");
+        compact = compact_bvh();
+
+        // A tree with spatial splits lists shared objects once per leaf; rebuild from the distinct ones
+        if (distinct_objects > 0 && objects.size() > distinct_objects)
+        {
+            std::unordered_set<const hittable *> seen;
+            std::vector<shared_ptr<hittable>> distinct;
+            for (auto &object : objects)
+                if (seen.insert(object.get()).second)
+                    distinct.push_back(std::move(object));
+            objects.swap(distinct);
+        }
+        distinct_objects = objects.size();
+
+        std::vector<aabb> bounds(objects.size());
+        for (size_t k = 0; k < objects.size(); k++)
+            bounds[k] = objects[k]->bounding_box();
+
+        auto order = build_bvh(bvh, bounds, method);
+
+        std::vector<shared_ptr<hittable>> ordered(order.size());
+        object_bounds.resize(order.size());
+        for (size_t k = 0; k < order.size(); k++)
+        {
+            ordered[k] = objects[order[k]];
+            object_bounds[k] = bounds[order[k]];
+        }
+        objects.swap(ordered);
+    }
+};
+
+#endif
@@ -0,0 +1,79 @@
+#ifndef BVH_BUILD_H
+#define BVH_BUILD_H
+
+#include "aabb.h"
+#include "bvh.h"
+#include "lbvh.h"
+#include "rtweekend.h"
+#include "sbvh.h"
+
+#include <string>
+#include <vector>
+
+/**
+ * @file bvh_build.h
+ * @brief Choice of the algorithm that builds a bvh_tree
+ *
+ * All builders produce the same flat node layout, so owners of a tree
+ * select one by name and keep their traversal code unchanged.
+ */
+
+/**
+ * @brief Algorithm used to build a bvh_tree
+ */
+enum bvh_build_method
+{
+    sah_build,          ///< Binned SAH (bvh_tree::build), good trace speed
+    lbvh_build,         ///< Morton-code LBVH (lbvh_builder), fastest build
+    lbvh_treelet_build, ///< LBVH followed by treelet restructuring
+    sbvh_build          ///< SAH with spatial splits (sbvh_builder), best for large overlapping primitives
+};
+
+/**
+ * @brief Parse a build method name ("sah", "lbvh", "lbvh-treelet" or "sbvh")
+ * @param name Name to parse
+ * @param method Parsed method (output)
+ * @return False if the name is unknown
+ */
+inline bool parse_bvh_build_method(const std::string &name, bvh_build_method &method)
+{
+    if (name == "sah")
+        method = sah_build;
+    else if (name == "lbvh")
+        method = lbvh_build;
+    else if (name == "lbvh-treelet")
+        method = lbvh_treelet_build;
+    else if (name == "sbvh")
+        method = sbvh_build;
+    else
+        return false;
+    return true;
+}
+
+/**
+ * @brief Build a tree with the chosen method
+ * @param tree Tree to build
+ * @param bounds Bounding box of every primitive
+ * @param method Build algorithm
+ * @param clip Exact primitive clipping for spatial splits (see sbvh_builder::clip); optional
+ * @return Primitive indices in leaf order; with sbvh_build a primitive can appear more than once
+ */
+inline std::vector<uint32_t> build_bvh(bvh_tree &tree, const std::vector<aabb> &bounds, bvh_build_method method,
+                                       const sbvh_builder::clip_function &clip = nullptr)
+{
+    if (method == lbvh_build || method == lbvh_treelet_build)
+    {
+        lbvh_builder builder;
+        builder.optimize_treelets = method == lbvh_treelet_build;
+        return builder.build(tree, bounds);
+    }
+    if (method == sbvh_build)
+    {
+        sbvh_builder builder;
+        builder.clip = clip;
+        return builder.build(tree, bounds);
+    }
+    return tree.build(bounds);
+}
+
+#endif
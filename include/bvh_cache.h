@@ -0,0 +1,254 @@
+#ifndef BVH_CACHE_H
+#define BVH_CACHE_H
+
+#include "bvh.h"
+#include "content_hash.h"
+#include "mapped_file.h"
+#include "material.h"
+#include "obj_loader.h"
+#include "rtweekend.h"
+#include "trace.h"
+#include "triangle_mesh.h"
+
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <string>
+
+/**
+ * @file bvh_cache.h
+ * @brief On-disk cache of meshes with their prebuilt BVH
+ *
+ * This file implements a cache for the most expensive part of scene setup:
+ * parsing a large OBJ file and building the BVH over its triangles. The
+ * vertex, index and node arrays of a built mesh are written to one binary
+ * file named after a hash of the OBJ contents. The arrays are stored in
+ * exactly their in-memory layout at aligned offsets, and nodes refer to
+ * each other by index, so a cached mesh is loaded by mapping the file:
+ * there is no parsing, no building and no pointer fixup, and pages are
+ * read from disk only when rays reach them.
+ *
+ * The file records the format version, byte order and element sizes;
+ * files written by a different build are rebuilt instead of loaded.
+ */
+
+/**
+ * @class bvh_cache
+ * @brief Directory of cached meshes keyed by the hash of their source file
+ */
+class bvh_cache
+{
+public:
+    std::string directory; ///< Cache directory (created on first store)
+    std::string error;     ///< Description of the last failure
+
+    /**
+     * @brief Constructor
+     * @param directory Cache directory
+     */
+    explicit bvh_cache(std::string directory) : directory(std::move(directory)) {}
+
+    /**
+     * @brief Load a mesh from an OBJ file, through the cache
+     * @param path OBJ file
+     * @param mat Material applied to the whole mesh
+     * @param cached Set to true if the mesh came from the cache (output)
+     * @param method Algorithm used to build the BVH on a miss (part of the key)
+     * @return The mesh, or nullptr if the OBJ file could not be loaded
+     *
+     * On a miss the OBJ file is parsed and built as usual and the result is
+     * stored for the next run. A failure to store is not an error.
+     */
+    shared_ptr<triangle_mesh> load_obj(const std::string &path, shared_ptr<material> mat, bool &cached,
+                                       bvh_build_method method = sah_build)
+    {
+        cached = false;
+        content_hash hash;
+        hash.add(uint64_t(format_version));
+        hash.add(uint64_t(bvh_tree().max_leaf_size));
+        if (method != sah_build)
+            hash.add(uint64_t(method));
+        if (!hash.add_file(path))
+        {
+            error = "cannot read " + path;
+            return nullptr;
+        }
+        std::string cache_path = directory + "/" + hash.hex() + ".bvh";
+
+        if (auto mesh = load(cache_path, mat))
+        {
+            cached = true;
+            return mesh;
+        }
+
+        obj_loader loader;
+        if (!loader.load(path))
+        {
+            error = loader.error;
+            return nullptr;
+        }
+        auto mesh = loader.make_mesh(mat, method);
+
+        std::error_code code;
+        std::filesystem::create_directories(directory, code);
+        if (!save(cache_path, *mesh))
+            std::clog << "Cannot store " << cache_path << " in the BVH cache\n";
+        return mesh;
+    }
+
+    /**
+     * @brief Map a cached mesh
+     * @param path Cache file
+     * @param mat Material applied to the whole mesh
+     * @return The mesh, or nullptr if the file is missing or was written by an incompatible build
+     */
+    shared_ptr<triangle_mesh> load(const std::string &path, shared_ptr<material> mat)
+    {
+        trace_scope scope("load BVH cache", "io");
+
+        auto file = mapped_file::open(path, error);
+        if (!file)
+            return nullptr;
+
+        file_header header;
+        if (file->size() < sizeof(header))
+            return invalid(path);
+        std::memcpy(&header, file->data(), sizeof(header));
+        if (std::memcmp(header.magic, magic, sizeof(magic)) != 0 || header.version != format_version ||
+            header.byte_order != byte_order_mark || header.vertex_size != sizeof(point3) ||
+            header.node_size != sizeof(bvh_node) || header.node_count == 0 || header.index_count % 3 != 0 ||
+            header.triangle_count == 0 || header.triangle_count > header.index_count / 3 ||
+            (header.reference_count != 0 && header.reference_count != header.index_count / 3) ||
+            !section_fits(*file, header.vertex_offset, header.vertex_count, sizeof(point3)) ||
+            !section_fits(*file, header.index_offset, header.index_count, sizeof(uint32_t)) ||
+            !section_fits(*file, header.node_offset, header.node_count, sizeof(bvh_node)) ||
+            !section_fits(*file, header.reference_offset, header.reference_count, sizeof(uint32_t)))
+            return invalid(path);
+
+        bvh_tree bvh;
+        bvh.assign(mapped_array<bvh_node>(file, header.node_offset, header.node_count), header.split_cost);
+        return make_shared<triangle_mesh>(mapped_array<point3>(file, header.vertex_offset, header.vertex_count),
+                                          mapped_array<uint32_t>(file, header.index_offset, header.index_count),
+                                          std::move(bvh), mat, header.triangle_count,
+                                          mapped_array<uint32_t>(file, header.reference_offset, header.reference_count));
+    }
+
+    /**
+     * @brief Write a mesh with its BVH to a cache file
+     * @param path Cache file
+     * @param mesh Mesh to store
+     * @return False if the file could not be written
+     */
+    bool save(const std::string &path, const triangle_mesh &mesh)
+    {
+        trace_scope scope("store BVH cache", "io");
+
+        const auto &vertices = mesh.vertex_array();
+        const auto &indices = mesh.index_array();
+        const auto &nodes = mesh.tree().nodes;
+        const auto &references = mesh.reference_array();
+        if (nodes.empty())
+        {
+            error = "the mesh has no full-precision BVH to store";
+            return false;
+        }
+
+        file_header header;
+        std::memset(&header, 0, sizeof(header));
+        std::memcpy(header.magic, magic, sizeof(magic));
+        header.version = format_version;
+        header.byte_order = byte_order_mark;
+        header.vertex_size = sizeof(point3);
+        header.node_size = sizeof(bvh_node);
+        header.vertex_count = vertices.size();
+        header.index_count = indices.size();
+        header.node_count = nodes.size();
+        header.triangle_count = mesh.triangle_count();
+        header.reference_count = references.size();
+        header.vertex_offset = align(sizeof(header));
+        header.index_offset = align(header.vertex_offset + vertices.size() * sizeof(point3));
+        header.node_offset = align(header.index_offset + indices.size() * sizeof(uint32_t));
+        header.reference_offset = align(header.node_offset + nodes.size() * sizeof(bvh_node));
+        header.split_cost = mesh.tree().built_split_cost();
+
+        // Write to a temporary file of this writer, so concurrent readers never map a partial file and
+        // concurrent writers never truncate a file another one has already renamed into place
+        std::string temp_path = temporary_path(path);
+        {
+            std::ofstream out(temp_path, std::ios::binary | std::ios::trunc);
+            write_section(out, 0, &header, sizeof(header));
+            write_section(out, header.vertex_offset, vertices.data(), vertices.size() * sizeof(point3));
+            write_section(out, header.index_offset, indices.data(), indices.size() * sizeof(uint32_t));
+            write_section(out, header.node_offset, nodes.data(), nodes.size() * sizeof(bvh_node));
+            write_section(out, header.reference_offset, references.data(), references.size() * sizeof(uint32_t));
+            if (!out)
+            {
+                out.close();
+                std::remove(temp_path.c_str());
+                error = "cannot write " + temp_path;
+                return false;
+            }
+        }
+        if (std::rename(temp_path.c_str(), path.c_str()) != 0)
+        {
+            std::remove(temp_path.c_str());
+            error = "cannot write " + path;
+            return false;
+        }
+        return true;
+    }
+
+private:
+    static constexpr char magic[8] = {'R', 'T', 'B', 'V', 'H', 'C', 0, 0}; ///< File signature
+    static constexpr uint32_t format_version = 3;           ///< Bump when the mesh, node or loader format changes
+    static constexpr uint32_t byte_order_mark = 0x01020304; ///< Reads differently on other byte orders
+    static constexpr size_t section_alignment = 64;         ///< Alignment of the arrays (one cache line)
+
+    /**
+     * @brief Fixed-size header at the start of a cache file
+     */
+    struct file_header
+    {
+        char magic[8];             ///< File signature
+        uint32_t version;          ///< Format version
+        uint32_t byte_order;       ///< byte_order_mark as written
+        uint32_t vertex_size;      ///< sizeof(point3) of the writer
+        uint32_t node_size;        ///< sizeof(bvh_node) of the writer
+        uint64_t vertex_count;     ///< Number of vertices
+        uint64_t index_count;      ///< Number of indices (three per leaf reference)
+        uint64_t triangle_count;   ///< Number of distinct triangles (spatial splits repeat some)
+        uint64_t node_count;       ///< Number of BVH nodes
+        uint64_t vertex_offset;    ///< Byte offset of the vertex array
+        uint64_t index_offset;     ///< Byte offset of the index array
+        uint64_t node_offset;      ///< Byte offset of the node array
+        double split_cost;         ///< bvh_tree::built_split_cost() of the tree
+        uint64_t reference_count;  ///< Number of entries of the reference array (0 if no triangle is repeated)
+        uint64_t reference_offset; ///< Byte offset of the reference array
+    };
+
+    static size_t align(size_t offset) { return (offset + section_alignment - 1) / section_alignment * section_alignment; }
+
+    static bool section_fits(const mapped_file &file, uint64_t offset, uint64_t count, size_t element_size)
+    {
+        return offset % section_alignment == 0 && offset <= file.size() &&
+               count <= (file.size() - offset) / element_size;
+    }
+
+    static void write_section(std::ofstream &out, uint64_t offset, const void *data, size_t size)
+    {
+        static const char padding[section_alignment] = {};
+        if (!out)
+            return;
+        out.write(padding, std::streamsize(offset - uint64_t(out.tellp())));
+        out.write(static_cast<const char *>(data), std::streamsize(size));
+    }
+
+    shared_ptr<triangle_mesh> invalid(const std::string &path)
+    {
+        error = path + " is not a compatible BVH cache file";
+        return nullptr;
+    }
+};
+
+#endif
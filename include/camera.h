@@ -1,8 +1,24 @@
 #ifndef CAMERA_H
 #define CAMERA_H
 
+#include "checkpoint.h"
+#include "content_hash.h"
+#include "heatmap.h"
 #include "hittable.h"
 #include "material.h"
+#include "ray_sort.h"
+#include "render_stats.h"
+#include "scheduler.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <mutex>
+#include <string>
+#include <vector>
 
 /**
  * @file camera.h
@@ -46,41 +62,318 @@ public:
     double defocus_angle = 0;
     double focus_dist = 10;
 
+    // ============================================================================
+    // Sampling and Checkpoint Parameters
+    // ============================================================================
+
+    uint64_t seed = 0;               ///< Base seed of the per-sample random streams
+    std::string checkpoint_path;     ///< Checkpoint file (empty disables checkpointing)
+    double checkpoint_interval = 60; ///< Seconds between periodic checkpoints
+    bool resume = false;             ///< Continue from checkpoint_path if it exists
+    uint64_t scene_hash = 0;         ///< Hash of the scene inputs, checked on resume (see scene_description::add_contents)
+    bool show_progress = true;       ///< Report remaining tiles on std::clog
+    std::string stats_path;          ///< JSON ray statistics file (RT_ENABLE_STATS builds only)
+
+    // ============================================================================
+    // Region of Interest Parameters
+    // ============================================================================
+
+    int crop_x = 0;               ///< Left column of the crop window
+    int crop_y = 0;               ///< Top row of the crop window
+    int crop_width = 0;           ///< Width of the crop window (0 renders the full image)
+    int crop_height = 0;          ///< Height of the crop window (0 renders the full image)
+    bool crop_full_frame = false; ///< Output the full-size image with only the crop filled
+
+    // ============================================================================
+    // Instrumentation Parameters
+    // ============================================================================
+
+    std::string heatmap_prefix;         ///< Write <prefix>.ppm and <prefix>.pfm cost heatmaps (empty disables)
+    bool heatmap_intersections = false; ///< Measure sphere and triangle tests instead of time (RT_ENABLE_STATS builds only)
+
+    // ============================================================================
+    // Parallelism Parameters
+    // ============================================================================
+
+    int thread_count = 0;            ///< Worker threads (0 = number of hardware threads)
+    int tile_size = 16;              ///< Edge length of the square render tiles in pixels
+    bool sort_rays = false;          ///< Trace tiles bounce by bounce in batches sorted by ray origin and direction
+    bool scheduler_report = false;   ///< Print per-worker busy/idle time after rendering
+    shared_ptr<thread_pool> pool;    ///< Worker threads, created on first render if not set
+
     /**
      * @brief Render the scene to PPM format
      * @param world The scene containing hittable objects
+     * @param out Output stream for the PPM image (standard output by default)
      *
      * Main rendering function that generates rays for each pixel,
      * performs Monte Carlo sampling for anti-aliasing, and outputs
-     * the result in PPM format to standard output.
+     * the result in PPM format.
+     *
+     * When a checkpoint path is set, the accumulation buffer is saved
+     * periodically. With resume enabled, samples already stored in the
+     * checkpoint are skipped, and the final image is identical to an
+     * uninterrupted render.
+     *
+     * With a crop window only the pixels inside it are traced. They get
+     * exactly the samples of a full render, so a crop can be pasted into
+     * (or compared against) the full image.
      */
-    void render(const hittable &world)
+    void render(const hittable &world, std::ostream &out = std::cout)
     {
-        initialize();
+        render_views({this}, world, {&out});
+    }
 
-        // Output PPM header
-        std::cout << "P3\n"
-                  << image_width << ' ' << image_height << "\n255\n";
+    /**
+     * @brief Render several views of one scene in a single pass
+     * @param views Cameras to render (each with its own settings)
+     * @param world The scene shared by all views
+     * @param outputs Output stream of every view, in the same order
+     *
+     * The tiles of all views are ordered by estimated cost and scheduled
+     * together on the worker pool of the first camera, which the other
+     * cameras share afterwards. Cores stay busy until the last tile of
+     * the last view instead of idling at the end of every view. Each view
+     * keeps its own checkpoint, heatmap and statistics paths; statistics
+     * cover the whole pass.
+     */
+    static void render_views(const std::vector<Camera *> &views, const hittable &world,
+                             const std::vector<std::ostream *> &outputs)
+    {
+        trace_scope frame_scope("render frame");
+
+        Camera &lead = *views.front();
+        if (!lead.pool)
+            lead.pool = make_shared<thread_pool>(lead.thread_count);
+
+        // Set up every view and collect its tiles with their estimated costs
+        std::vector<view_tile> tiles;
+        for (size_t view = 0; view < views.size(); view++)
+        {
+            Camera &cam = *views[view];
+            cam.pool = lead.pool;
+            cam.initialize();
+            cam.begin_frame();
+
+            auto view_tiles = cam.make_tiles();
+            cam.estimate_tile_costs(view_tiles, world);
+            for (size_t t = 0; t < view_tiles.size(); t++)
+                tiles.push_back({int(view), int(t), view_tiles[t]});
+        }
 
-        // Render each pixel
-        for (int j = 0; j < image_height; j++)
+        // A task is one tile, or with sorted tracing a run of neighbouring tiles of one view, so that
+        // each sorted batch holds enough paths to find coherent rays among them
+        std::vector<size_t> task_start;
+        std::vector<double> task_cost;
+        size_t task_paths = 0;
+        for (size_t t = 0; t < tiles.size(); t++)
         {
-            std::clog << "\rScanlines remaining: " << (image_height - j) << ' ' << std::flush;
-            for (int i = 0; i < image_width; i++)
+            const Camera &cam = *views[tiles[t].view];
+            const render_tile &tile = tiles[t].tile;
+            size_t paths = size_t(tile.x1 - tile.x0) * (tile.y1 - tile.y0) * std::max(cam.samples_per_pixel, 1);
+            bool batched = cam.sort_rays && cam.heatmap_prefix.empty();
+            if (t == 0 || !batched || tiles[t - 1].view != tiles[t].view || task_paths + paths > ray_batch_size)
             {
-                // Monte Carlo sampling for anti-aliasing
-                color pixel_color(0, 0, 0);
-                for (int sample = 0; sample < samples_per_pixel; sample++)
+                task_start.push_back(t);
+                task_cost.push_back(0);
+                task_paths = 0;
+            }
+            task_paths += paths;
+            task_cost.back() += tile.cost;
+        }
+        task_start.push_back(tiles.size());
+
+        // Order tasks by estimated cost so expensive tiles start first
+        std::vector<int> order(task_cost.size());
+        for (size_t t = 0; t < task_cost.size(); t++)
+            order[t] = int(t);
+        std::stable_sort(order.begin(), order.end(), [&](int a, int b) { return task_cost[a] > task_cost[b]; });
+
+        ray_stats::reset();
+
+        pass_progress pass;
+        pass.tiles_left = tiles.size();
+        pass.show = lead.show_progress;
+        std::vector<frame_progress> progress(views.size());
+        for (auto &view_progress : progress)
+            view_progress.last_checkpoint = std::chrono::steady_clock::now();
+
+        work_stealing_scheduler scheduler;
+        auto reports = scheduler.run(*lead.pool, order, [&](int t, int) {
+            const view_tile *first = &tiles[task_start[t]];
+            views[first->view]->render_tile_pixels(first, task_start[t + 1] - task_start[t], world,
+                                                   progress[first->view], pass);
+        });
+
+        if (pass.show)
+            std::clog << "\rDone.                 \n";
+
+        for (size_t view = 0; view < views.size(); view++)
+        {
+            Camera &cam = *views[view];
+            if (!cam.checkpoint_path.empty())
+                cam.save_checkpoint();
+            cam.write_image(*outputs[view]);
+            cam.report_stats();
+            cam.write_heatmap();
+        }
+
+        if (lead.scheduler_report)
+            lead.print_scheduler_report(reports);
+    }
+
+    // ============================================================================
+    // Externally Scheduled Rendering
+    // ============================================================================
+
+    /**
+     * @brief Start a frame whose tiles are rendered elsewhere
+     * @return Tiles of the frame that still miss samples
+     *
+     * Used by the distributed coordinator: tiles are traced by other
+     * processes with trace_tile(), returned with commit_tile() and the
+     * image is written with finish_frame(). With resume enabled, the
+     * frame starts from the checkpoint and complete tiles are skipped.
+     */
+    std::vector<render_tile> begin_external_frame()
+    {
+        initialize();
+        begin_frame();
+
+        std::vector<render_tile> missing;
+        for (const auto &tile : make_tiles())
+        {
+            bool complete = true;
+            for (int j = tile.y0; j < tile.y1 && complete; j++)
+                for (int i = tile.x0; i < tile.x1 && complete; i++)
+                    complete = frame.sample_counts[size_t(j) * image_width + i] >= samples_per_pixel;
+            if (!complete)
+                missing.push_back(tile);
+        }
+        return missing;
+    }
+
+    /**
+     * @brief Check that a tile lies inside the image of the current frame
+     * @param tile Tile to check
+     * @return True if 0 <= x0 < x1 <= image_width and 0 <= y0 < y1 <= image height
+     */
+    bool valid_tile(const render_tile &tile) const
+    {
+        return 0 <= tile.x0 && tile.x0 < tile.x1 && tile.x1 <= image_width && 0 <= tile.y0 && tile.y0 < tile.y1 &&
+               tile.y1 <= image_height;
+    }
+
+    /**
+     * @brief Take all samples of the pixels of one tile
+     * @param world The scene containing hittable objects
+     * @param tile Tile to trace
+     * @param accumulated Summed radiance per pixel of the tile, row-major (output)
+     *
+     * Rows are traced in parallel on the camera's worker pool. The result
+     * is exactly what a local render accumulates for these pixels.
+     */
+    void trace_tile(const hittable &world, const render_tile &tile, std::vector<color> &accumulated)
+    {
+        trace_scope scope("trace remote tile");
+
+        initialize();
+        if (!pool)
+            pool = make_shared<thread_pool>(thread_count);
+
+        int width = tile.x1 - tile.x0;
+        accumulated.assign(size_t(width) * (tile.y1 - tile.y0), color(0, 0, 0));
+        std::atomic<int> next_row{tile.y0};
+        pool->run([&](int) {
+            for (int j; (j = next_row++) < tile.y1;)
+            {
+                if (sort_rays)
                 {
-                    ray r = get_ray(i, j);
-                    pixel_color += ray_color(r, max_depth, world);
+                    render_tile row = tile;
+                    row.y0 = j;
+                    row.y1 = j + 1;
+                    std::vector<color> colors(width, color(0, 0, 0));
+                    std::vector<int> counts(width, 0);
+                    render_tiles_sorted({row}, world, colors, counts);
+                    std::copy(colors.begin(), colors.end(), accumulated.begin() + size_t(j - tile.y0) * width);
+                    continue;
+                }
+                for (int i = tile.x0; i < tile.x1; i++)
+                {
+                    int count = 0;
+                    render_pixel(i, j, world, accumulated[size_t(j - tile.y0) * width + (i - tile.x0)], count);
                 }
+            }
+        });
+    }
 
-                // Average samples and output color
-                write_color(std::cout, pixel_samples_scale * pixel_color);
+    /**
+     * @brief Store the result of trace_tile() in the frame
+     * @param tile Tile that was traced
+     * @param accumulated Summed radiance per pixel of the tile, row-major
+     */
+    void commit_tile(const render_tile &tile, const std::vector<color> &accumulated)
+    {
+        int width = tile.x1 - tile.x0;
+        for (int j = tile.y0; j < tile.y1; j++)
+        {
+            for (int i = tile.x0; i < tile.x1; i++)
+            {
+                size_t pixel_index = size_t(j) * image_width + i;
+                frame.accumulated[pixel_index] = accumulated[size_t(j - tile.y0) * width + (i - tile.x0)];
+                frame.sample_counts[pixel_index] = samples_per_pixel;
             }
         }
-        std::clog << "\rDone.      \n";
+    }
+
+    /**
+     * @brief Save the frame of an externally scheduled render to checkpoint_path
+     */
+    void checkpoint_external_frame() const
+    {
+        if (!checkpoint_path.empty())
+            save_checkpoint();
+    }
+
+    /**
+     * @brief Write the image of an externally scheduled frame
+     * @param out Output stream for the PPM image
+     */
+    void finish_frame(std::ostream &out)
+    {
+        checkpoint_external_frame();
+        write_image(out);
+    }
+
+    /**
+     * @brief Add every setting that affects pixel values, except the sample count
+     * @param hash Hash to extend
+     */
+    void add_settings(content_hash &hash) const
+    {
+        hash.add(aspect_ratio);
+        hash.add(uint64_t(image_width));
+        hash.add(uint64_t(max_depth));
+        hash.add(seed);
+        hash.add(vfov);
+        hash.add(lookfrom);
+        hash.add(lookat);
+        hash.add(vup);
+        hash.add(defocus_angle);
+        hash.add(focus_dist);
+        for (int value : {crop_x, crop_y, crop_width, crop_height, int(crop_full_frame)})
+            hash.add(uint64_t(int64_t(value)));
+    }
+
+    /**
+     * @brief Hash of the scene and camera settings a checkpoint must have been written with
+     */
+    uint64_t settings_hash() const
+    {
+        content_hash hash;
+        hash.add(scene_hash);
+        add_settings(hash);
+        return hash.value();
     }
 
 private:
@@ -88,6 +381,8 @@ private:
     // Private Member Variables
     // ============================================================================
 
+    static constexpr size_t ray_batch_size = size_t(1) << 14; ///< Largest batch of paths traced together with sort_rays (about 2 MB of paths)
+
     int image_height;           ///< Calculated image height based on aspect ratio
     double pixel_samples_scale; ///< Scale factor for averaging samples (1/samples_per_pixel)
     point3 center;              ///< Camera center (pinhole position)
@@ -97,6 +392,39 @@ private:
     vec3 u, v, w;               ///< Camera coordinate system basis vectors
     vec3 defocus_disk_u;
     vec3 defocus_disk_v;
+    int region_x0, region_y0;   ///< First column and row of the rendered region
+    int region_x1, region_y1;   ///< End column and row (exclusive) of the rendered region
+    render_checkpoint frame;    ///< Accumulation buffer and per-pixel sample counts
+    std::vector<double> pixel_cost; ///< Measured cost per pixel (heatmap mode only)
+
+    /**
+     * @brief Shared bookkeeping of the tiles of a frame in flight
+     */
+    struct frame_progress
+    {
+        std::mutex mutex;                                     ///< Guards frame updates and checkpoints
+        std::chrono::steady_clock::time_point last_checkpoint; ///< Time of the last checkpoint
+    };
+
+    /**
+     * @brief Progress of a render pass over one or more views
+     */
+    struct pass_progress
+    {
+        std::mutex mutex;      ///< Guards the counter and progress output
+        size_t tiles_left = 0; ///< Tiles of all views not yet committed
+        bool show = true;      ///< Report remaining tiles on std::clog
+    };
+
+    /**
+     * @brief A tile of one view in a multi-view pass
+     */
+    struct view_tile
+    {
+        int view;         ///< Index of the view the tile belongs to
+        int index;        ///< Index of the tile within its view
+        render_tile tile; ///< Pixel bounds and estimated cost
+    };
 
     /**
      * @brief Initialize camera parameters and compute derived values
@@ -144,6 +472,481 @@ private:
         auto defocus_radius = focus_dist * std::tan(degrees_to_radians(defocus_angle / 2));
         defocus_disk_u = u * defocus_radius;
         defocus_disk_v = v * defocus_radius;
+
+        // Clip the crop window to the image
+        region_x0 = 0, region_y0 = 0, region_x1 = image_width, region_y1 = image_height;
+        if (crop_width > 0 && crop_height > 0)
+        {
+            region_x0 = std::clamp(crop_x, 0, image_width);
+            region_y0 = std::clamp(crop_y, 0, image_height);
+            region_x1 = std::clamp(crop_x + crop_width, region_x0, image_width);
+            region_y1 = std::clamp(crop_y + crop_height, region_y0, image_height);
+        }
+    }
+
+    /**
+     * @brief Prepare the accumulation buffer for a new frame
+     *
+     * Starts from an empty buffer, or from the checkpoint file when resume
+     * is enabled and the checkpoint matches the current render settings.
+     */
+    void begin_frame()
+    {
+        if (!heatmap_prefix.empty())
+            pixel_cost.assign(size_t(image_width) * image_height, 0.0);
+#ifndef RT_ENABLE_STATS
+        if (!heatmap_prefix.empty() && heatmap_intersections)
+            std::clog << "Intersection counts need RT_ENABLE_STATS, the heatmap " << heatmap_prefix << " measures time\n";
+#endif
+
+        if (resume && !checkpoint_path.empty())
+        {
+            render_checkpoint saved;
+            if (!saved.load(checkpoint_path))
+                std::clog << "No usable checkpoint at " << checkpoint_path << ", starting fresh\n";
+            else if (saved.image_width != image_width || saved.image_height != image_height ||
+                     saved.max_depth != max_depth || saved.seed != seed || saved.fingerprint != settings_hash())
+                std::clog << "Checkpoint " << checkpoint_path << " does not match the render settings, starting fresh\n";
+            else
+            {
+                frame = std::move(saved);
+                return;
+            }
+        }
+
+        frame.image_width = image_width;
+        frame.image_height = image_height;
+        frame.max_depth = max_depth;
+        frame.seed = seed;
+        frame.fingerprint = settings_hash();
+        frame.sample_counts.assign(size_t(image_width) * image_height, 0);
+        frame.accumulated.assign(size_t(image_width) * image_height, color(0, 0, 0));
+    }
+
+    /**
+     * @brief Split the rendered region into square tiles
+     * @return Tiles covering the crop window (or the whole image) in row-major order
+     */
+    std::vector<render_tile> make_tiles() const
+    {
+        int size = tile_size > 0 ? tile_size : 16;
+        std::vector<render_tile> tiles;
+        for (int y = region_y0; y < region_y1; y += size)
+            for (int x = region_x0; x < region_x1; x += size)
+                tiles.push_back({x, y, std::min(x + size, region_x1), std::min(y + size, region_y1)});
+        return tiles;
+    }
+
+    /**
+     * @brief Estimate the cost of every tile with a cheap low-sample pass
+     * @param tiles Tiles to estimate; their cost field is filled in
+     * @param world The scene containing hittable objects
+     *
+     * Traces one path through a sparse 4x4 grid of pixels per tile and
+     * scales the measured time by the number of samples still missing.
+     * The pass uses its own random streams and does not touch the image.
+     */
+    void estimate_tile_costs(std::vector<render_tile> &tiles, const hittable &world) const
+    {
+        trace_scope scope("estimate tile costs");
+
+        const uint64_t estimate_seed = mix_bits(seed ^ 0x5eedc057ULL);
+        std::atomic<size_t> next_tile{0};
+
+        pool->run([&](int) {
+            for (size_t t; (t = next_tile++) < tiles.size();)
+            {
+                auto &tile = tiles[t];
+                int step_x = std::max(1, (tile.x1 - tile.x0) / 4);
+                int step_y = std::max(1, (tile.y1 - tile.y0) / 4);
+                int probes = 0;
+                double seconds = 0;
+
+                for (int j = tile.y0; j < tile.y1; j += step_y)
+                {
+                    for (int i = tile.x0; i < tile.x1; i += step_x)
+                    {
+                        size_t pixel_index = size_t(j) * image_width + i;
+                        int missing = samples_per_pixel - frame.sample_counts[pixel_index];
+                        probes++;
+                        if (missing <= 0)
+                            continue;
+
+                        auto start = std::chrono::steady_clock::now();
+                        thread_random_generator().state = sample_seed(estimate_seed, pixel_index, 0);
+                        ray_color(get_ray(i, j), max_depth, world);
+                        seconds += missing * std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+                    }
+                }
+
+                double tile_pixels = double(tile.x1 - tile.x0) * (tile.y1 - tile.y0);
+                tile.cost = seconds * tile_pixels / probes;
+            }
+        });
+    }
+
+    /**
+     * @brief Render all pixels of a run of tiles and commit them to the frame
+     * @param first First tile of the run
+     * @param tile_count Number of tiles in the run
+     * @param world The scene containing hittable objects
+     * @param progress Shared frame bookkeeping
+     * @param pass Progress of the whole render pass
+     *
+     * Pixels are rendered into a task-local buffer and copied into the
+     * frame under the progress mutex, so checkpoints only ever contain
+     * fully committed tiles. Sorted tracing batches the paths of all tiles
+     * of the run together.
+     */
+    void render_tile_pixels(const view_tile *first, size_t tile_count, const hittable &world, frame_progress &progress,
+                            pass_progress &pass)
+    {
+        trace_scope scope("render tile", "render", first->index);
+
+        std::vector<render_tile> run;
+        size_t count = 0;
+        for (size_t t = 0; t < tile_count; t++)
+        {
+            run.push_back(first[t].tile);
+            count += size_t(run.back().x1 - run.back().x0) * (run.back().y1 - run.back().y0);
+        }
+        std::vector<color> colors(count);
+        std::vector<int> counts(count);
+
+        // Only this worker writes the pixels of these tiles, so they can be read without locking
+        size_t local = 0;
+        for (const auto &tile : run)
+        {
+            for (int j = tile.y0; j < tile.y1; j++)
+            {
+                for (int i = tile.x0; i < tile.x1; i++, local++)
+                {
+                    size_t pixel_index = size_t(j) * image_width + i;
+                    colors[local] = frame.accumulated[pixel_index];
+                    counts[local] = frame.sample_counts[pixel_index];
+
+                    if (!heatmap_prefix.empty())
+                        render_pixel_measured(i, j, world, colors[local], counts[local]);
+                    else if (!sort_rays)
+                        render_pixel(i, j, world, colors[local], counts[local]);
+                }
+            }
+        }
+
+        // Heatmaps time pixels one by one, so they keep per-pixel tracing
+        if (sort_rays && heatmap_prefix.empty())
+            render_tiles_sorted(run, world, colors, counts);
+
+        {
+            std::lock_guard<std::mutex> lock(progress.mutex);
+            local = 0;
+            for (const auto &tile : run)
+            {
+                for (int j = tile.y0; j < tile.y1; j++)
+                {
+                    for (int i = tile.x0; i < tile.x1; i++, local++)
+                    {
+                        size_t pixel_index = size_t(j) * image_width + i;
+                        frame.accumulated[pixel_index] = colors[local];
+                        frame.sample_counts[pixel_index] = counts[local];
+                    }
+                }
+            }
+
+            if (!checkpoint_path.empty())
+            {
+                auto now = std::chrono::steady_clock::now();
+                if (std::chrono::duration<double>(now - progress.last_checkpoint).count() >= checkpoint_interval)
+                {
+                    save_checkpoint();
+                    progress.last_checkpoint = now;
+                }
+            }
+        }
+
+        std::lock_guard<std::mutex> lock(pass.mutex);
+        pass.tiles_left -= tile_count;
+        if (pass.show)
+            std::clog << "\rTiles remaining: " << pass.tiles_left << ' ' << std::flush;
+    }
+
+    /**
+     * @brief Take the missing samples of one pixel
+     * @param i Horizontal pixel coordinate
+     * @param j Vertical pixel coordinate
+     * @param world The scene containing hittable objects
+     * @param pixel_color Accumulated radiance of the pixel (updated)
+     * @param count Samples already taken (updated)
+     *
+     * Every sample reseeds the thread's random generator from the pixel
+     * and sample index, so the samples are the same no matter when, on
+     * which thread or in which order they are taken.
+     */
+    void render_pixel(int i, int j, const hittable &world, color &pixel_color, int &count) const
+    {
+        size_t pixel_index = size_t(j) * image_width + i;
+
+        // Monte Carlo sampling for anti-aliasing
+        for (; count < samples_per_pixel; count++)
+        {
+            thread_random_generator().state = sample_seed(seed, pixel_index, count);
+            ray r = get_ray(i, j);
+            RT_STAT_INC(primary_rays);
+            pixel_color += ray_color(r, max_depth, world);
+        }
+    }
+
+    /**
+     * @brief Take the missing samples of the pixels of some tiles in sorted batches
+     * @param tiles Tiles to render
+     * @param world The scene containing hittable objects
+     * @param colors Accumulated radiance of every pixel, tile by tile and row by row (updated)
+     * @param counts Samples already taken of every pixel, in the order of colors (updated)
+     *
+     * Instead of following one path to its end before starting the next,
+     * a batch of samples advances one bounce at a time. Before every bounce
+     * after the camera rays, the surviving paths are reordered with
+     * sort_by_ray_key(), so scattered rays that start close together and
+     * head the same way are traced one after another.
+     *
+     * Every path keeps its own random generator state, and the
+     * attenuations are multiplied in the order ray_color() uses, so the
+     * samples are bit-identical to those of render_pixel().
+     */
+    void render_tiles_sorted(const std::vector<render_tile> &tiles, const hittable &world, std::vector<color> &colors,
+                             std::vector<int> &counts) const
+    {
+        struct path
+        {
+            ray r;           ///< Ray of the next bounce
+            uint64_t random; ///< Random generator state of the path
+            uint32_t slot;   ///< Sample of the batch the path belongs to
+        };
+        struct scatter_event
+        {
+            uint32_t slot;     ///< Sample of the batch
+            color attenuation; ///< Attenuation of one bounce
+        };
+
+        // Image coordinates of every buffer pixel
+        size_t pixel_count = colors.size();
+        std::vector<std::pair<int, int>> coordinates;
+        coordinates.reserve(pixel_count);
+        for (const auto &tile : tiles)
+            for (int j = tile.y0; j < tile.y1; j++)
+                for (int i = tile.x0; i < tile.x1; i++)
+                    coordinates.push_back({i, j});
+
+        std::vector<uint32_t> slot_pixel;  // Buffer pixel of every sample of the batch
+        std::vector<color> radiance;       // Light reaching the end of every path
+        std::vector<scatter_event> events; // Attenuations in bounce order
+        std::vector<path> paths, survivors;
+
+        // Batches are filled sample by sample over the tiles, so every pixel gets its samples in order
+        int sample = *std::min_element(counts.begin(), counts.end());
+        size_t pixel = 0;
+        while (sample < samples_per_pixel)
+        {
+            slot_pixel.clear();
+            paths.clear();
+            for (; sample < samples_per_pixel && slot_pixel.size() < ray_batch_size;)
+            {
+                if (sample >= counts[pixel])
+                {
+                    auto [i, j] = coordinates[pixel];
+                    thread_random_generator().state = sample_seed(seed, size_t(j) * image_width + i, sample);
+                    ray r = get_ray(i, j);
+                    RT_STAT_INC(primary_rays);
+                    paths.push_back({r, thread_random_generator().state, uint32_t(slot_pixel.size())});
+                    slot_pixel.push_back(uint32_t(pixel));
+                }
+                if (++pixel == pixel_count)
+                {
+                    pixel = 0;
+                    sample++;
+                }
+            }
+
+            radiance.assign(slot_pixel.size(), color(0, 0, 0));
+            events.clear();
+            for (int depth = max_depth; !paths.empty(); depth--)
+            {
+                if (depth <= 0)
+                {
+                    for (size_t k = 0; k < paths.size(); k++)
+                        RT_STAT_INC(paths_depth_limit);
+                    break;
+                }
+                if (depth < max_depth)
+                    sort_by_ray_key(paths, [](const path &p) -> const ray & { return p.r; });
+
+                survivors.clear();
+                for (const auto &p : paths)
+                {
+                    if (depth < max_depth)
+                        RT_STAT_INC(secondary_rays);
+
+                    thread_random_generator().state = p.random;
+                    hit_record rec;
+                    if (!world.hit(p.r, interval(0.001, infinity), rec))
+                    {
+                        RT_STAT_INC(paths_escaped);
+                        radiance[p.slot] = background(p.r);
+                        continue;
+                    }
+
+                    ray scattered;
+                    color attenuation;
+                    if (!rec.mat->scatter(p.r, rec, attenuation, scattered))
+                    {
+                        RT_STAT_INC(paths_absorbed);
+                        continue;
+                    }
+                    events.push_back({p.slot, attenuation});
+                    survivors.push_back({scattered, thread_random_generator().state, p.slot});
+                }
+                paths.swap(survivors);
+            }
+
+            // Apply the attenuations from the last bounce to the first, as the recursion in ray_color() does
+            for (size_t k = events.size(); k-- > 0;)
+                radiance[events[k].slot] = events[k].attenuation * radiance[events[k].slot];
+            for (size_t slot = 0; slot < slot_pixel.size(); slot++)
+            {
+                colors[slot_pixel[slot]] += radiance[slot];
+                counts[slot_pixel[slot]]++;
+            }
+        }
+    }
+
+    /**
+     * @brief Render one pixel and record its cost for the heatmap
+     * @param i Horizontal pixel coordinate
+     * @param j Vertical pixel coordinate
+     * @param world The scene containing hittable objects
+     * @param pixel_color Accumulated radiance of the pixel (updated)
+     * @param count Samples already taken (updated)
+     *
+     * The cost is the wall-clock time in nanoseconds, or the number of
+     * sphere and triangle intersection tests when heatmap_intersections
+     * is set.
+     */
+    void render_pixel_measured(int i, int j, const hittable &world, color &pixel_color, int &count)
+    {
+        size_t pixel_index = size_t(j) * image_width + i;
+
+#ifdef RT_ENABLE_STATS
+        if (heatmap_intersections)
+        {
+            const auto &stats = ray_stats::local();
+            auto tests_before = stats[ray_stats::sphere_tests] + stats[ray_stats::triangle_tests];
+            render_pixel(i, j, world, pixel_color, count);
+            pixel_cost[pixel_index] += double(stats[ray_stats::sphere_tests] + stats[ray_stats::triangle_tests] - tests_before);
+            return;
+        }
+#endif
+
+        auto start = std::chrono::steady_clock::now();
+        render_pixel(i, j, world, pixel_color, count);
+        auto end = std::chrono::steady_clock::now();
+        pixel_cost[pixel_index] += std::chrono::duration<double, std::nano>(end - start).count();
+    }
+
+    /**
+     * @brief Print per-worker scheduling statistics
+     * @param reports Busy/idle report of every worker
+     */
+    void print_scheduler_report(const std::vector<worker_report> &reports) const
+    {
+        double busy = 0, total = 0;
+        std::clog << "worker      busy (s)    idle (s)   tiles  steals\n";
+        for (size_t k = 0; k < reports.size(); k++)
+        {
+            const auto &r = reports[k];
+            std::clog << std::setw(6) << k << std::fixed << std::setprecision(3) << std::setw(12) << r.busy_seconds
+                      << std::setw(12) << r.idle_seconds << std::setw(8) << r.tasks << std::setw(8) << r.steals << '\n';
+            busy += r.busy_seconds;
+            total += r.busy_seconds + r.idle_seconds;
+        }
+        std::clog << "utilization " << std::setprecision(1) << (total > 0 ? 100 * busy / total : 0) << "%\n"
+                  << std::defaultfloat << std::setprecision(6);
+    }
+
+    /**
+     * @brief Write the per-pixel cost heatmap images
+     *
+     * Writes a false-color <prefix>.ppm and the raw values as <prefix>.pfm.
+     */
+    void write_heatmap() const
+    {
+        if (heatmap_prefix.empty())
+            return;
+
+        trace_scope scope("write heatmap", "io");
+        if (!write_heatmap_ppm(heatmap_prefix + ".ppm", image_width, image_height, pixel_cost) ||
+            !write_heatmap_pfm(heatmap_prefix + ".pfm", image_width, image_height, pixel_cost))
+            std::clog << "Failed to write heatmap " << heatmap_prefix << '\n';
+    }
+
+    /**
+     * @brief Save the accumulation buffer to checkpoint_path
+     */
+    void save_checkpoint() const
+    {
+        trace_scope scope("save checkpoint", "io");
+        if (!frame.save(checkpoint_path))
+            std::clog << "\nFailed to write checkpoint " << checkpoint_path << '\n';
+    }
+
+    /**
+     * @brief Print the ray statistics of the finished frame
+     *
+     * Prints a table to std::clog and, if stats_path is set, writes the
+     * same numbers as JSON. Does nothing unless built with RT_ENABLE_STATS.
+     */
+    void report_stats() const
+    {
+#ifdef RT_ENABLE_STATS
+        auto totals = ray_stats::aggregate();
+        if (show_progress)
+            ray_stats::print_table(std::clog, totals);
+        if (!stats_path.empty())
+        {
+            std::ofstream stats_out(stats_path);
+            ray_stats::write_json(stats_out, totals);
+        }
+#endif
+    }
+
+    /**
+     * @brief Write the averaged accumulation buffer in PPM format
+     * @param out Output stream
+     *
+     * Writes the crop window alone unless crop_full_frame is set, in which
+     * case pixels outside the window are black.
+     */
+    void write_image(std::ostream &out) const
+    {
+        trace_scope scope("encode image", "io");
+
+        int x0 = 0, y0 = 0, x1 = image_width, y1 = image_height;
+        if (!crop_full_frame)
+            x0 = region_x0, y0 = region_y0, x1 = region_x1, y1 = region_y1;
+
+        // Output PPM header
+        out << "P3\n"
+            << (x1 - x0) << ' ' << (y1 - y0) << "\n255\n";
+
+        // Average samples and output color
+        for (int j = y0; j < y1; j++)
+        {
+            for (int i = x0; i < x1; i++)
+            {
+                size_t pixel_index = size_t(j) * image_width + i;
+                int count = frame.sample_counts[pixel_index];
+                write_color(out, count > 0 ? (1.0 / count) * frame.accumulated[pixel_index] : color(0, 0, 0));
+            }
+        }
     }
 
     /**
@@ -153,7 +956,8 @@ private:
      * @return Ray from camera center through the pixel
      *
      * Generates a ray from the camera center through the specified pixel,
-     * with random sampling within the pixel for anti-aliasing.
+     * with random sampling within the pixel for anti-aliasing and a random
+     * time within the exposure for motion blur.
      */
     ray get_ray(int i, int j) const
     {
@@ -162,8 +966,9 @@ private:
 
         auto ray_origin = (defocus_angle <= 0) ? center : defocus_disk_sample();
         auto ray_direction = pixel_sample - ray_origin;
+        auto ray_time = random_double();
 
-        return ray(ray_origin, ray_direction);
+        return ray(ray_origin, ray_direction, ray_time);
     }
 
     /**
@@ -199,7 +1004,13 @@ private:
     {
         // Base case: maximum depth reached
         if (depth <= 0)
+        {
+            RT_STAT_INC(paths_depth_limit);
             return color(0, 0, 0);
+        }
+
+        if (depth < max_depth)
+            RT_STAT_INC(secondary_rays);
 
         hit_record rec;
         if (world.hit(r, interval(0.001, infinity), rec))
@@ -208,10 +1019,21 @@ private:
             color attenuation;
             if (rec.mat->scatter(r, rec, attenuation, scattered))
                 return attenuation * ray_color(scattered, depth - 1, world);
+            RT_STAT_INC(paths_absorbed);
             return color(0, 0, 0);
         }
 
-        // Background gradient (sky)
+        RT_STAT_INC(paths_escaped);
+        return background(r);
+    }
+
+    /**
+     * @brief Color of a ray that leaves the scene
+     * @param r The escaping ray
+     * @return Gradient background color simulating sky
+     */
+    static color background(const ray &r)
+    {
         vec3 unit_direction = unit_vector(r.direction());
         auto a = 0.5 * (unit_direction.y() + 1.0);
         return (1.0 - a) * color(1.0, 1.0, 1.0) + a * color(0.5, 0.7, 1.0);
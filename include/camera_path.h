@@ -0,0 +1,226 @@
+#ifndef CAMERA_PATH_H
+#define CAMERA_PATH_H
+
+#include "camera.h"
+#include "rtweekend.h"
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+/**
+ * @file camera_path.h
+ * @brief Keyframed camera paths for animation sequences
+ *
+ * This file implements camera animation for sequence rendering. A path
+ * is a list of keyframes, each holding the viewpoint (lookfrom, lookat),
+ * field of view and focus distance at one moment. Between keyframes the
+ * values are interpolated with a Catmull-Rom spline, which passes through
+ * every keyframe and keeps orbits smooth.
+ */
+
+/**
+ * @struct camera_keyframe
+ * @brief Camera parameters at one moment of an animation
+ */
+struct camera_keyframe
+{
+    double time;       ///< Moment of the keyframe (any unit, increasing along the path)
+    point3 lookfrom;   ///< Camera position
+    point3 lookat;     ///< Camera target point
+    double vfov;       ///< Vertical field of view in degrees
+    double focus_dist; ///< Distance to the plane of perfect focus
+};
+
+/**
+ * @class camera_path
+ * @brief Interpolated sequence of camera keyframes
+ */
+class camera_path
+{
+public:
+    std::vector<camera_keyframe> keys; ///< Keyframes ordered by time
+    std::string error;                 ///< Description of the first error, if loading failed
+
+    /**
+     * @brief Load keyframes from a text file
+     * @param path File with one keyframe per line:
+     *        time lookfrom.x lookfrom.y lookfrom.z lookat.x lookat.y lookat.z vfov focus_dist
+     *        Blank lines and lines starting with '#' are ignored.
+     * @return True on success; on failure `error` describes the problem
+     */
+    bool load(const std::string &path)
+    {
+        keys.clear();
+        error.clear();
+
+        std::ifstream in(path);
+        if (!in)
+        {
+            error = "cannot open " + path;
+            return false;
+        }
+
+        std::string line;
+        for (int line_number = 1; std::getline(in, line); line_number++)
+        {
+            size_t first = line.find_first_not_of(" \t\r");
+            if (first == std::string::npos || line[first] == '#')
+                continue;
+
+            std::istringstream fields(line);
+            camera_keyframe key;
+            double fx, fy, fz, ax, ay, az;
+            if (!(fields >> key.time >> fx >> fy >> fz >> ax >> ay >> az >> key.vfov >> key.focus_dist))
+            {
+                error = "malformed keyframe on line " + std::to_string(line_number);
+                return false;
+            }
+            key.lookfrom = point3(fx, fy, fz);
+            key.lookat = point3(ax, ay, az);
+
+            if (!keys.empty() && key.time <= keys.back().time)
+            {
+                error = "keyframe times must increase (line " + std::to_string(line_number) + ")";
+                return false;
+            }
+            keys.push_back(key);
+        }
+
+        if (keys.empty())
+        {
+            error = "no keyframes in " + path;
+            return false;
+        }
+        return true;
+    }
+
+    /**
+     * @brief Time of the first keyframe
+     */
+    double start_time() const { return keys.front().time; }
+
+    /**
+     * @brief Time of the last keyframe
+     */
+    double end_time() const { return keys.back().time; }
+
+    /**
+     * @brief Time of one frame when the path is split into evenly spaced frames
+     * @param frame Frame index in [0, frame_count)
+     * @param frame_count Number of frames covering the whole path
+     */
+    double frame_time(int frame, int frame_count) const
+    {
+        if (frame_count <= 1)
+            return start_time();
+        return start_time() + (end_time() - start_time()) * frame / (frame_count - 1);
+    }
+
+    /**
+     * @brief Interpolate the camera parameters at a moment
+     * @param time Moment along the path (clamped to the keyframe range)
+     * @return Interpolated keyframe
+     */
+    camera_keyframe at(double time) const
+    {
+        if (time <= start_time())
+            return keys.front();
+        if (time >= end_time())
+            return keys.back();
+
+        size_t k = 1;
+        while (keys[k].time < time)
+            k++;
+
+        // Segment keys[k - 1] -> keys[k]; neighbours are clamped at the ends
+        const camera_keyframe &p0 = keys[k >= 2 ? k - 2 : 0];
+        const camera_keyframe &p1 = keys[k - 1];
+        const camera_keyframe &p2 = keys[k];
+        const camera_keyframe &p3 = keys[k + 1 < keys.size() ? k + 1 : k];
+        double s = (time - p1.time) / (p2.time - p1.time);
+
+        camera_keyframe result;
+        result.time = time;
+        result.lookfrom = spline(p0.lookfrom, p1.lookfrom, p2.lookfrom, p3.lookfrom, s);
+        result.lookat = spline(p0.lookat, p1.lookat, p2.lookat, p3.lookat, s);
+        result.vfov = spline(p0.vfov, p1.vfov, p2.vfov, p3.vfov, s);
+        result.focus_dist = spline(p0.focus_dist, p1.focus_dist, p2.focus_dist, p3.focus_dist, s);
+        return result;
+    }
+
+    /**
+     * @brief Set a camera to the interpolated parameters at a moment
+     * @param cam Camera to configure (resolution and sampling are left unchanged)
+     * @param time Moment along the path
+     */
+    void apply(Camera &cam, double time) const
+    {
+        camera_keyframe key = at(time);
+        cam.lookfrom = key.lookfrom;
+        cam.lookat = key.lookat;
+        cam.vfov = key.vfov;
+        cam.focus_dist = key.focus_dist;
+    }
+
+private:
+    /**
+     * @brief Uniform Catmull-Rom interpolation between b and c
+     * @param s Position between b (s = 0) and c (s = 1)
+     */
+    template <typename T>
+    static T spline(const T &a, const T &b, const T &c, const T &d, double s)
+    {
+        double s2 = s * s, s3 = s2 * s;
+        return 0.5 * ((2 * b) + (-1 * a + c) * s + (2 * a - 5 * b + 4 * c - d) * s2 + (-1 * a + 3 * b - 3 * c + d) * s3);
+    }
+};
+
+/**
+ * @brief Expand a frame file name pattern
+ * @param pattern File name with a printf-style frame number, e.g. "frame_%04d.ppm"
+ *        (%d, %Nd and %0Nd are replaced, %% is a literal percent sign)
+ * @param frame Frame number
+ * @return File name of the frame
+ */
+inline std::string frame_file_name(const std::string &pattern, int frame)
+{
+    std::string name;
+    for (size_t k = 0; k < pattern.size(); k++)
+    {
+        if (pattern[k] != '%' || k + 1 == pattern.size())
+        {
+            name += pattern[k];
+            continue;
+        }
+        if (pattern[k + 1] == '%')
+        {
+            name += '%';
+            k++;
+            continue;
+        }
+
+        // Parse an optional zero flag and width up to the 'd'
+        size_t end = k + 1;
+        char fill = pattern[end] == '0' ? '0' : ' ';
+        int width = 0;
+        while (end < pattern.size() && pattern[end] >= '0' && pattern[end] <= '9')
+            width = std::min(width * 10 + (pattern[end++] - '0'), 64);
+        if (end == pattern.size() || pattern[end] != 'd')
+        {
+            name += pattern[k];
+            continue;
+        }
+
+        std::string number = std::to_string(frame);
+        if (int(number.size()) < width)
+            number.insert(0, width - number.size(), fill);
+        name += number;
+        k = end;
+    }
+    return name;
+}
+
+#endif
@@ -0,0 +1,143 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include "content_hash.h"
+#include "rtweekend.h"
+
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <vector>
+
+/**
+ * @file checkpoint.h
+ * @brief Render checkpoint file format
+ *
+ * This file implements saving and loading of partially finished renders.
+ * A checkpoint stores the accumulated radiance of every pixel together
+ * with the number of samples already taken, so an interrupted render can
+ * continue where it stopped and still produce the identical final image.
+ */
+
+/**
+ * @class render_checkpoint
+ * @brief Snapshot of the accumulation buffer of a render in progress
+ *
+ * The random state of a render is fully described by its base seed and the
+ * per-pixel sample counts, because every sample reseeds the generator from
+ * (seed, pixel, sample). Only pixels that have samples store radiance,
+ * which keeps checkpoints of early interruptions small.
+ */
+class render_checkpoint
+{
+public:
+    int image_width = 0;             ///< Width of the checkpointed image
+    int image_height = 0;            ///< Height of the checkpointed image
+    int max_depth = 0;               ///< Ray depth the samples were traced with
+    uint64_t seed = 0;               ///< Base seed of the render
+    uint64_t fingerprint = 0;        ///< Hash of the scene and camera settings (see Camera::settings_hash())
+    std::vector<int> sample_counts;  ///< Samples taken per pixel
+    std::vector<color> accumulated;  ///< Sum of sample radiance per pixel
+
+    /**
+     * @brief Write the checkpoint to disk
+     * @param path Destination file
+     * @return True on success, false if the file could not be written
+     *
+     * The data is written to a temporary file of this writer which is then
+     * renamed over the destination, so neither a crash nor a concurrent
+     * writer leaves a truncated checkpoint.
+     */
+    bool save(const std::string &path) const
+    {
+        std::string temp_path = temporary_path(path);
+        {
+            std::ofstream out(temp_path, std::ios::binary | std::ios::trunc);
+            if (!out)
+                return false;
+
+            out.write(magic, sizeof(magic));
+            write_value(out, version);
+            write_value(out, image_width);
+            write_value(out, image_height);
+            write_value(out, max_depth);
+            write_value(out, seed);
+            write_value(out, fingerprint);
+            out.write(reinterpret_cast<const char *>(sample_counts.data()), sample_counts.size() * sizeof(int));
+
+            // Radiance is only stored for pixels that already have samples
+            for (size_t i = 0; i < sample_counts.size(); i++)
+                if (sample_counts[i] > 0)
+                    out.write(reinterpret_cast<const char *>(accumulated[i].e), sizeof(accumulated[i].e));
+
+            if (!out)
+            {
+                out.close();
+                std::remove(temp_path.c_str());
+                return false;
+            }
+        }
+        if (std::rename(temp_path.c_str(), path.c_str()) != 0)
+        {
+            std::remove(temp_path.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    /**
+     * @brief Read a checkpoint from disk
+     * @param path Source file
+     * @return True if a valid checkpoint was loaded
+     */
+    bool load(const std::string &path)
+    {
+        std::ifstream in(path, std::ios::binary);
+        if (!in)
+            return false;
+
+        char file_magic[sizeof(magic)];
+        uint32_t file_version = 0;
+        in.read(file_magic, sizeof(file_magic));
+        read_value(in, file_version);
+        if (!in || std::string(file_magic, sizeof(file_magic)) != std::string(magic, sizeof(magic)) || file_version != version)
+            return false;
+
+        read_value(in, image_width);
+        read_value(in, image_height);
+        read_value(in, max_depth);
+        read_value(in, seed);
+        read_value(in, fingerprint);
+        if (!in || image_width <= 0 || image_height <= 0)
+            return false;
+
+        size_t pixel_count = size_t(image_width) * image_height;
+        sample_counts.assign(pixel_count, 0);
+        accumulated.assign(pixel_count, color(0, 0, 0));
+        in.read(reinterpret_cast<char *>(sample_counts.data()), pixel_count * sizeof(int));
+
+        for (size_t i = 0; i < pixel_count; i++)
+            if (sample_counts[i] > 0)
+                in.read(reinterpret_cast<char *>(accumulated[i].e), sizeof(accumulated[i].e));
+
+        return bool(in);
+    }
+
+private:
+    static constexpr char magic[4] = {'R', 'T', 'C', 'K'}; ///< File signature
+    static constexpr uint32_t version = 2;                  ///< File format version
+
+    template <typename T>
+    static void write_value(std::ofstream &out, const T &value)
+    {
+        out.write(reinterpret_cast<const char *>(&value), sizeof(T));
+    }
+
+    template <typename T>
+    static void read_value(std::ifstream &in, T &value)
+    {
+        in.read(reinterpret_cast<char *>(&value), sizeof(T));
+    }
+};
+
+#endif
@@ -0,0 +1,577 @@
+#ifndef CHUNKED_SCENE_H
+#define CHUNKED_SCENE_H
+
+#include "bvh.h"
+#include "hittable.h"
+#include "mapped_file.h"
+#include "material.h"
+#include "render_stats.h"
+#include "rtweekend.h"
+#include "trace.h"
+
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/**
+ * @file chunked_scene.h
+ * @brief Out-of-core sphere fields streamed from memory-mapped chunk files
+ *
+ * This file implements geometry that does not have to fit in memory. A
+ * sphere field is written once to a directory: the spheres are grouped
+ * into spatial chunks (square blocks of the ground grid), and every chunk
+ * is a file holding packed 20-byte sphere records in BVH leaf order plus
+ * the chunk's BVH. A small manifest lists the bounds of every chunk.
+ *
+ * At render time only the manifest and a BVH over the chunk bounds are in
+ * memory. Chunks are mapped when a ray first reaches them and unmapped in
+ * least-recently-used order once the mapped chunks exceed the resident
+ * budget. Materials come from a fixed palette instead of one heap object
+ * per sphere, so a resident chunk costs its file size and nothing more.
+ *
+ * Rays that reach a chunk that is not resident map it on the spot; only
+ * rays waiting for the same chunk block, and tiles keep neighbouring rays
+ * in the same chunks, which keeps reloads rare. Visits to resident chunks
+ * take no lock and write no shared counter.
+ */
+
+/**
+ * @struct packed_sphere
+ * @brief Compact sphere record of a chunk file
+ */
+struct packed_sphere
+{
+    float center[3];   ///< Sphere center
+    float radius;      ///< Sphere radius
+    uint32_t material; ///< Index into sphere_field_palette()
+};
+
+/**
+ * @brief Materials available to the spheres of a field
+ *
+ * 4096 diffuse albedos (16 levels per channel), 512 metals (4 albedo
+ * levels per channel, 8 fuzz levels) and glass.
+ */
+inline const std::vector<shared_ptr<material>> &sphere_field_palette()
+{
+    static const std::vector<shared_ptr<material>> palette = [] {
+        std::vector<shared_ptr<material>> materials;
+        for (int r = 0; r < 16; r++)
+            for (int g = 0; g < 16; g++)
+                for (int b = 0; b < 16; b++)
+                    materials.push_back(make_shared<lambertian>(color(r + 0.5, g + 0.5, b + 0.5) / 16));
+        for (int r = 0; r < 4; r++)
+            for (int g = 0; g < 4; g++)
+                for (int b = 0; b < 4; b++)
+                    for (int f = 0; f < 8; f++)
+                        materials.push_back(make_shared<metal>(color(0.5, 0.5, 0.5) + color(r + 0.5, g + 0.5, b + 0.5) / 8,
+                                                               (f + 0.5) / 16));
+        materials.push_back(make_shared<dielectric>(1.5));
+        return materials;
+    }();
+    return palette;
+}
+
+/**
+ * @class chunked_scene
+ * @brief Hittable sphere field streamed from a directory of chunk files
+ */
+class chunked_scene : public hittable
+{
+public:
+    size_t resident_budget = size_t(1) << 30; ///< Bytes of chunk files kept mapped
+    std::string error;                        ///< Description of the failure, if open() returned false
+
+    /**
+     * @brief Generate a cover-style sphere field and write it to a directory
+     * @param directory Output directory (created if needed)
+     * @param extent Half-size of the sphere grid; the field has up to (2 * extent)² spheres
+     * @param seed Seed of the placement and materials
+     * @param chunk_cells Edge length of a chunk in grid cells
+     * @param error Description of the failure (output)
+     * @return True on success
+     *
+     * Spheres are generated chunk by chunk from per-cell random streams, so
+     * memory use is bounded by one chunk whatever the extent.
+     */
+    static bool write_sphere_field(const std::string &directory, int extent, uint64_t seed, int chunk_cells,
+                                   std::string &error)
+    {
+        trace_scope scope("write sphere field", "scene");
+
+        std::error_code code;
+        std::filesystem::create_directories(directory, code);
+        if (code)
+        {
+            error = "cannot create " + directory + ": " + code.message();
+            return false;
+        }
+
+        chunk_cells = std::max(chunk_cells, 1);
+        std::vector<manifest_entry> manifest;
+        for (int z0 = -extent; z0 < extent; z0 += chunk_cells)
+        {
+            for (int x0 = -extent; x0 < extent; x0 += chunk_cells)
+            {
+                std::vector<packed_sphere> spheres;
+                for (int a = x0; a < std::min(x0 + chunk_cells, extent); a++)
+                    for (int b = z0; b < std::min(z0 + chunk_cells, extent); b++)
+                        generate_cell(a, b, seed, spheres);
+                if (spheres.empty())
+                    continue;
+
+                manifest_entry entry;
+                if (!write_chunk(chunk_path(directory, manifest.size()), spheres, entry, error))
+                    return false;
+                manifest.push_back(entry);
+            }
+        }
+
+        std::ofstream out(directory + "/manifest.bin", std::ios::binary | std::ios::trunc);
+        uint64_t chunk_count = manifest.size();
+        out.write(magic, sizeof(magic));
+        out.write(reinterpret_cast<const char *>(&format_version), sizeof(format_version));
+        out.write(reinterpret_cast<const char *>(&chunk_count), sizeof(chunk_count));
+        out.write(reinterpret_cast<const char *>(manifest.data()), manifest.size() * sizeof(manifest_entry));
+        if (!out)
+        {
+            error = "cannot write " + directory + "/manifest.bin";
+            return false;
+        }
+        return true;
+    }
+
+    /**
+     * @brief Open a sphere field written by write_sphere_field()
+     * @param path Directory of the field
+     * @return False if the manifest is missing or incompatible
+     */
+    bool open(const std::string &path)
+    {
+        directory = path;
+        std::ifstream in(directory + "/manifest.bin", std::ios::binary);
+        char file_magic[sizeof(magic)];
+        uint32_t version = 0;
+        uint64_t chunk_count = 0;
+        in.read(file_magic, sizeof(file_magic));
+        in.read(reinterpret_cast<char *>(&version), sizeof(version));
+        in.read(reinterpret_cast<char *>(&chunk_count), sizeof(chunk_count));
+        if (!in || std::memcmp(file_magic, magic, sizeof(magic)) != 0 || version != format_version)
+        {
+            error = directory + " does not contain a compatible sphere field";
+            return false;
+        }
+
+        std::vector<manifest_entry> manifest(chunk_count);
+        in.read(reinterpret_cast<char *>(manifest.data()), manifest.size() * sizeof(manifest_entry));
+        if (!in)
+        {
+            error = "truncated manifest in " + directory;
+            return false;
+        }
+
+        // The top level is a BVH over the chunk bounds; chunks are stored in its leaf order
+        std::vector<aabb> bounds(manifest.size());
+        for (size_t c = 0; c < manifest.size(); c++)
+            bounds[c] = manifest[c].bounds;
+        bvh_tree top;
+        auto order = top.build(bounds);
+        chunk_tree = std::move(top);
+
+        chunks = std::vector<chunk_slot>(manifest.size());
+        newest = oldest = no_chunk;
+        resident_bytes = 0;
+        sphere_total = 0;
+        for (size_t k = 0; k < order.size(); k++)
+        {
+            chunks[k].file_index = order[k];
+            sphere_total += manifest[order[k]].sphere_count;
+        }
+        return true;
+    }
+
+    /**
+     * @brief Number of spheres in the field
+     */
+    uint64_t sphere_count() const { return sphere_total; }
+
+    /**
+     * @brief Number of chunk files
+     */
+    size_t chunk_count() const { return chunks.size(); }
+
+    /**
+     * @brief Number of times a chunk was mapped
+     */
+    uint64_t chunk_loads() const { return loads; }
+
+    /**
+     * @brief Number of times a chunk was unmapped to stay within the budget
+     */
+    uint64_t chunk_evictions() const { return evictions; }
+
+    /**
+     * @brief Test ray intersection against the spheres of the field
+     * @param r The ray to test for intersection
+     * @param ray_t The interval along the ray to test for intersections
+     * @param rec Reference to hit_record to fill with the closest hit
+     * @return True if a sphere is hit within the interval
+     */
+    bool hit(const ray &r, interval ray_t, hit_record &rec) const override
+    {
+        const auto &palette = sphere_field_palette();
+        return chunk_tree.traverse(r, ray_t, [&](uint32_t c, interval &t_range) {
+            auto data = resident(c);
+            if (!data)
+                return false;
+
+            const packed_sphere *spheres = data->spheres.data();
+            const packed_sphere *closest = nullptr;
+            data->tree.traverse(r, t_range, [&](uint32_t k, interval &sphere_range) {
+                double t;
+                if (!hit_sphere(r, spheres[k], sphere_range, t))
+                    return false;
+                sphere_range.max = t;
+                closest = &spheres[k];
+                return true;
+            });
+            if (!closest)
+                return false;
+
+            point3 center(closest->center[0], closest->center[1], closest->center[2]);
+            rec.t = t_range.max;
+            rec.p = r.at(rec.t);
+            rec.set_face_normal(r, (rec.p - center) / closest->radius);
+            rec.mat = palette[closest->material];
+            return true;
+        });
+    }
+
+    /**
+     * @brief Get the bounding box of the field
+     */
+    aabb bounding_box() const override { return chunk_tree.bounds(); }
+
+private:
+    static constexpr char magic[4] = {'R', 'T', 'S', 'F'}; ///< File signature of manifest and chunks
+    static constexpr uint32_t format_version = 1;           ///< Bump when the file layout changes
+    static constexpr size_t section_alignment = 64;         ///< Alignment of the arrays in chunk files
+
+    /**
+     * @brief Manifest record of one chunk
+     */
+    struct manifest_entry
+    {
+        aabb bounds;           ///< Bounds of the chunk's spheres
+        uint64_t sphere_count; ///< Number of spheres in the chunk
+    };
+
+    /**
+     * @brief Fixed-size header at the start of a chunk file
+     */
+    struct chunk_header
+    {
+        char magic[4];         ///< File signature
+        uint32_t version;      ///< Format version
+        uint64_t sphere_count; ///< Number of sphere records
+        uint64_t node_count;   ///< Number of BVH nodes
+        uint64_t sphere_offset; ///< Byte offset of the sphere records
+        uint64_t node_offset;  ///< Byte offset of the BVH nodes
+    };
+
+    /**
+     * @brief A mapped chunk
+     */
+    struct chunk_data
+    {
+        mapped_array<packed_sphere> spheres; ///< Spheres in leaf order
+        bvh_tree tree;                       ///< Hierarchy over the spheres
+        size_t bytes = 0;                    ///< Size of the mapped file
+    };
+
+    static constexpr uint32_t no_chunk = 0xffffffff; ///< End of the LRU list
+
+    /**
+     * @brief Residency state of one chunk
+     *
+     * Readers take a reference with std::atomic_load, so a chunk evicted
+     * while rays are inside it stays mapped until they are done. Resident
+     * chunks form an intrusive list from the most to the least recently
+     * listed, so eviction finds its victim in constant time.
+     */
+    struct chunk_slot
+    {
+        uint32_t file_index = 0;            ///< Number of the chunk file
+        shared_ptr<const chunk_data> data;  ///< Mapped chunk, or nullptr when not resident
+        std::atomic<uint64_t> last_used{0}; ///< Load epoch of the latest visit
+        uint64_t listed_at = 0;             ///< Load epoch when the chunk was put at the head (load_mutex)
+        uint32_t newer = no_chunk;          ///< Neighbour towards the head of the LRU list (load_mutex)
+        uint32_t older = no_chunk;          ///< Neighbour towards the tail of the LRU list (load_mutex)
+        std::mutex map_mutex;               ///< Held while the chunk file is mapped
+
+        chunk_slot() = default;
+        chunk_slot(chunk_slot &&other) noexcept : file_index(other.file_index), data(std::move(other.data)) {}
+    };
+
+    std::string directory;                  ///< Directory of the field
+    bvh_tree chunk_tree;                    ///< Hierarchy over the chunk bounds
+    mutable std::vector<chunk_slot> chunks; ///< Chunks in leaf order of chunk_tree
+    uint64_t sphere_total = 0;              ///< Spheres in all chunks
+
+    mutable std::mutex load_mutex;              ///< Guards the LRU list and resident_bytes
+    mutable uint32_t newest = no_chunk;         ///< Head of the LRU list (guarded by load_mutex)
+    mutable uint32_t oldest = no_chunk;         ///< Tail of the LRU list, the next eviction candidate (guarded by load_mutex)
+    mutable size_t resident_bytes = 0;          ///< Bytes of mapped chunk files (guarded by load_mutex)
+    mutable std::atomic<uint64_t> epoch{0};     ///< Coarse LRU clock, advanced once per mapped chunk
+    mutable std::atomic<uint64_t> loads{0};     ///< Chunks mapped so far
+    mutable std::atomic<uint64_t> evictions{0}; ///< Chunks unmapped so far
+
+    static std::string chunk_path(const std::string &directory, size_t index)
+    {
+        char name[32];
+        std::snprintf(name, sizeof(name), "/chunk_%06zu.bin", index);
+        return directory + name;
+    }
+
+    static size_t align(size_t offset) { return (offset + section_alignment - 1) / section_alignment * section_alignment; }
+
+    /**
+     * @brief Generate the sphere of one grid cell (the rule of cover_scene)
+     */
+    static void generate_cell(int a, int b, uint64_t seed, std::vector<packed_sphere> &spheres)
+    {
+        random_generator rng(mix_bits(seed ^ mix_bits((uint64_t(uint32_t(a)) << 32) | uint32_t(b))));
+        double choose_mat = rng.next_double();
+        point3 center(a + 0.9 * rng.next_double(), 0.2, b + 0.9 * rng.next_double());
+        if ((center - point3(4, 0.2, 0)).length() <= 0.9)
+            return;
+
+        auto level = [&](int levels) { return std::min(int(rng.next_double() * levels), levels - 1); };
+        uint32_t material;
+        if (choose_mat < 0.8)
+        {
+            // Diffuse: albedo is the product of two random colors, quantized to the palette
+            int channel[3];
+            for (auto &value : channel)
+                value = std::min(int(rng.next_double() * rng.next_double() * 16), 15);
+            material = uint32_t(channel[0] * 256 + channel[1] * 16 + channel[2]);
+        }
+        else if (choose_mat < 0.95)
+        {
+            int r = level(4), g = level(4), b = level(4);
+            material = uint32_t(4096 + ((r * 4 + g) * 4 + b) * 8 + level(8));
+        }
+        else
+        {
+            material = 4096 + 512; // Glass
+        }
+
+        spheres.push_back({{float(center.x()), float(center.y()), float(center.z())}, 0.2f, material});
+    }
+
+    static aabb sphere_bounds(const packed_sphere &s)
+    {
+        vec3 r(s.radius, s.radius, s.radius);
+        point3 center(s.center[0], s.center[1], s.center[2]);
+        return aabb(center - r, center + r);
+    }
+
+    /**
+     * @brief Build the BVH of a chunk and write its file
+     */
+    static bool write_chunk(const std::string &path, const std::vector<packed_sphere> &spheres, manifest_entry &entry,
+                            std::string &error)
+    {
+        std::vector<aabb> bounds(spheres.size());
+        for (size_t k = 0; k < spheres.size(); k++)
+            bounds[k] = sphere_bounds(spheres[k]);
+
+        bvh_tree tree;
+        auto order = tree.build(bounds);
+        std::vector<packed_sphere> ordered(spheres.size());
+        for (size_t k = 0; k < order.size(); k++)
+            ordered[k] = spheres[order[k]];
+
+        chunk_header header;
+        std::memset(&header, 0, sizeof(header));
+        std::memcpy(header.magic, magic, sizeof(magic));
+        header.version = format_version;
+        header.sphere_count = ordered.size();
+        header.node_count = tree.nodes.size();
+        header.sphere_offset = align(sizeof(header));
+        header.node_offset = align(header.sphere_offset + ordered.size() * sizeof(packed_sphere));
+
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        static const char padding[section_alignment] = {};
+        out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        out.write(padding, std::streamsize(header.sphere_offset - sizeof(header)));
+        out.write(reinterpret_cast<const char *>(ordered.data()), std::streamsize(ordered.size() * sizeof(packed_sphere)));
+        out.write(padding, std::streamsize(header.node_offset - header.sphere_offset - ordered.size() * sizeof(packed_sphere)));
+        out.write(reinterpret_cast<const char *>(tree.nodes.data()), std::streamsize(tree.nodes.size() * sizeof(bvh_node)));
+        if (!out)
+        {
+            error = "cannot write " + path;
+            return false;
+        }
+
+        entry.bounds = tree.bounds();
+        entry.sphere_count = ordered.size();
+        return true;
+    }
+
+    /**
+     * @brief Get a chunk, mapping it if it is not resident
+     * @param c Chunk index in leaf order
+     * @return The mapped chunk, or nullptr if its file is unusable
+     */
+    shared_ptr<const chunk_data> resident(uint32_t c) const
+    {
+        chunk_slot &slot = chunks[c];
+        if (auto data = std::atomic_load(&slot.data))
+        {
+            touch(slot);
+            return data;
+        }
+
+        // The file is mapped under the lock of its slot only, so misses on other chunks proceed
+        std::lock_guard<std::mutex> map_lock(slot.map_mutex);
+        if (auto data = std::atomic_load(&slot.data)) // Mapped by another thread meanwhile
+        {
+            touch(slot);
+            return data;
+        }
+        auto data = map_chunk(slot.file_index);
+        if (!data)
+            return nullptr;
+
+        std::vector<shared_ptr<const chunk_data>> evicted; // Unmapped once load_mutex is released
+        std::lock_guard<std::mutex> lock(load_mutex);
+        uint64_t now = epoch.fetch_add(1, std::memory_order_relaxed) + 1;
+        std::atomic_store(&slot.data, data);
+        slot.last_used.store(now, std::memory_order_relaxed);
+        slot.listed_at = now;
+        push_newest(c);
+        resident_bytes += data->bytes;
+        loads++;
+
+        // Unmap the least recently used chunks beyond the budget (never the one just mapped).
+        // A chunk used since it was listed gets a second pass at the head instead.
+        while (resident_bytes > resident_budget && oldest != c)
+        {
+            uint32_t victim = oldest;
+            chunk_slot &other = chunks[victim];
+            unlink(victim);
+            if (other.last_used.load(std::memory_order_relaxed) > other.listed_at)
+            {
+                other.listed_at = now;
+                push_newest(victim);
+                continue;
+            }
+            evicted.push_back(std::atomic_exchange(&other.data, shared_ptr<const chunk_data>()));
+            resident_bytes -= evicted.back()->bytes;
+            evictions++;
+        }
+        return data;
+    }
+
+    /**
+     * @brief Record a visit to a resident chunk
+     *
+     * The clock only advances when a chunk is mapped, so a chunk is written
+     * at most once per load instead of on every visit.
+     */
+    void touch(chunk_slot &slot) const
+    {
+        uint64_t now = epoch.load(std::memory_order_relaxed);
+        if (slot.last_used.load(std::memory_order_relaxed) != now)
+            slot.last_used.store(now, std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Insert a chunk at the head of the LRU list (load_mutex held)
+     */
+    void push_newest(uint32_t c) const
+    {
+        chunks[c].older = newest;
+        chunks[c].newer = no_chunk;
+        if (newest != no_chunk)
+            chunks[newest].newer = c;
+        else
+            oldest = c;
+        newest = c;
+    }
+
+    /**
+     * @brief Remove a chunk from the LRU list (load_mutex held)
+     */
+    void unlink(uint32_t c) const
+    {
+        chunk_slot &slot = chunks[c];
+        (slot.newer != no_chunk ? chunks[slot.newer].older : newest) = slot.older;
+        (slot.older != no_chunk ? chunks[slot.older].newer : oldest) = slot.newer;
+        slot.newer = slot.older = no_chunk;
+    }
+
+    shared_ptr<const chunk_data> map_chunk(uint32_t file_index) const
+    {
+        trace_scope scope("map chunk", "io");
+
+        std::string map_error;
+        auto file = mapped_file::open(chunk_path(directory, file_index), map_error);
+        if (!file)
+            return nullptr;
+
+        chunk_header header;
+        if (file->size() < sizeof(header))
+            return nullptr;
+        std::memcpy(&header, file->data(), sizeof(header));
+        if (std::memcmp(header.magic, magic, sizeof(magic)) != 0 || header.version != format_version ||
+            header.node_count == 0 || header.sphere_offset > file->size() || header.node_offset > file->size() ||
+            header.sphere_count > (file->size() - header.sphere_offset) / sizeof(packed_sphere) ||
+            header.node_count > (file->size() - header.node_offset) / sizeof(bvh_node))
+            return nullptr;
+
+        auto data = make_shared<chunk_data>();
+        data->spheres = mapped_array<packed_sphere>(file, header.sphere_offset, header.sphere_count);
+        data->tree.assign(mapped_array<bvh_node>(file, header.node_offset, header.node_count), 0);
+        data->bytes = file->size();
+        return data;
+    }
+
+    /**
+     * @brief Ray/sphere intersection of a packed sphere (see sphere::hit)
+     */
+    static bool hit_sphere(const ray &r, const packed_sphere &s, const interval &ray_t, double &t)
+    {
+        RT_STAT_INC(sphere_tests);
+
+        vec3 oc = point3(s.center[0], s.center[1], s.center[2]) - r.origin();
+        double radius = s.radius;
+        auto a = r.direction_length_squared();
+        auto h = dot(r.direction(), oc);
+        auto c = oc.length_squared() - radius * radius;
+
+        auto discriminant = h * h - a * c;
+        if (discriminant < 0)
+            return false;
+
+        auto sqrtd = std::sqrt(discriminant);
+        t = (h - sqrtd) / a;
+        if (!ray_t.surrounds(t))
+        {
+            t = (h + sqrtd) / a;
+            if (!ray_t.surrounds(t))
+                return false;
+        }
+
+        RT_STAT_INC(sphere_hits);
+        return true;
+    }
+};
+
+#endif
@@ -0,0 +1,319 @@
+#ifndef COMPACT_BVH_H
+#define COMPACT_BVH_H
+
+#include "aabb.h"
+#include "bvh.h"
+#include "render_stats.h"
+#include "rtweekend.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+/**
+ * @file compact_bvh.h
+ * @brief Quantized four-wide BVH in cache-line-sized nodes
+ *
+ * This file implements a compressed layout of a built bvh_tree for scenes
+ * whose hierarchy is limited by memory size and bandwidth. The binary tree
+ * is collapsed into nodes with up to four children, and the bounds of the
+ * children are stored as 8-bit offsets on a per-node grid instead of as
+ * doubles. A node describes four boxes in one 64-byte cache line, where
+ * the full-precision layout needs 56 bytes for one box.
+ *
+ * Quantized bounds are rounded outwards, so they always contain the exact
+ * bounds: traversal may visit a few more nodes than with the binary tree,
+ * but it finds the same hits. The leaf order of the source tree is kept,
+ * so owners do not reorder their primitives.
+ */
+
+/**
+ * @struct compact_bvh_node
+ * @brief One node of a compact_bvh, exactly one cache line
+ *
+ * Child c covers origin[a] + lower[a][c] * 2^exponent[a] to
+ * origin[a] + upper[a][c] * 2^exponent[a] on axis a. A child with a zero
+ * count is an interior node at index `child`; otherwise it is a leaf
+ * holding `count` primitives starting at leaf-order position `child`.
+ */
+struct alignas(64) compact_bvh_node
+{
+    float origin[3];     ///< Grid origin, at or below the minimum corner of the node
+    int8_t exponent[3];  ///< Grid spacing per axis as a power of two
+    uint8_t child_count; ///< Number of used child slots
+    uint8_t lower[3][4]; ///< Quantized lower child bounds per axis
+    uint8_t upper[3][4]; ///< Quantized upper child bounds per axis
+    uint32_t child[4];   ///< Child node index (interior) or first primitive (leaf)
+    uint16_t count[4];   ///< Number of primitives (0 for interior children)
+};
+
+static_assert(sizeof(compact_bvh_node) == 64, "compact BVH nodes must fill one cache line");
+
+/**
+ * @class compact_bvh
+ * @brief Quantized four-wide form of a bvh_tree
+ *
+ * Traversal has the same contract as bvh_tree::traverse(), so owners can
+ * switch layouts without changing their primitive tests. The compact form
+ * cannot be refit; owners rebuild the binary tree and compress it again.
+ */
+class compact_bvh
+{
+public:
+    static constexpr int width = 4;             ///< Children per node
+    static constexpr int traversal_stack = 256; ///< Pending children traverse() keeps on the call stack
+
+    std::vector<compact_bvh_node> nodes; ///< Nodes in depth-first order (root at index 0)
+
+    /**
+     * @brief Build the compact form of a binary tree
+     * @param tree Built tree; its leaf order is kept
+     */
+    void build(const bvh_tree &tree)
+    {
+        nodes.clear();
+        root_bounds = tree.bounds();
+        // A node is no deeper than its binary source and leaves width - 1 siblings pending
+        stack_entries = (width - 1) * tree.depth() + width;
+        if (tree.nodes.empty() || (tree.nodes.size() == 1 && tree.nodes[0].count == 0))
+            return;
+
+        nodes.reserve(tree.nodes.size() / 2 + 1);
+        build_recursive(tree, 0);
+    }
+
+    /**
+     * @brief True if there is nothing to traverse
+     */
+    bool empty() const { return nodes.empty(); }
+
+    /**
+     * @brief Bounds of the whole hierarchy (exact, not quantized)
+     */
+    aabb bounds() const { return root_bounds; }
+
+    /**
+     * @brief Bytes used by the node array
+     */
+    size_t memory_bytes() const { return nodes.size() * sizeof(compact_bvh_node); }
+
+    /**
+     * @brief Find the closest primitive hit along a ray
+     * @param r The ray to trace
+     * @param ray_t Interval along the ray; max shrinks to the closest hit
+     * @param intersect Callback bool(uint32_t position, interval &ray_t), as for bvh_tree::traverse()
+     * @return True if any primitive was hit
+     *
+     * The children of a node are tested together and pushed far to near,
+     * so the nearest child is visited next. Pending children are skipped
+     * when popped if a closer hit has been found since they were pushed.
+     * Trees too deep for traversal_stack pending children use a heap stack.
+     */
+    template <typename Intersect>
+    bool traverse(const ray &r, interval &ray_t, Intersect &&intersect) const
+    {
+        if (nodes.empty())
+            return false;
+
+        const point3 &ray_orig = r.origin();
+        const vec3 &inverse = r.inverse_direction();
+        const compact_bvh_node *node_data = nodes.data();
+
+        struct entry
+        {
+            uint32_t child; ///< Node index, or first primitive of a leaf
+            uint32_t count; ///< Number of primitives (0 for nodes)
+            double t;       ///< Distance at which the ray enters the child
+        };
+        entry local_stack[traversal_stack];
+        std::vector<entry> deep_stack;
+        entry *stack = local_stack;
+        if (stack_entries > traversal_stack)
+        {
+            deep_stack.resize(stack_entries);
+            stack = deep_stack.data();
+        }
+        int stack_size = 0;
+        entry current = {0, 0, ray_t.min};
+        bool hit_anything = false;
+
+        while (true)
+        {
+            if (current.count > 0)
+            {
+                for (uint32_t k = current.child; k < current.child + current.count; k++)
+                    hit_anything |= intersect(k, ray_t);
+            }
+            else
+            {
+                const compact_bvh_node &node = node_data[current.child];
+
+                // Slab distances are base + q * step for grid coordinate q
+                double base[3], step[3];
+                for (int axis = 0; axis < 3; axis++)
+                {
+                    base[axis] = (double(node.origin[axis]) - ray_orig[axis]) * inverse[axis];
+                    step[axis] = grid_spacing(node.exponent[axis]) * inverse[axis];
+                }
+
+                // Intersect the ray with all child boxes, sorting the hits near to far
+                int hit_count = 0;
+                entry hits[width];
+                for (int c = 0; c < node.child_count; c++)
+                {
+                    RT_STAT_INC(bvh_nodes);
+                    interval t = ray_t;
+                    for (int axis = 0; axis < 3; axis++)
+                    {
+                        bool negative = r.direction_sign(axis);
+                        double t0 = base[axis] + (negative ? node.upper : node.lower)[axis][c] * step[axis];
+                        double t1 = base[axis] + (negative ? node.lower : node.upper)[axis][c] * step[axis];
+                        if (t0 > t.min)
+                            t.min = t0;
+                        if (t1 < t.max)
+                            t.max = t1;
+                    }
+                    // Equality is a hit so that flat boxes are not culled
+                    if (t.max < t.min)
+                        continue;
+
+                    int k = hit_count++;
+                    for (; k > 0 && hits[k - 1].t > t.min; k--)
+                        hits[k] = hits[k - 1];
+                    hits[k] = {node.child[c], node.count[c], t.min};
+                }
+                for (int k = hit_count; k-- > 0;)
+                    stack[stack_size++] = hits[k];
+            }
+
+            // Pop the nearest pending child that the ray can still reach
+            do
+            {
+                if (stack_size == 0)
+                    return hit_anything;
+                current = stack[--stack_size];
+            } while (current.t > ray_t.max);
+        }
+    }
+
+private:
+    aabb root_bounds = aabb::empty; ///< Exact bounds of the source tree
+    int stack_entries = 0;          ///< Most children traverse() can have pending
+
+    /**
+     * @brief 2^exponent as a double, built from its bit pattern
+     */
+    static double grid_spacing(int exponent)
+    {
+        uint64_t bits = uint64_t(1023 + exponent) << 52;
+        double spacing;
+        std::memcpy(&spacing, &bits, sizeof(spacing));
+        return spacing;
+    }
+
+    /**
+     * @brief Compress the subtree below a binary interior node (or a root leaf)
+     * @param tree Source tree
+     * @param source Index of the binary node
+     * @return Index of the compact node
+     */
+    uint32_t build_recursive(const bvh_tree &tree, uint32_t source)
+    {
+        // Open the largest interior child until the node has `width` children
+        uint32_t children[width];
+        int child_count = 0;
+        const bvh_node &root = tree.nodes[source];
+        if (root.is_leaf())
+            children[child_count++] = source;
+        else
+        {
+            children[child_count++] = source + 1;
+            children[child_count++] = root.offset;
+        }
+        while (child_count < width)
+        {
+            int best = -1;
+            double best_area = -1;
+            for (int c = 0; c < child_count; c++)
+            {
+                const bvh_node &child = tree.nodes[children[c]];
+                if (!child.is_leaf() && child.bbox.surface_area() > best_area)
+                {
+                    best = c;
+                    best_area = child.bbox.surface_area();
+                }
+            }
+            if (best < 0)
+                break;
+            uint32_t opened = children[best];
+            children[best] = opened + 1;
+            children[child_count++] = tree.nodes[opened].offset;
+        }
+
+        uint32_t node_index = uint32_t(nodes.size());
+        nodes.push_back({});
+        quantize(tree, children, child_count, nodes[node_index]);
+
+        for (int c = 0; c < child_count; c++)
+        {
+            const bvh_node &child = tree.nodes[children[c]];
+            if (child.is_leaf())
+                continue;
+            uint32_t compact_child = build_recursive(tree, children[c]);
+            nodes[node_index].child[c] = compact_child;
+        }
+        return node_index;
+    }
+
+    /**
+     * @brief Fill the grid and the outward-rounded child bounds of a node
+     */
+    static void quantize(const bvh_tree &tree, const uint32_t *children, int child_count, compact_bvh_node &node)
+    {
+        aabb box;
+        for (int c = 0; c < child_count; c++)
+            box = aabb(box, tree.nodes[children[c]].bbox);
+
+        node.child_count = uint8_t(child_count);
+        for (int axis = 0; axis < 3; axis++)
+        {
+            const interval &extent = box.axis_interval(axis);
+
+            // Round the origin down to a float and pick the finest grid that spans the node
+            float origin = float(extent.min);
+            if (double(origin) > extent.min)
+                origin = std::nextafter(origin, -std::numeric_limits<float>::infinity());
+            int exponent = -100;
+            while (exponent < 127 && 255 * grid_spacing(exponent) < extent.max - origin)
+                exponent++;
+            node.origin[axis] = origin;
+            node.exponent[axis] = int8_t(exponent);
+
+            double spacing = grid_spacing(exponent);
+            for (int c = 0; c < child_count; c++)
+            {
+                const interval &bounds = tree.nodes[children[c]].bbox.axis_interval(axis);
+                double lower = std::clamp(std::floor((bounds.min - origin) / spacing), 0.0, 255.0);
+                double upper = std::clamp(std::ceil((bounds.max - origin) / spacing), 0.0, 255.0);
+
+                // Correct for rounding in the subtraction so the grid box always contains the child
+                while (lower > 0 && origin + lower * spacing > bounds.min)
+                    lower--;
+                while (upper < 255 && origin + upper * spacing < bounds.max)
+                    upper++;
+                node.lower[axis][c] = uint8_t(lower);
+                node.upper[axis][c] = uint8_t(upper);
+            }
+        }
+
+        for (int c = 0; c < child_count; c++)
+        {
+            const bvh_node &child = tree.nodes[children[c]];
+            node.child[c] = child.is_leaf() ? child.offset : 0;
+            node.count[c] = child.is_leaf() ? child.count : 0;
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,145 @@
+#ifndef CONTENT_HASH_H
+#define CONTENT_HASH_H
+
+#include "rtweekend.h"
+#include "vec3.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <string>
+
+/**
+ * @file content_hash.h
+ * @brief Hashing of render inputs for on-disk caches
+ *
+ * Caches name their files after a hash of everything that determines the
+ * cached data, so stale entries are never found instead of having to be
+ * invalidated.
+ */
+
+/**
+ * @class content_hash
+ * @brief 128-bit hash of a sequence of values
+ *
+ * Two independently seeded SplitMix64 chains give a key wide enough that
+ * collisions between cached renders need not be considered.
+ */
+class content_hash
+{
+public:
+    /**
+     * @brief Add a 64-bit value
+     */
+    void add(uint64_t value)
+    {
+        lo = mix_bits(lo ^ (value + 0x9e3779b97f4a7c15ULL));
+        hi = mix_bits(hi + (value ^ 0xc2b2ae3d27d4eb4fULL) * 0x165667b19e3779f9ULL);
+    }
+
+    /**
+     * @brief Add a double by its bit pattern
+     */
+    void add(double value)
+    {
+        uint64_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        add(bits);
+    }
+
+    /**
+     * @brief Add the three components of a vector
+     */
+    void add(const vec3 &v)
+    {
+        for (int i = 0; i < 3; i++)
+            add(v[i]);
+    }
+
+    /**
+     * @brief Add a byte sequence (length-prefixed, so concatenations differ)
+     */
+    void add(const void *data, size_t size)
+    {
+        add(uint64_t(size));
+        const unsigned char *bytes = static_cast<const unsigned char *>(data);
+        for (; size >= 8; bytes += 8, size -= 8)
+        {
+            uint64_t word;
+            std::memcpy(&word, bytes, 8);
+            add(word);
+        }
+        uint64_t tail = 0;
+        std::memcpy(&tail, bytes, size);
+        add(tail);
+    }
+
+    /**
+     * @brief Add a string
+     */
+    void add(const std::string &text) { add(text.data(), text.size()); }
+
+    /**
+     * @brief Add the contents of a file
+     * @return False if the file could not be read
+     */
+    bool add_file(const std::string &path)
+    {
+        FILE *file = std::fopen(path.c_str(), "rb");
+        if (!file)
+            return false;
+        std::string block(1 << 20, '\0');
+        size_t size;
+        while ((size = std::fread(&block[0], 1, block.size(), file)) > 0)
+            add(block.data(), size);
+        bool ok = !std::ferror(file);
+        std::fclose(file);
+        return ok;
+    }
+
+    /**
+     * @brief Hash as 32 hexadecimal digits
+     */
+    std::string hex() const
+    {
+        static const char digits[] = "0123456789abcdef";
+        std::string text;
+        for (uint64_t part : {hi, lo})
+            for (int shift = 60; shift >= 0; shift -= 4)
+                text += digits[(part >> shift) & 15];
+        return text;
+    }
+
+    /**
+     * @brief First 64 bits of the hash, for fixed-size protocol fields
+     */
+    uint64_t value() const { return hi; }
+
+private:
+    uint64_t lo = 0x243f6a8885a308d3ULL; ///< First chain
+    uint64_t hi = 0x13198a2e03707344ULL; ///< Second chain
+};
+
+/**
+ * @brief Name of a temporary file to write before renaming it to path
+ * @param path Final file name
+ * @return path with a suffix unique to the calling process and call
+ *
+ * Every writer gets its own temporary file, so concurrent writers of the
+ * same cache entry never truncate or interleave each other's data.
+ */
+inline std::string temporary_path(const std::string &path)
+{
+    static const uint64_t process =
+        mix_bits((uint64_t(std::random_device{}()) << 32) ^
+                 uint64_t(std::chrono::steady_clock::now().time_since_epoch().count()));
+    static std::atomic<uint64_t> counter{0};
+
+    char suffix[32];
+    std::snprintf(suffix, sizeof(suffix), ".%016llx.tmp", (unsigned long long)mix_bits(process + ++counter));
+    return path + suffix;
+}
+
+#endif
@@ -0,0 +1,799 @@
+#ifndef DISTRIBUTED_H
+#define DISTRIBUTED_H
+
+/**
+ * @file distributed.h
+ * @brief Coordinator/worker rendering over sockets
+ *
+ * This file implements distributed rendering of one frame by several
+ * processes. A coordinator splits the frame into tiles and hands them to
+ * worker processes over TCP ("host:port") or Unix-domain ("unix:/path")
+ * sockets. Workers build the same scene from the same command line,
+ * trace whole tiles and send back the summed radiance of every pixel.
+ *
+ * Every sample is seeded from its pixel and sample index, so a tile has
+ * the same result no matter which worker traces it. This makes it safe
+ * to give the tiles of a failed or stalled worker to another one: the
+ * coordinator keeps the first result of each tile and the image is
+ * identical to a single-process render.
+ *
+ * Available on POSIX systems (RT_HAVE_SOCKETS is defined there).
+ */
+
+#if defined(__unix__) || defined(__APPLE__)
+#define RT_HAVE_SOCKETS 1
+
+#include "camera.h"
+#include "hittable.h"
+#include "rtweekend.h"
+#include "trace.h"
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief Message types of the coordinator/worker protocol
+ *
+ * Every message is a header (type, payload size; both uint32 in host
+ * byte order) followed by the payload. Workers and coordinator are
+ * expected to run on machines of the same architecture.
+ */
+enum render_message : uint32_t
+{
+    message_hello = 1, ///< Worker -> coordinator: uint64 render fingerprint
+    message_reject,    ///< Coordinator -> worker: settings differ, worker should exit
+    message_tile,      ///< Coordinator -> worker: int32 tile id, x0, y0, x1, y1
+    message_result,    ///< Worker -> coordinator: int32 tile id, 3 doubles per pixel
+    message_done       ///< Coordinator -> worker: frame finished, worker should exit
+};
+
+/**
+ * @class message_buffer
+ * @brief Serialization of message payloads
+ */
+class message_buffer
+{
+public:
+    std::vector<char> data; ///< Payload bytes
+    size_t position = 0;    ///< Read position
+
+    /**
+     * @brief Append a trivially copyable value
+     */
+    template <typename T>
+    void put(const T &value)
+    {
+        size_t offset = data.size();
+        data.resize(offset + sizeof(T));
+        std::memcpy(data.data() + offset, &value, sizeof(T));
+    }
+
+    /**
+     * @brief Read the next value
+     * @return False if the payload is too short
+     */
+    template <typename T>
+    bool get(T &value)
+    {
+        if (data.size() - position < sizeof(T))
+            return false;
+        std::memcpy(&value, data.data() + position, sizeof(T));
+        position += sizeof(T);
+        return true;
+    }
+};
+
+/**
+ * @class socket_connection
+ * @brief Connected stream socket exchanging framed messages
+ */
+class socket_connection
+{
+public:
+    /**
+     * @brief Take ownership of a connected socket descriptor
+     */
+    explicit socket_connection(int descriptor = -1) : descriptor(descriptor) {}
+
+    ~socket_connection() { close(); }
+
+    socket_connection(const socket_connection &) = delete;
+    socket_connection &operator=(const socket_connection &) = delete;
+
+    socket_connection(socket_connection &&other) noexcept : descriptor(other.descriptor), buffer(std::move(other.buffer))
+    {
+        other.descriptor = -1;
+    }
+
+    socket_connection &operator=(socket_connection &&other) noexcept
+    {
+        if (this != &other)
+        {
+            close();
+            descriptor = other.descriptor;
+            buffer = std::move(other.buffer);
+            other.descriptor = -1;
+        }
+        return *this;
+    }
+
+    /**
+     * @brief Socket descriptor (-1 when closed)
+     */
+    int fd() const { return descriptor; }
+
+    /**
+     * @brief Close the socket
+     */
+    void close()
+    {
+        if (descriptor >= 0)
+            ::close(descriptor);
+        descriptor = -1;
+    }
+
+    /**
+     * @brief Send one message, blocking until it is written
+     * @return False if the connection failed
+     */
+    bool send_message(uint32_t type, const message_buffer &payload = message_buffer()) const
+    {
+        uint32_t header[2] = {type, uint32_t(payload.data.size())};
+        return send_all(header, sizeof(header)) && send_all(payload.data.data(), payload.data.size());
+    }
+
+    /**
+     * @brief Receive one message, blocking until it is complete
+     * @return False if the connection was closed or failed
+     */
+    bool receive_message(uint32_t &type, message_buffer &payload)
+    {
+        while (!pop_message(type, payload))
+        {
+            if (!fill(true))
+                return false;
+        }
+        return true;
+    }
+
+    /**
+     * @brief Read whatever data is available without blocking
+     * @return False if the connection was closed or failed
+     */
+    bool read_available() { return fill(false); }
+
+    /**
+     * @brief Take the next complete message from the receive buffer
+     * @return False if no complete message has arrived yet
+     */
+    bool pop_message(uint32_t &type, message_buffer &payload)
+    {
+        uint32_t header[2];
+        if (buffer.size() < sizeof(header))
+            return false;
+        std::memcpy(header, buffer.data(), sizeof(header));
+        if (buffer.size() < sizeof(header) + header[1])
+            return false;
+
+        type = header[0];
+        payload.data.assign(buffer.begin() + sizeof(header), buffer.begin() + sizeof(header) + header[1]);
+        payload.position = 0;
+        buffer.erase(buffer.begin(), buffer.begin() + sizeof(header) + header[1]);
+        return true;
+    }
+
+private:
+    int descriptor;           ///< Socket descriptor
+    std::vector<char> buffer; ///< Received bytes not yet parsed into messages
+
+    static constexpr uint32_t max_message_size = 1u << 30; ///< Larger headers are treated as corruption
+
+    bool send_all(const void *data, size_t size) const
+    {
+#ifdef MSG_NOSIGNAL
+        const int flags = MSG_NOSIGNAL; // A vanished peer must not kill the process with SIGPIPE
+#else
+        const int flags = 0;
+#endif
+        const char *bytes = static_cast<const char *>(data);
+        while (size > 0)
+        {
+            ssize_t sent = ::send(descriptor, bytes, size, flags);
+            if (sent < 0 && errno == EINTR)
+                continue;
+            if (sent <= 0)
+                return false;
+            bytes += sent;
+            size -= size_t(sent);
+        }
+        return true;
+    }
+
+    bool fill(bool wait)
+    {
+        if (buffer.size() >= 8)
+        {
+            uint32_t size;
+            std::memcpy(&size, buffer.data() + 4, sizeof(size));
+            if (size > max_message_size)
+                return false;
+        }
+
+        char chunk[65536];
+        while (true)
+        {
+            ssize_t received = ::recv(descriptor, chunk, sizeof(chunk), wait ? 0 : MSG_DONTWAIT);
+            if (received > 0)
+            {
+                buffer.insert(buffer.end(), chunk, chunk + received);
+                return true;
+            }
+            if (received == 0)
+                return false;
+            if (errno == EINTR)
+                continue;
+            return !wait && (errno == EAGAIN || errno == EWOULDBLOCK);
+        }
+    }
+};
+
+/**
+ * @brief Socket helpers shared by coordinator and worker
+ */
+class socket_address
+{
+public:
+    /**
+     * @brief Create a listening socket
+     * @param address "unix:/path" or "host:port"; an empty host listens on
+     *        loopback only, "0.0.0.0" or "::" on every interface
+     * @param error Description of the failure (output)
+     * @return Socket descriptor, or -1 on failure
+     */
+    static int listen_on(const std::string &address, std::string &error)
+    {
+        if (is_unix(address))
+        {
+            sockaddr_un addr;
+            if (!unix_address(address, addr, error))
+                return -1;
+            ::unlink(addr.sun_path); // Remove a stale socket file of an earlier run
+            int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+            if (fd < 0 || ::bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0 || ::listen(fd, 64) < 0)
+                return fail(fd, "cannot listen on " + address, error);
+            return fd;
+        }
+
+        // No host means loopback (IPv4, which ":port" and "127.0.0.1:port" clients both reach)
+        addrinfo *list = resolve(!address.empty() && address[0] == ':' ? "127.0.0.1" + address : address, true, error);
+        if (!list)
+            return -1;
+        int fd = -1;
+        for (addrinfo *entry = list; entry && fd < 0; entry = entry->ai_next)
+        {
+            fd = ::socket(entry->ai_family, entry->ai_socktype, entry->ai_protocol);
+            int reuse = 1;
+            if (fd >= 0)
+                ::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+            if (fd >= 0 && (::bind(fd, entry->ai_addr, entry->ai_addrlen) < 0 || ::listen(fd, 64) < 0))
+            {
+                ::close(fd);
+                fd = -1;
+            }
+        }
+        ::freeaddrinfo(list);
+        if (fd < 0)
+            error = "cannot listen on " + address;
+        return fd;
+    }
+
+    /**
+     * @brief Connect to a listening socket
+     * @param address "unix:/path" or "host:port"
+     * @param error Description of the failure (output)
+     * @return Socket descriptor, or -1 on failure
+     */
+    static int connect_to(const std::string &address, std::string &error)
+    {
+        if (is_unix(address))
+        {
+            sockaddr_un addr;
+            if (!unix_address(address, addr, error))
+                return -1;
+            int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+            if (fd < 0 || ::connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0)
+                return fail(fd, "cannot connect to " + address, error);
+            configure(fd);
+            return fd;
+        }
+
+        addrinfo *list = resolve(address, false, error);
+        if (!list)
+            return -1;
+        int fd = -1;
+        for (addrinfo *entry = list; entry && fd < 0; entry = entry->ai_next)
+        {
+            fd = ::socket(entry->ai_family, entry->ai_socktype, entry->ai_protocol);
+            if (fd >= 0 && ::connect(fd, entry->ai_addr, entry->ai_addrlen) < 0)
+            {
+                ::close(fd);
+                fd = -1;
+            }
+        }
+        ::freeaddrinfo(list);
+        if (fd < 0)
+        {
+            error = "cannot connect to " + address;
+            return -1;
+        }
+        configure(fd);
+        return fd;
+    }
+
+    /**
+     * @brief Set per-connection socket options
+     *
+     * Disables Nagle's algorithm (tile messages are latency bound) and,
+     * where MSG_NOSIGNAL is unavailable, SIGPIPE on writes.
+     */
+    static void configure(int fd)
+    {
+        int on = 1;
+        ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on)); // Fails harmlessly on Unix sockets
+#ifdef SO_NOSIGPIPE
+        ::setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#endif
+    }
+
+private:
+    static bool is_unix(const std::string &address) { return address.rfind("unix:", 0) == 0; }
+
+    static bool unix_address(const std::string &address, sockaddr_un &addr, std::string &error)
+    {
+        std::string path = address.substr(5);
+        std::memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        if (path.empty() || path.size() >= sizeof(addr.sun_path))
+        {
+            error = "invalid socket path in " + address;
+            return false;
+        }
+        std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+        return true;
+    }
+
+    static addrinfo *resolve(const std::string &address, bool passive, std::string &error)
+    {
+        size_t colon = address.rfind(':');
+        if (colon == std::string::npos)
+        {
+            error = "address must be host:port or unix:/path, got " + address;
+            return nullptr;
+        }
+        std::string host = address.substr(0, colon), port = address.substr(colon + 1);
+
+        addrinfo hints;
+        std::memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        hints.ai_flags = passive ? AI_PASSIVE : 0;
+        addrinfo *list = nullptr;
+        if (::getaddrinfo(host.empty() ? nullptr : host.c_str(), port.c_str(), &hints, &list) != 0)
+        {
+            error = "cannot resolve " + address;
+            return nullptr;
+        }
+        return list;
+    }
+
+    static int fail(int fd, const std::string &message, std::string &error)
+    {
+        if (fd >= 0)
+            ::close(fd);
+        error = message + ": " + std::strerror(errno);
+        return -1;
+    }
+};
+
+/**
+ * @brief Fingerprint of the settings that determine a frame
+ * @param cam Camera (resolution, sampling and view)
+ * @param scene_hash Hash of the scene inputs (see scene_description::add_contents)
+ * @return Hash that coordinator and workers compare before exchanging tiles
+ */
+inline uint64_t render_fingerprint(const Camera &cam, uint64_t scene_hash)
+{
+    uint64_t hash = 0;
+    auto mix = [&](uint64_t value) { hash = mix_bits(hash ^ (value + 0x9e3779b97f4a7c15ULL)); };
+    auto mix_double = [&](double value) {
+        uint64_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        mix(bits);
+    };
+    auto mix_vec = [&](const vec3 &v) {
+        for (int i = 0; i < 3; i++)
+            mix_double(v[i]);
+    };
+
+    mix_double(cam.aspect_ratio);
+    mix(uint64_t(cam.image_width));
+    mix(uint64_t(cam.samples_per_pixel));
+    mix(uint64_t(cam.max_depth));
+    mix(cam.seed);
+    mix_double(cam.vfov);
+    mix_vec(cam.lookfrom);
+    mix_vec(cam.lookat);
+    mix_vec(cam.vup);
+    mix_double(cam.defocus_angle);
+    mix_double(cam.focus_dist);
+    mix(scene_hash);
+    return hash;
+}
+
+/**
+ * @class render_coordinator
+ * @brief Hands out the tiles of a frame to worker processes
+ */
+class render_coordinator
+{
+public:
+    int tiles_in_flight = 2;   ///< Tiles assigned to one worker at a time (hides network latency)
+    double tile_timeout = 600; ///< Seconds after which an unanswered tile is also given to another worker
+    std::string error;         ///< Description of the failure, if run() returned false
+
+    /**
+     * @brief Render a frame with remote workers
+     * @param cam Camera of the frame (checkpoint and resume settings apply)
+     * @param scene_hash Hash of the scene inputs, compared with the workers' (see render_fingerprint())
+     * @param address Address to listen on for workers
+     * @param out Output stream for the PPM image
+     * @return True when the image was written
+     *
+     * Waits for workers as long as tiles remain; workers may join at
+     * any time. Tiles of workers that disconnect go back to the queue.
+     */
+    bool run(Camera &cam, uint64_t scene_hash, const std::string &address, std::ostream &out)
+    {
+        trace_scope frame_scope("coordinate frame");
+
+        int listen_fd = socket_address::listen_on(address, error);
+        if (listen_fd < 0)
+            return false;
+        socket_connection listener(listen_fd);
+
+        tiles = cam.begin_external_frame();
+        done.assign(tiles.size(), false);
+        queued.assign(tiles.size(), true);
+        assigned_at.assign(tiles.size(), clock::now());
+        pending.clear();
+        for (size_t t = 0; t < tiles.size(); t++)
+            pending.push_back(int(t));
+
+        const uint64_t fingerprint = render_fingerprint(cam, scene_hash);
+        size_t tiles_left = tiles.size();
+        auto last_checkpoint = clock::now();
+        std::clog << "Coordinator listening on " << address << " (" << tiles_left << " tiles)\n";
+
+        while (tiles_left > 0)
+        {
+            std::vector<pollfd> fds(1 + workers.size());
+            fds[0] = {listener.fd(), POLLIN, 0};
+            for (size_t w = 0; w < workers.size(); w++)
+                fds[w + 1] = {workers[w].connection.fd(), POLLIN, 0};
+            ::poll(fds.data(), fds.size(), 200);
+
+            if (fds[0].revents & POLLIN)
+            {
+                int fd = ::accept(listener.fd(), nullptr, nullptr);
+                if (fd >= 0)
+                {
+                    socket_address::configure(fd);
+                    workers.push_back(worker_state{socket_connection(fd), false, true, {}});
+                }
+            }
+
+            // Read results; workers whose connection fails are dropped below
+            for (size_t w = 0; w + 1 < fds.size(); w++)
+            {
+                worker_state &worker = workers[w];
+                if (fds[w + 1].revents == 0)
+                    continue;
+                if (!worker.connection.read_available())
+                {
+                    worker.alive = false;
+                    continue;
+                }
+
+                uint32_t type;
+                message_buffer payload;
+                while (worker.alive && worker.connection.pop_message(type, payload))
+                {
+                    if (type == message_hello)
+                    {
+                        uint64_t worker_fingerprint = 0;
+                        worker.ready = payload.get(worker_fingerprint) && worker_fingerprint == fingerprint;
+                        if (!worker.ready)
+                        {
+                            std::clog << "\nRejecting worker with different render settings\n";
+                            worker.connection.send_message(message_reject);
+                            worker.alive = false;
+                        }
+                    }
+                    else if (type == message_result && worker.ready)
+                    {
+                        int32_t id;
+                        if (!payload.get(id) || id < 0 || size_t(id) >= tiles.size() || !receive_tile(cam, id, payload))
+                        {
+                            worker.alive = false;
+                            continue;
+                        }
+                        worker.assigned.erase(std::remove(worker.assigned.begin(), worker.assigned.end(), id),
+                                              worker.assigned.end());
+                        if (!done[id])
+                        {
+                            done[id] = true;
+                            tiles_left--;
+                            if (cam.show_progress)
+                                std::clog << "\rTiles remaining: " << tiles_left << " (workers: " << workers.size()
+                                          << ")   " << std::flush;
+                        }
+                    }
+                    else
+                    {
+                        worker.alive = false;
+                    }
+                }
+            }
+
+            drop_failed_workers();
+            requeue_stalled_tiles();
+            assign_tiles();
+
+            if (!cam.checkpoint_path.empty() &&
+                std::chrono::duration<double>(clock::now() - last_checkpoint).count() >= cam.checkpoint_interval)
+            {
+                cam.checkpoint_external_frame();
+                last_checkpoint = clock::now();
+            }
+        }
+
+        for (auto &worker : workers)
+            worker.connection.send_message(message_done);
+        workers.clear();
+
+        if (cam.show_progress)
+            std::clog << "\rDone.                               \n";
+        cam.finish_frame(out);
+        return true;
+    }
+
+private:
+    using clock = std::chrono::steady_clock;
+
+    /**
+     * @brief Connection and tiles of one worker
+     */
+    struct worker_state
+    {
+        socket_connection connection; ///< Connection to the worker process
+        bool ready = false;           ///< Handshake completed with matching settings
+        bool alive = true;            ///< False once the connection failed
+        std::vector<int> assigned;    ///< Tiles sent to this worker and not yet returned
+    };
+
+    std::vector<render_tile> tiles;          ///< Tiles of the frame that need samples
+    std::vector<bool> done;                  ///< Tiles whose result has been committed
+    std::vector<bool> queued;                ///< Tiles currently in the pending queue
+    std::vector<clock::time_point> assigned_at; ///< Time each tile was last handed out
+    std::deque<int> pending;                 ///< Tiles waiting for a worker
+    std::vector<worker_state> workers;       ///< Connected workers
+
+    /**
+     * @brief Parse and commit the pixels of a returned tile
+     * @return False if the payload does not match the tile size
+     */
+    bool receive_tile(Camera &cam, int id, message_buffer &payload)
+    {
+        const render_tile &tile = tiles[id];
+        size_t count = size_t(tile.x1 - tile.x0) * (tile.y1 - tile.y0);
+        if (payload.data.size() - payload.position != count * 3 * sizeof(double))
+            return false;
+        if (done[id])
+            return true; // A duplicate of a reassigned tile; the results are identical
+
+        std::vector<color> accumulated(count);
+        for (auto &c : accumulated)
+        {
+            double r = 0, g = 0, b = 0;
+            payload.get(r), payload.get(g), payload.get(b);
+            c = color(r, g, b);
+        }
+        cam.commit_tile(tile, accumulated);
+        return true;
+    }
+
+    /**
+     * @brief Remove failed workers and put their unfinished tiles back in front of the queue
+     */
+    void drop_failed_workers()
+    {
+        for (size_t w = 0; w < workers.size();)
+        {
+            if (workers[w].alive)
+            {
+                w++;
+                continue;
+            }
+            if (workers[w].ready)
+                std::clog << "\nWorker lost, reassigning " << workers[w].assigned.size() << " tiles\n";
+            for (int id : workers[w].assigned)
+                requeue(id, true);
+            workers.erase(workers.begin() + w);
+        }
+    }
+
+    /**
+     * @brief Also hand out tiles that have been out for longer than tile_timeout
+     */
+    void requeue_stalled_tiles()
+    {
+        auto now = clock::now();
+        for (const auto &worker : workers)
+        {
+            for (int id : worker.assigned)
+            {
+                if (!done[id] && !queued[id] && std::chrono::duration<double>(now - assigned_at[id]).count() > tile_timeout)
+                {
+                    requeue(id, true);
+                    assigned_at[id] = now;
+                }
+            }
+        }
+    }
+
+    void requeue(int id, bool front)
+    {
+        if (done[id] || queued[id])
+            return;
+        queued[id] = true;
+        if (front)
+            pending.push_front(id);
+        else
+            pending.push_back(id);
+    }
+
+    /**
+     * @brief Fill every ready worker up to tiles_in_flight
+     */
+    void assign_tiles()
+    {
+        for (auto &worker : workers)
+        {
+            while (worker.ready && worker.alive && int(worker.assigned.size()) < tiles_in_flight && !pending.empty())
+            {
+                int id = pending.front();
+                pending.pop_front();
+                queued[id] = false;
+                if (done[id] || std::find(worker.assigned.begin(), worker.assigned.end(), id) != worker.assigned.end())
+                    continue;
+
+                const render_tile &tile = tiles[id];
+                message_buffer message;
+                message.put(int32_t(id));
+                message.put(int32_t(tile.x0)), message.put(int32_t(tile.y0));
+                message.put(int32_t(tile.x1)), message.put(int32_t(tile.y1));
+                if (!worker.connection.send_message(message_tile, message))
+                {
+                    worker.alive = false;
+                    requeue(id, true);
+                    break;
+                }
+                worker.assigned.push_back(id);
+                assigned_at[id] = clock::now();
+            }
+        }
+    }
+};
+
+/**
+ * @class render_worker
+ * @brief Traces tiles handed out by a coordinator
+ */
+class render_worker
+{
+public:
+    double connect_timeout = 30; ///< Seconds to keep retrying while the coordinator is not up yet
+    std::string error;           ///< Description of the failure, if run() returned false
+
+    /**
+     * @brief Serve tiles until the coordinator reports the frame as done
+     * @param cam Camera with the same settings as the coordinator's
+     * @param world The same scene as the coordinator's
+     * @param scene_hash Hash of the scene inputs, compared with the coordinator's (see render_fingerprint())
+     * @param address Address of the coordinator
+     * @return True if the frame was completed
+     */
+    bool run(Camera &cam, const hittable &world, uint64_t scene_hash, const std::string &address)
+    {
+        socket_connection connection(connect_with_retry(address));
+        if (connection.fd() < 0)
+            return false;
+
+        message_buffer hello;
+        hello.put(render_fingerprint(cam, scene_hash));
+        if (!connection.send_message(message_hello, hello))
+        {
+            error = "lost connection to the coordinator";
+            return false;
+        }
+
+        cam.begin_external_frame();
+        std::vector<color> accumulated;
+        uint32_t type;
+        message_buffer payload;
+        while (connection.receive_message(type, payload))
+        {
+            if (type == message_done)
+                return true;
+            if (type == message_reject)
+            {
+                error = "the coordinator renders with different settings";
+                return false;
+            }
+
+            int32_t id;
+            render_tile tile;
+            if (type != message_tile || !payload.get(id) || !payload.get(tile.x0) || !payload.get(tile.y0) ||
+                !payload.get(tile.x1) || !payload.get(tile.y1) || !cam.valid_tile(tile))
+            {
+                error = "malformed message from the coordinator";
+                return false;
+            }
+
+            cam.trace_tile(world, tile, accumulated);
+
+            message_buffer result;
+            result.data.reserve(sizeof(int32_t) + accumulated.size() * 3 * sizeof(double));
+            result.put(id);
+            for (const auto &c : accumulated)
+                result.put(c.x()), result.put(c.y()), result.put(c.z());
+            if (!connection.send_message(message_result, result))
+                break;
+        }
+
+        error = "lost connection to the coordinator";
+        return false;
+    }
+
+private:
+    int connect_with_retry(const std::string &address)
+    {
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::duration<double>(connect_timeout);
+        while (true)
+        {
+            int fd = socket_address::connect_to(address, error);
+            if (fd >= 0 || std::chrono::steady_clock::now() >= deadline)
+                return fd;
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        }
+    }
+};
+
+#endif
+
+#endif
@@ -0,0 +1,98 @@
+#ifndef HEATMAP_H
+#define HEATMAP_H
+
+#include "rtweekend.h"
+
+#include <algorithm>
+#include <fstream>
+#include <string>
+#include <vector>
+
+/**
+ * @file heatmap.h
+ * @brief False-color visualization of per-pixel render cost
+ *
+ * This file implements writing of per-pixel cost measurements (render time
+ * or intersection tests) as a false-color PPM image for quick inspection,
+ * and as a raw PFM float image for further analysis.
+ */
+
+/**
+ * @brief Map a normalized cost to a false color
+ * @param x Cost in [0, 1]
+ * @return Color ramp black -> blue -> red -> yellow -> white
+ */
+inline color heatmap_color(double x)
+{
+    static const color ramp[] = {color(0, 0, 0), color(0.1, 0.1, 0.8), color(0.9, 0.1, 0.1),
+                                 color(1.0, 0.9, 0.1), color(1, 1, 1)};
+    const int segments = sizeof(ramp) / sizeof(ramp[0]) - 1;
+
+    x = interval(0, 1).clamp(x) * segments;
+    int k = std::min(int(x), segments - 1);
+    double f = x - k;
+    return (1 - f) * ramp[k] + f * ramp[k + 1];
+}
+
+/**
+ * @brief Write per-pixel costs as a false-color PPM image
+ * @param path Destination file
+ * @param width Image width
+ * @param height Image height
+ * @param costs Cost per pixel in row-major order
+ * @return True on success
+ *
+ * Costs are normalized to the 99th percentile so that a few extreme
+ * pixels do not wash out the rest of the image.
+ */
+inline bool write_heatmap_ppm(const std::string &path, int width, int height, const std::vector<double> &costs)
+{
+    std::ofstream out(path);
+    if (!out)
+        return false;
+
+    std::vector<double> sorted(costs);
+    size_t rank = sorted.empty() ? 0 : (sorted.size() - 1) * 99 / 100;
+    std::nth_element(sorted.begin(), sorted.begin() + rank, sorted.end());
+    double scale = (!sorted.empty() && sorted[rank] > 0) ? 1.0 / sorted[rank] : 0;
+
+    out << "P3\n"
+        << width << ' ' << height << "\n255\n";
+    for (double cost : costs)
+    {
+        color c = heatmap_color(cost * scale);
+        out << int(255.999 * c.x()) << ' ' << int(255.999 * c.y()) << ' ' << int(255.999 * c.z()) << '\n';
+    }
+    return bool(out);
+}
+
+/**
+ * @brief Write per-pixel costs as a single-channel PFM image
+ * @param path Destination file
+ * @param width Image width
+ * @param height Image height
+ * @param costs Cost per pixel in row-major order
+ * @return True on success
+ *
+ * PFM stores rows bottom to top; the negative scale marks little-endian floats.
+ */
+inline bool write_heatmap_pfm(const std::string &path, int width, int height, const std::vector<double> &costs)
+{
+    std::ofstream out(path, std::ios::binary);
+    if (!out)
+        return false;
+
+    out << "Pf\n"
+        << width << ' ' << height << "\n-1.0\n";
+    for (int j = height - 1; j >= 0; j--)
+    {
+        for (int i = 0; i < width; i++)
+        {
+            float value = float(costs[size_t(j) * width + i]);
+            out.write(reinterpret_cast<const char *>(&value), sizeof(value));
+        }
+    }
+    return bool(out);
+}
+
+#endif
@@ -1,6 +1,7 @@
 #ifndef HITTABLE_H
 #define HITTABLE_H
 
+#include "aabb.h"
 #include "rtweekend.h"
 
 class material;
@@ -78,6 +79,24 @@ public:
      * intersection information if a hit is found.
      */
     virtual bool hit(const ray &r, interval ray_t, hit_record &rec) const = 0;
+
+    /**
+     * @brief Get the axis-aligned bounding box of the object
+     * @return Box enclosing all points the object can be hit at
+     *
+     * Used by acceleration structures to skip objects a ray cannot hit.
+     */
+    virtual aabb bounding_box() const = 0;
+
+    /**
+     * @brief Check whether the object fits in a finite box
+     * @return False for objects such as infinite planes, whose bounding box is aabb::universe
+     *
+     * Acceleration structures keep unbounded objects out of their
+     * hierarchy, where an infinite box would enclose every node, and
+     * test them separately.
+     */
+    virtual bool is_bounded() const { return true; }
 };
 
 #endif
\ No newline at end of file
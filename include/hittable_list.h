@@ -42,7 +42,12 @@ public:
     /**
      * @brief Clear all objects from the list
      */
-    void clear() { objects.clear(); }
+    void clear()
+    {
+        objects.clear();
+        bbox = aabb();
+        bounded = true;
+    }
 
     /**
      * @brief Add a hittable object to the list
@@ -51,6 +56,8 @@ public:
     void add(shared_ptr<hittable> object)
     {
         objects.push_back(object);
+        bbox = aabb(bbox, object->bounding_box());
+        bounded = bounded && object->is_bounded();
     }
 
     /**
@@ -82,6 +89,20 @@ public:
         }
         return hit_anything;
     }
+
+    /**
+     * @brief Get the bounding box of all objects in the list
+     */
+    aabb bounding_box() const override { return bbox; }
+
+    /**
+     * @brief A list is unbounded if any of its objects is
+     */
+    bool is_bounded() const override { return bounded; }
+
+private:
+    aabb bbox;           ///< Union of the bounding boxes of all objects
+    bool bounded = true; ///< False once an unbounded object was added
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,97 @@
+#ifndef INSTANCE_H
+#define INSTANCE_H
+
+#include "hittable.h"
+#include "rtweekend.h"
+#include "transform.h"
+
+/**
+ * @file instance.h
+ * @brief Transformed references to shared geometry
+ *
+ * This file implements instancing: an instance places a shared hittable
+ * (typically a mesh with its own BVH) in the world with an affine
+ * transformation. Many instances can reference the same geometry, so
+ * each additional copy costs one transformation instead of a copy of the
+ * geometry and its acceleration structure.
+ */
+
+/**
+ * @class instance
+ * @brief Hittable that shows shared geometry under an affine transformation
+ *
+ * Rays are transformed into the object space of the geometry. The
+ * direction is not renormalized, so hit distances t are the same in both
+ * spaces and the hit point can be evaluated on the world-space ray.
+ */
+class instance : public hittable
+{
+public:
+    /**
+     * @brief Constructor
+     * @param object Shared geometry in its own object space
+     * @param object_to_world Placement of the geometry in the world
+     */
+    instance(shared_ptr<hittable> object, const transform &object_to_world)
+        : object(object), world_to_object(object_to_world.inverse())
+    {
+        update_bounds(object_to_world);
+    }
+
+    /**
+     * @brief Move the instance (for animation)
+     * @param object_to_world New placement of the geometry in the world
+     *
+     * Also refreshes the world bounds after the shared geometry changed.
+     * Containers holding the instance in a BVH must be updated afterwards.
+     */
+    void set_transform(const transform &object_to_world)
+    {
+        world_to_object = object_to_world.inverse();
+        update_bounds(object_to_world);
+    }
+
+    /**
+     * @brief Test ray intersection with the transformed geometry
+     * @param r The world-space ray
+     * @param ray_t The interval along the ray to test for intersections
+     * @param rec Reference to hit_record to fill with world-space hit data
+     * @return True if the geometry is hit within the interval
+     */
+    bool hit(const ray &r, interval ray_t, hit_record &rec) const override
+    {
+        ray object_ray(world_to_object.apply_point(r.origin()), world_to_object.apply_vector(r.direction()), r.time());
+        if (!object->hit(object_ray, ray_t, rec))
+            return false;
+
+        // Normals transform with the inverse transpose; the side the ray came from is unchanged
+        rec.p = r.at(rec.t);
+        rec.normal = unit_vector(world_to_object.apply_transposed(rec.normal));
+        return true;
+    }
+
+    /**
+     * @brief Get the world-space bounding box of the instance
+     */
+    aabb bounding_box() const override { return bbox; }
+
+    /**
+     * @brief An instance is unbounded if its geometry is
+     */
+    bool is_bounded() const override { return object->is_bounded(); }
+
+private:
+    shared_ptr<hittable> object; ///< Shared geometry
+    transform world_to_object;   ///< Maps world-space rays into object space
+    aabb bbox;                   ///< World-space bounds
+
+    /**
+     * @brief Recompute the world bounds (infinite bounds are not transformed, which would give NaN)
+     */
+    void update_bounds(const transform &object_to_world)
+    {
+        bbox = object->is_bounded() ? object_to_world.apply_box(object->bounding_box()) : aabb::universe;
+    }
+};
+
+#endif
@@ -0,0 +1,519 @@
+#ifndef LBVH_H
+#define LBVH_H
+
+#include "aabb.h"
+#include "bvh.h"
+#include "morton.h"
+#include "rtweekend.h"
+#include "scheduler.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+/**
+ * @file lbvh.h
+ * @brief Linear BVH construction from Morton codes
+ *
+ * This file implements a fast alternative to the binned SAH build of
+ * bvh_tree for scenes that are rebuilt interactively. Primitive centroids
+ * are mapped to Morton codes, which order them along a space-filling
+ * curve, and sorted with a parallel radix sort. The hierarchy follows
+ * from the sorted codes: every node splits its range where the highest
+ * differing code bit changes, which is a binary search per node, so the
+ * whole hierarchy is emitted in linear time for balanced trees.
+ *
+ * The Morton split ignores primitive sizes and leaves the tree well
+ * below SAH quality. An optional pass restructures small treelets (Karras
+ * and Aila 2013): for every node, the topology over its largest
+ * descendants is replaced by the one with the lowest SAH cost, found by
+ * dynamic programming over all subsets. The builder produces the same
+ * flat layout as bvh_tree::build(), so owners and traversal are unchanged.
+ */
+
+/**
+ * @class lbvh_builder
+ * @brief Builds a bvh_tree from sorted Morton codes
+ */
+class lbvh_builder
+{
+public:
+    int morton_bits = 0;            ///< 30 or 63 bits per code; 0 picks 63 above 2^20 primitives
+    bool optimize_treelets = false; ///< Run the treelet restructuring pass
+    int treelet_size = 7;           ///< Leaves per restructured treelet (3 to 8)
+    thread_pool *pool = nullptr;    ///< Workers for the parallel stages; nullptr uses shared_pool() for large inputs
+
+    /**
+     * @brief Build the hierarchy
+     * @param tree Tree to fill (its max_leaf_size is honoured)
+     * @param bounds Bounding box of every primitive
+     * @return Primitive indices in leaf order, as for bvh_tree::build()
+     */
+    std::vector<uint32_t> build(bvh_tree &tree, const std::vector<aabb> &bounds)
+    {
+        size_t count = bounds.size();
+        if (count == 0)
+        {
+            tree.assign(std::vector<bvh_node>{{aabb::empty, 0, 0, 0}});
+            return {};
+        }
+
+        std::unique_lock<std::mutex> shared_lock;
+        thread_pool *workers = pool;
+        if (!workers && count >= parallel_threshold)
+        {
+            shared_lock = std::unique_lock<std::mutex>(shared_pool_mutex());
+            workers = &shared_pool();
+        }
+
+        std::vector<uint64_t> codes;
+        std::vector<uint32_t> order;
+        {
+            trace_scope scope("LBVH Morton sort", "accel");
+            int bits = morton_bits == 30 || morton_bits == 63 ? morton_bits : (count > (size_t(1) << 20) ? 63 : 30);
+            compute_codes(bounds, bits, workers, codes, order);
+            radix_sort(codes, order, bits, workers);
+        }
+
+        max_leaf_size = std::max(1, tree.max_leaf_size);
+        source_bounds = &bounds;
+        sorted_codes = &codes;
+        sorted_order = &order;
+        nodes.clear();
+        nodes.reserve(2 * count / max_leaf_size + 1);
+        {
+            trace_scope scope("LBVH emit", "accel");
+            emit(0, count);
+        }
+
+        if (optimize_treelets)
+        {
+            trace_scope scope("LBVH treelets", "accel");
+            optimize(workers);
+        }
+
+        // Flatten into the depth-first layout with leaves addressing contiguous ranges
+        std::vector<bvh_node> flat;
+        flat.reserve(nodes.size());
+        std::vector<uint32_t> leaf_order;
+        leaf_order.reserve(count);
+        flatten(0, flat, leaf_order);
+        tree.assign(std::move(flat));
+
+        nodes.clear();
+        nodes.shrink_to_fit();
+        return leaf_order;
+    }
+
+    /**
+     * @brief Workers of large builds that were not given a pool
+     *
+     * Started by the first such build and kept for the process, so
+     * repeated rebuilds (bvh_accel::update) do not start threads each
+     * time. thread_pool::run() serves one caller at a time, so builds
+     * using it hold shared_pool_mutex().
+     */
+    static thread_pool &shared_pool()
+    {
+        static thread_pool workers;
+        return workers;
+    }
+
+private:
+    static std::mutex &shared_pool_mutex()
+    {
+        static std::mutex mutex;
+        return mutex;
+    }
+
+    static constexpr size_t parallel_threshold = size_t(1) << 16; ///< Inputs smaller than this are built serially
+    static constexpr double traversal_cost = 1.0;                  ///< Relative cost of a box test (as in bvh_tree)
+    static constexpr double intersection_cost = 1.0;               ///< Relative cost of a primitive test (as in bvh_tree)
+
+    /**
+     * @brief Node of the intermediate tree, linked by index
+     */
+    struct build_node
+    {
+        aabb bbox;          ///< Bounds of the subtree
+        uint32_t left = 0;  ///< Left child (interior)
+        uint32_t right = 0; ///< Right child (interior)
+        uint32_t first = 0; ///< First sorted primitive (leaf)
+        uint32_t count = 0; ///< Number of primitives (0 for interior nodes)
+        double cost = 0;    ///< Unnormalized SAH cost of the subtree
+    };
+
+    std::vector<build_node> nodes;                       ///< Intermediate tree (root at index 0)
+    int max_leaf_size = 4;                               ///< Largest leaf of the tree being built
+    const std::vector<aabb> *source_bounds = nullptr;    ///< Primitive bounds of the current build
+    const std::vector<uint64_t> *sorted_codes = nullptr; ///< Morton codes in sorted order
+    const std::vector<uint32_t> *sorted_order = nullptr; ///< Primitive indices in sorted order
+
+    /**
+     * @brief Run body(begin, end, worker) over equal slices of [0, count) on the workers
+     */
+    template <typename Body>
+    static void parallel_for(thread_pool *workers, size_t count, Body &&body)
+    {
+        if (!workers || workers->size() == 1)
+        {
+            body(size_t(0), count, 0);
+            return;
+        }
+        size_t slices = size_t(workers->size());
+        workers->run([&](int worker) {
+            size_t begin = count * size_t(worker) / slices, end = count * size_t(worker + 1) / slices;
+            body(begin, end, worker);
+        });
+    }
+
+    /**
+     * @brief Morton code of every centroid on a grid over the centroid bounds
+     */
+    static void compute_codes(const std::vector<aabb> &bounds, int bits, thread_pool *workers,
+                              std::vector<uint64_t> &codes, std::vector<uint32_t> &order)
+    {
+        aabb centroid_bounds;
+        for (const auto &box : bounds)
+            centroid_bounds.expand(box.centroid());
+
+        int axis_bits = bits / 3;
+        double cells = double(uint64_t(1) << axis_bits);
+        double scale[3], offset[3];
+        for (int axis = 0; axis < 3; axis++)
+        {
+            const interval &extent = centroid_bounds.axis_interval(axis);
+            // A denormal extent overflows the scale; such an axis contributes no code bits
+            scale[axis] = extent.size() > 0 && std::isfinite(cells / extent.size()) ? cells / extent.size() : 0;
+            offset[axis] = extent.min;
+        }
+
+        codes.resize(bounds.size());
+        order.resize(bounds.size());
+        parallel_for(workers, bounds.size(), [&](size_t begin, size_t end, int) {
+            for (size_t i = begin; i < end; i++)
+            {
+                point3 centroid = bounds[i].centroid();
+                uint64_t code = 0;
+                for (int axis = 0; axis < 3; axis++)
+                {
+                    double cell = std::min((centroid[axis] - offset[axis]) * scale[axis], cells - 1);
+                    code |= morton_spread_bits(uint64_t(std::max(cell, 0.0))) << (2 - axis);
+                }
+                codes[i] = code;
+                order[i] = uint32_t(i);
+            }
+        });
+    }
+
+    /**
+     * @brief Stable least-significant-digit radix sort of (code, index) pairs by code
+     *
+     * Every pass sorts by eight bits. Workers count the digits of their
+     * slice, the counts are turned into per-worker output offsets, and
+     * each worker scatters its slice, which keeps the sort stable. Passes
+     * over digits that all codes share are skipped.
+     */
+    static void radix_sort(std::vector<uint64_t> &codes, std::vector<uint32_t> &order, int bits, thread_pool *workers)
+    {
+        size_t count = codes.size();
+        int slices = workers ? workers->size() : 1;
+        std::vector<uint64_t> codes_out(count);
+        std::vector<uint32_t> order_out(count);
+        std::vector<size_t> histogram(size_t(slices) * 256);
+
+        for (int shift = 0; shift < bits; shift += 8)
+        {
+            std::fill(histogram.begin(), histogram.end(), 0);
+            parallel_for(workers, count, [&](size_t begin, size_t end, int worker) {
+                size_t *counts = &histogram[size_t(worker) * 256];
+                for (size_t i = begin; i < end; i++)
+                    counts[(codes[i] >> shift) & 0xff]++;
+            });
+
+            // Turn the counts into output offsets, digit-major and worker-minor
+            size_t offset = 0;
+            bool single_digit = false;
+            for (int digit = 0; digit < 256; digit++)
+            {
+                size_t digit_total = 0;
+                for (int worker = 0; worker < slices; worker++)
+                {
+                    size_t &slot = histogram[size_t(worker) * 256 + digit];
+                    size_t worker_count = slot;
+                    slot = offset;
+                    offset += worker_count;
+                    digit_total += worker_count;
+                }
+                single_digit |= digit_total == count;
+            }
+            if (single_digit)
+                continue;
+
+            parallel_for(workers, count, [&](size_t begin, size_t end, int worker) {
+                size_t *offsets = &histogram[size_t(worker) * 256];
+                for (size_t i = begin; i < end; i++)
+                {
+                    size_t target = offsets[(codes[i] >> shift) & 0xff]++;
+                    codes_out[target] = codes[i];
+                    order_out[target] = order[i];
+                }
+            });
+            codes.swap(codes_out);
+            order.swap(order_out);
+        }
+    }
+
+    /**
+     * @brief Emit the subtree over sorted primitives [begin, end)
+     * @return Index of the subtree's root in nodes
+     */
+    uint32_t emit(size_t begin, size_t end)
+    {
+        uint32_t node_index = uint32_t(nodes.size());
+        nodes.emplace_back();
+
+        size_t count = end - begin;
+        if (count <= size_t(max_leaf_size))
+        {
+            aabb bbox;
+            for (size_t i = begin; i < end; i++)
+                bbox = aabb(bbox, (*source_bounds)[(*sorted_order)[i]]);
+            build_node &leaf = nodes[node_index];
+            leaf.bbox = bbox;
+            leaf.first = uint32_t(begin);
+            leaf.count = uint32_t(count);
+            leaf.cost = intersection_cost * count * bbox.surface_area();
+            return node_index;
+        }
+
+        // Split where the highest bit that differs within the range turns on
+        const std::vector<uint64_t> &codes = *sorted_codes;
+        uint64_t differing = codes[begin] ^ codes[end - 1];
+        size_t mid;
+        if (differing == 0)
+            mid = begin + count / 2; // Identical codes: split in the middle
+        else
+        {
+            uint64_t bit = uint64_t(1) << (63 - __builtin_clzll(differing));
+            mid = size_t(std::partition_point(codes.begin() + begin, codes.begin() + end,
+                                              [&](uint64_t code) { return (code & bit) == 0; }) -
+                         codes.begin());
+        }
+
+        uint32_t left = emit(begin, mid);
+        uint32_t right = emit(mid, end);
+        build_node &node = nodes[node_index];
+        node.left = left;
+        node.right = right;
+        update_interior(node);
+        return node_index;
+    }
+
+    /**
+     * @brief Recompute the bounds and cost of an interior node from its children
+     */
+    void update_interior(build_node &node) const
+    {
+        node.bbox = aabb(nodes[node.left].bbox, nodes[node.right].bbox);
+        node.cost = traversal_cost * node.bbox.surface_area() + nodes[node.left].cost + nodes[node.right].cost;
+    }
+
+    /**
+     * @brief Restructure the treelets of all nodes, children before parents
+     *
+     * Subtrees below a fixed depth are independent and are optimized in
+     * parallel; the nodes above them are optimized afterwards.
+     */
+    void optimize(thread_pool *workers)
+    {
+        std::vector<uint32_t> frontier, upper;
+        collect_frontier(0, 0, workers ? frontier_depth : 0, frontier, upper);
+
+        std::atomic<size_t> next(0);
+        auto optimize_frontier = [&] {
+            for (size_t k; (k = next.fetch_add(1)) < frontier.size();)
+                optimize_subtree(frontier[k]);
+        };
+        if (workers)
+            workers->run([&](int) { optimize_frontier(); });
+        else
+            optimize_frontier();
+
+        // upper holds the nodes above the frontier in pre-order; reverse it to visit children first
+        for (size_t k = upper.size(); k-- > 0;)
+            restructure(upper[k]);
+    }
+
+    static constexpr int frontier_depth = 6; ///< Depth of the subtrees optimized in parallel
+
+    void collect_frontier(uint32_t node, int depth, int max_depth, std::vector<uint32_t> &frontier,
+                          std::vector<uint32_t> &upper) const
+    {
+        if (nodes[node].count > 0)
+            return;
+        if (depth == max_depth)
+        {
+            frontier.push_back(node);
+            return;
+        }
+        upper.push_back(node);
+        collect_frontier(nodes[node].left, depth + 1, max_depth, frontier, upper);
+        collect_frontier(nodes[node].right, depth + 1, max_depth, frontier, upper);
+    }
+
+    void optimize_subtree(uint32_t node)
+    {
+        if (nodes[node].count > 0)
+            return;
+        optimize_subtree(nodes[node].left);
+        optimize_subtree(nodes[node].right);
+        restructure(node);
+    }
+
+    /**
+     * @brief Replace the treelet below an interior node by its SAH-optimal topology
+     *
+     * The treelet is grown by opening its largest interior leaf until it
+     * has treelet_size leaves. The best cost of every subset of leaves is
+     * found by trying all of its two-way partitions, smallest subsets
+     * first. If the best topology is cheaper, the treelet's interior nodes
+     * are reused to link it.
+     */
+    void restructure(uint32_t root)
+    {
+        constexpr int max_leaves = 8;
+        int leaf_limit = std::clamp(treelet_size, 3, max_leaves);
+
+        uint32_t leaves[max_leaves], interior[max_leaves];
+        int leaf_count = 2, interior_count = 1;
+        leaves[0] = nodes[root].left;
+        leaves[1] = nodes[root].right;
+        interior[0] = root;
+        while (leaf_count < leaf_limit)
+        {
+            int largest = -1;
+            double largest_area = -1;
+            for (int k = 0; k < leaf_count; k++)
+            {
+                const build_node &candidate = nodes[leaves[k]];
+                if (candidate.count == 0 && candidate.bbox.surface_area() > largest_area)
+                {
+                    largest = k;
+                    largest_area = candidate.bbox.surface_area();
+                }
+            }
+            if (largest < 0)
+                break;
+            uint32_t opened = leaves[largest];
+            interior[interior_count++] = opened;
+            leaves[largest] = nodes[opened].left;
+            leaves[leaf_count++] = nodes[opened].right;
+        }
+        if (leaf_count < 3)
+            return;
+
+        // Best cost and partition of every subset of the treelet leaves
+        int subsets = 1 << leaf_count;
+        double area[1 << max_leaves], cost[1 << max_leaves];
+        int partition[1 << max_leaves];
+        for (int s = 1; s < subsets; s++)
+        {
+            aabb box;
+            for (int k = 0; k < leaf_count; k++)
+                if (s & (1 << k))
+                    box = aabb(box, nodes[leaves[k]].bbox);
+            area[s] = box.surface_area();
+        }
+        for (int k = 0; k < leaf_count; k++)
+            cost[1 << k] = nodes[leaves[k]].cost;
+        for (int s = 1; s < subsets; s++)
+        {
+            if ((s & (s - 1)) == 0)
+                continue;
+            // Every partition is tried once: the lowest leaf of s stays on the left side
+            int lowest = s & -s;
+            double best = infinity;
+            int best_partition = 0;
+            for (int left = (s - 1) & s; left > 0; left = (left - 1) & s)
+            {
+                if (!(left & lowest))
+                    continue;
+                double candidate = cost[left] + cost[s ^ left];
+                if (candidate < best)
+                {
+                    best = candidate;
+                    best_partition = left;
+                }
+            }
+            cost[s] = traversal_cost * area[s] + best;
+            partition[s] = best_partition;
+        }
+
+        if (!(cost[subsets - 1] < nodes[root].cost * (1 - 1e-9)))
+            return;
+
+        int next_interior = 0;
+        link(subsets - 1, leaves, interior, next_interior, partition);
+    }
+
+    /**
+     * @brief Link the nodes of an optimal treelet subset
+     * @return Node index of the subset's root
+     */
+    uint32_t link(int subset, const uint32_t *leaves, const uint32_t *interior, int &next_interior, const int *partition)
+    {
+        if ((subset & (subset - 1)) == 0)
+            return leaves[__builtin_ctz(unsigned(subset))];
+
+        // The first interior node taken is the treelet root, so its parent link stays valid
+        uint32_t node_index = interior[next_interior++];
+        uint32_t left = link(partition[subset], leaves, interior, next_interior, partition);
+        uint32_t right = link(subset ^ partition[subset], leaves, interior, next_interior, partition);
+        build_node &node = nodes[node_index];
+        node.left = left;
+        node.right = right;
+        update_interior(node);
+        return node_index;
+    }
+
+    /**
+     * @brief Write the subtree below a node in depth-first order
+     * @return Index of the subtree's root in flat
+     */
+    uint32_t flatten(uint32_t node_index, std::vector<bvh_node> &flat, std::vector<uint32_t> &leaf_order) const
+    {
+        const build_node &node = nodes[node_index];
+        uint32_t flat_index = uint32_t(flat.size());
+        flat.push_back({});
+
+        if (node.count > 0)
+        {
+            flat[flat_index] = {node.bbox, uint32_t(leaf_order.size()), uint16_t(node.count), 0};
+            for (uint32_t i = node.first; i < node.first + node.count; i++)
+                leaf_order.push_back((*sorted_order)[i]);
+            return flat_index;
+        }
+
+        // Store the lower child first along the axis that separates the child centers most
+        uint32_t lower = node.left, upper = node.right;
+        vec3 separation = nodes[upper].bbox.centroid() - nodes[lower].bbox.centroid();
+        int axis = 0;
+        for (int a = 1; a < 3; a++)
+            if (std::fabs(separation[a]) > std::fabs(separation[axis]))
+                axis = a;
+        if (separation[axis] < 0)
+            std::swap(lower, upper);
+
+        flatten(lower, flat, leaf_order);
+        uint32_t right = flatten(upper, flat, leaf_order);
+        flat[flat_index] = {node.bbox, right, 0, uint16_t(axis)};
+        return flat_index;
+    }
+};
+
+#endif
@@ -0,0 +1,205 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include "rtweekend.h"
+
+#include <cstdio>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define RT_HAVE_MMAP 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/**
+ * @file mapped_file.h
+ * @brief Read-only memory-mapped files and arrays backed by them
+ *
+ * This file implements the storage used to load prebuilt data structures
+ * without parsing or copying: a file is mapped into memory and arrays
+ * point straight into it. Data that is only read is paged in on demand
+ * and shared between processes rendering the same geometry.
+ */
+
+/**
+ * @class mapped_file
+ * @brief Read-only view of a whole file in memory
+ *
+ * Uses mmap where available (RT_HAVE_MMAP) and reads the file into a
+ * buffer elsewhere. The mapping is page-aligned, so data stored at
+ * aligned offsets in the file is aligned in memory.
+ */
+class mapped_file
+{
+public:
+    /**
+     * @brief Map a file
+     * @param path File to map
+     * @param error Description of the failure (output)
+     * @return The mapping, or nullptr on failure
+     */
+    static shared_ptr<const mapped_file> open(const std::string &path, std::string &error)
+    {
+        auto file = shared_ptr<mapped_file>(new mapped_file());
+#ifdef RT_HAVE_MMAP
+        int fd = ::open(path.c_str(), O_RDONLY);
+        struct stat info;
+        if (fd < 0 || ::fstat(fd, &info) != 0 || info.st_size <= 0)
+        {
+            if (fd >= 0)
+                ::close(fd);
+            error = "cannot open " + path;
+            return nullptr;
+        }
+        void *address = ::mmap(nullptr, size_t(info.st_size), PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd); // The mapping stays valid after the descriptor is closed
+        if (address == MAP_FAILED)
+        {
+            error = "cannot map " + path;
+            return nullptr;
+        }
+        file->bytes = static_cast<const char *>(address);
+        file->length = size_t(info.st_size);
+#else
+        FILE *in = std::fopen(path.c_str(), "rb");
+        if (!in)
+        {
+            error = "cannot open " + path;
+            return nullptr;
+        }
+        char block[1 << 16];
+        size_t size;
+        while ((size = std::fread(block, 1, sizeof(block), in)) > 0)
+            file->buffer.insert(file->buffer.end(), block, block + size);
+        std::fclose(in);
+        file->bytes = file->buffer.data();
+        file->length = file->buffer.size();
+#endif
+        return file;
+    }
+
+    ~mapped_file()
+    {
+#ifdef RT_HAVE_MMAP
+        if (bytes)
+            ::munmap(const_cast<char *>(bytes), length);
+#endif
+    }
+
+    mapped_file(const mapped_file &) = delete;
+    mapped_file &operator=(const mapped_file &) = delete;
+
+    /**
+     * @brief First byte of the file
+     */
+    const char *data() const { return bytes; }
+
+    /**
+     * @brief Size of the file in bytes
+     */
+    size_t size() const { return length; }
+
+private:
+    mapped_file() = default;
+
+    const char *bytes = nullptr; ///< Start of the mapping
+    size_t length = 0;           ///< Length of the mapping
+#ifndef RT_HAVE_MMAP
+    std::vector<char> buffer; ///< File contents where mmap is unavailable
+#endif
+};
+
+/**
+ * @class mapped_array
+ * @brief Read-mostly array that is either owned or a view into a mapped file
+ *
+ * Built data structures own their elements; loaded ones point into the
+ * mapping, which the array keeps alive. mutable_data() turns a view into
+ * an owned copy before the first write, so loaded structures can still
+ * be refit.
+ */
+template <typename T>
+class mapped_array
+{
+    static_assert(std::is_trivially_copyable<T>::value, "mapped elements are used without construction");
+
+public:
+    mapped_array() = default;
+
+    /**
+     * @brief Take ownership of elements
+     */
+    mapped_array(std::vector<T> values) : owned(std::move(values)), items(owned.data()), count(owned.size()) {}
+
+    /**
+     * @brief View elements stored in a mapped file
+     * @param file Mapping that holds the elements (kept alive by the array)
+     * @param offset Byte offset of the first element (must be aligned for T)
+     * @param element_count Number of elements
+     */
+    mapped_array(shared_ptr<const mapped_file> file, size_t offset, size_t element_count)
+        : mapping(std::move(file)), count(element_count)
+    {
+        items = reinterpret_cast<const T *>(mapping->data() + offset);
+    }
+
+    mapped_array(const mapped_array &other) : owned(other.owned), mapping(other.mapping), count(other.count)
+    {
+        items = mapping ? other.items : owned.data();
+    }
+
+    mapped_array(mapped_array &&other) noexcept
+        : owned(std::move(other.owned)), mapping(std::move(other.mapping)), items(other.items), count(other.count)
+    {
+        other.items = nullptr;
+        other.count = 0;
+    }
+
+    mapped_array &operator=(mapped_array other) noexcept
+    {
+        owned.swap(other.owned);
+        mapping.swap(other.mapping);
+        std::swap(items, other.items);
+        std::swap(count, other.count);
+        return *this;
+    }
+
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    const T *data() const { return items; }
+    const T &operator[](size_t i) const { return items[i]; }
+    const T *begin() const { return items; }
+    const T *end() const { return items + count; }
+
+    /**
+     * @brief True if the elements are a view into a mapped file
+     */
+    bool is_mapped() const { return mapping != nullptr; }
+
+    /**
+     * @brief Writable elements, copying a mapped view into owned storage first
+     */
+    T *mutable_data()
+    {
+        if (mapping)
+        {
+            owned.assign(items, items + count);
+            mapping.reset();
+        }
+        items = owned.data();
+        return owned.data();
+    }
+
+private:
+    std::vector<T> owned;                 ///< Owned elements (empty for views)
+    shared_ptr<const mapped_file> mapping; ///< Mapping holding the elements of a view
+    const T *items = nullptr;             ///< First element
+    size_t count = 0;                     ///< Number of elements
+};
+
+#endif
@@ -0,0 +1,34 @@
+#ifndef MORTON_H
+#define MORTON_H
+
+#include <cstdint>
+
+/**
+ * @file morton.h
+ * @brief Morton (Z-order) codes
+ *
+ * Interleaving the bits of three grid coordinates gives a code whose
+ * order follows a space-filling curve, so points with close codes are
+ * close in space. Used to order primitives for the LBVH build and rays
+ * for coherent tracing.
+ */
+
+/**
+ * @brief Spread the low bits of a value so that two zero bits follow each one
+ * @param value Value with at most 21 significant bits
+ *
+ * The code of a cell (x, y, z) is
+ * morton_spread_bits(x) << 2 | morton_spread_bits(y) << 1 | morton_spread_bits(z).
+ */
+inline uint64_t morton_spread_bits(uint64_t value)
+{
+    value &= 0x1fffff;
+    value = (value | value << 32) & 0x1f00000000ffffULL;
+    value = (value | value << 16) & 0x1f0000ff0000ffULL;
+    value = (value | value << 8) & 0x100f00f00f00f00fULL;
+    value = (value | value << 4) & 0x10c30c30c30c30c3ULL;
+    value = (value | value << 2) & 0x1249249249249249ULL;
+    return value;
+}
+
+#endif
@@ -0,0 +1,273 @@
+#ifndef OBJ_LOADER_H
+#define OBJ_LOADER_H
+
+#include "rtweekend.h"
+#include "trace.h"
+#include "triangle_mesh.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+/**
+ * @file obj_loader.h
+ * @brief Streaming Wavefront OBJ loader
+ *
+ * This file implements a fast loader for the geometry of Wavefront OBJ
+ * files. The file is read in large blocks and parsed in place with a
+ * hand-written number parser, without building a string per line. Only
+ * vertex positions (`v`) and faces (`f`) are used; polygons are split
+ * into triangle fans and all other statements are ignored.
+ */
+
+/**
+ * @class obj_loader
+ * @brief Parser state for loading one OBJ file into flat buffers
+ */
+class obj_loader
+{
+public:
+    std::vector<point3> vertices;  ///< Vertex positions
+    std::vector<uint32_t> indices; ///< Three vertex indices per triangle
+    std::string error;             ///< Description of the first error, if loading failed
+
+    /**
+     * @brief Load an OBJ file
+     * @param path File to read
+     * @return True on success; on failure `error` describes the problem
+     */
+    bool load(const std::string &path)
+    {
+        trace_scope scope("load OBJ", "scene");
+
+        vertices.clear();
+        indices.clear();
+        error.clear();
+        line_number = 0;
+
+        std::FILE *file = std::fopen(path.c_str(), "rb");
+        if (!file)
+        {
+            error = "cannot open " + path;
+            return false;
+        }
+
+        // Parse block by block; a partial last line is carried into the next block
+        const size_t block_size = size_t(1) << 20;
+        std::vector<char> buffer(block_size + 1);
+        size_t carried = 0;
+        bool ok = true;
+
+        while (ok)
+        {
+            size_t read = std::fread(buffer.data() + carried, 1, block_size - carried, file);
+            size_t filled = carried + read;
+            bool at_end = read == 0 || std::feof(file);
+
+            size_t line_start = 0;
+            for (size_t k = 0; k < filled && ok; k++)
+            {
+                if (buffer[k] != '\n')
+                    continue;
+                buffer[k] = '\0';
+                ok = parse_line(buffer.data() + line_start, buffer.data() + k);
+                line_start = k + 1;
+            }
+
+            carried = filled - line_start;
+            if (ok && at_end)
+            {
+                if (carried > 0)
+                {
+                    buffer[filled] = '\0';
+                    ok = parse_line(buffer.data() + line_start, buffer.data() + filled);
+                }
+                break;
+            }
+
+            if (carried == block_size)
+            {
+                error = "line " + std::to_string(line_number + 1) + " is too long";
+                ok = false;
+            }
+            std::copy(buffer.begin() + line_start, buffer.begin() + filled, buffer.begin());
+        }
+
+        std::fclose(file);
+        return ok;
+    }
+
+    /**
+     * @brief Build a triangle mesh from the loaded buffers
+     * @param mat Material applied to the mesh
+     * @param method Algorithm used to build the mesh BVH
+     * @return The mesh (the loader's buffers are moved into it)
+     */
+    shared_ptr<triangle_mesh> make_mesh(shared_ptr<material> mat, bvh_build_method method = sah_build)
+    {
+        return make_shared<triangle_mesh>(std::move(vertices), std::move(indices), mat, method);
+    }
+
+private:
+    size_t line_number = 0;          ///< Number of lines parsed so far
+    std::vector<uint32_t> face;      ///< Vertex indices of the face being parsed
+
+    static bool is_space(char c) { return c == ' ' || c == '\t' || c == '\r'; }
+
+    static const char *skip_space(const char *p)
+    {
+        while (is_space(*p))
+            p++;
+        return p;
+    }
+
+    /**
+     * @brief Parse a decimal floating point number
+     * @param p Start of the number (leading blanks are skipped)
+     * @param value Parsed value (output)
+     * @return Pointer past the number, or nullptr if there is no number
+     *
+     * Up to 19 significant digits are accumulated in an integer and scaled
+     * once by a power of ten, which is exact for typical OBJ coordinates.
+     */
+    static const char *parse_double(const char *p, double &value)
+    {
+        static const double powers[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+                                        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+        p = skip_space(p);
+        bool negative = *p == '-';
+        if (*p == '-' || *p == '+')
+            p++;
+
+        uint64_t mantissa = 0;
+        int exponent = 0, digits = 0;
+        const char *start = p;
+        for (; *p >= '0' && *p <= '9'; p++)
+        {
+            if (digits < 19)
+                mantissa = mantissa * 10 + (*p - '0'), digits += mantissa > 0;
+            else
+                exponent++;
+        }
+        if (*p == '.')
+        {
+            for (p++; *p >= '0' && *p <= '9'; p++)
+            {
+                if (digits < 19)
+                    mantissa = mantissa * 10 + (*p - '0'), digits += mantissa > 0, exponent--;
+            }
+        }
+        if (p == start || (p == start + 1 && *start == '.'))
+            return nullptr;
+
+        if (*p == 'e' || *p == 'E')
+        {
+            const char *q = p + 1;
+            bool exp_negative = *q == '-';
+            if (*q == '-' || *q == '+')
+                q++;
+            if (*q >= '0' && *q <= '9')
+            {
+                int e = 0;
+                for (; *q >= '0' && *q <= '9'; q++)
+                    e = std::min(e * 10 + (*q - '0'), 100000);
+                exponent += exp_negative ? -e : e;
+                p = q;
+            }
+        }
+
+        value = double(mantissa);
+        if (exponent < 0)
+            value = exponent >= -22 ? value / powers[-exponent] : value * std::pow(10.0, exponent);
+        else if (exponent > 0)
+            value = exponent <= 22 ? value * powers[exponent] : value * std::pow(10.0, exponent);
+        if (negative)
+            value = -value;
+        return p;
+    }
+
+    /**
+     * @brief Parse a (possibly negative) integer
+     * @return Pointer past the number, or nullptr if there is no number
+     */
+    static const char *parse_int(const char *p, long &value)
+    {
+        bool negative = *p == '-';
+        if (*p == '-' || *p == '+')
+            p++;
+        if (*p < '0' || *p > '9')
+            return nullptr;
+        long v = 0;
+        for (; *p >= '0' && *p <= '9'; p++)
+            v = v * 10 + (*p - '0');
+        value = negative ? -v : v;
+        return p;
+    }
+
+    /**
+     * @brief Parse one line of the file
+     * @param p Start of the line
+     * @param end End of the line (points at a terminating '\0')
+     * @return False on a malformed vertex or face
+     */
+    bool parse_line(const char *p, const char *end)
+    {
+        line_number++;
+        p = skip_space(p);
+
+        if (p[0] == 'v' && is_space(p[1]))
+        {
+            double x, y, z;
+            const char *q = parse_double(p + 2, x);
+            q = q ? parse_double(q, y) : nullptr;
+            q = q ? parse_double(q, z) : nullptr;
+            if (!q)
+                return fail("malformed vertex");
+            vertices.push_back(point3(x, y, z));
+            return true;
+        }
+
+        if (p[0] == 'f' && is_space(p[1]))
+        {
+            face.clear();
+            p = skip_space(p + 2);
+            while (p < end && *p)
+            {
+                long index;
+                const char *q = parse_int(p, index);
+                if (!q)
+                    return fail("malformed face");
+
+                // Negative indices count back from the most recent vertex
+                long resolved = index < 0 ? long(vertices.size()) + index : index - 1;
+                if (index == 0 || resolved < 0 || resolved >= long(vertices.size()))
+                    return fail("face references a missing vertex");
+                face.push_back(uint32_t(resolved));
+
+                // Skip texture coordinate and normal references (v/vt/vn)
+                while (*q && !is_space(*q))
+                    q++;
+                p = skip_space(q);
+            }
+
+            if (face.size() < 3)
+                return fail("face with fewer than three vertices");
+            for (size_t k = 1; k + 1 < face.size(); k++)
+            {
+                indices.push_back(face[0]);
+                indices.push_back(face[k]);
+                indices.push_back(face[k + 1]);
+            }
+        }
+        return true;
+    }
+
+    bool fail(const char *message)
+    {
+        error = std::string(message) + " on line " + std::to_string(line_number);
+        return false;
+    }
+};
+
+#endif
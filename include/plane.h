@@ -0,0 +1,82 @@
+#ifndef PLANE_H
+#define PLANE_H
+
+#include "hittable.h"
+#include "rtweekend.h"
+
+/**
+ * @file plane.h
+ * @brief Infinite plane primitive
+ *
+ * This file implements an unbounded plane, used for the ground of the
+ * standard scenes. A ray-plane test is a division by the dot product of
+ * the ray direction with the normal, against a full quadratic for a
+ * sphere, and is exact at any distance from the origin.
+ */
+
+/**
+ * @class plane
+ * @brief Plane through a point, extending infinitely in all directions
+ *
+ * The plane is unbounded (see hittable::is_bounded), so acceleration
+ * structures test it on its own rather than putting its infinite
+ * bounding box into their hierarchy.
+ */
+class plane : public hittable
+{
+public:
+    /**
+     * @brief Constructor
+     * @param point Any point on the plane
+     * @param normal Front-facing normal (need not be unit length)
+     * @param mat Material applied to the plane surface
+     */
+    plane(const point3 &point, const vec3 &normal, shared_ptr<material> mat)
+        : normal(unit_vector(normal)), offset(dot(unit_vector(normal), point)), mat(mat)
+    {
+    }
+
+    /**
+     * @brief Test ray-plane intersection
+     * @param r The ray to test for intersection
+     * @param ray_t The interval along the ray to test for intersections
+     * @param rec Reference to hit_record to fill with intersection data
+     * @return True if the ray crosses the plane within the interval
+     *
+     * Solves dot(normal, A + tB) = offset for t. Rays parallel to the
+     * plane never hit it.
+     */
+    bool hit(const ray &r, interval ray_t, hit_record &rec) const override
+    {
+        double denominator = dot(normal, r.direction());
+        if (denominator == 0)
+            return false;
+
+        double t = (offset - dot(normal, r.origin())) / denominator;
+        if (!ray_t.surrounds(t))
+            return false;
+
+        rec.t = t;
+        rec.p = r.at(t);
+        rec.set_face_normal(r, normal);
+        rec.mat = mat;
+        return true;
+    }
+
+    /**
+     * @brief Get the bounding box of the plane (all of space)
+     */
+    aabb bounding_box() const override { return aabb::universe; }
+
+    /**
+     * @brief Planes are unbounded
+     */
+    bool is_bounded() const override { return false; }
+
+private:
+    vec3 normal;              ///< Unit front-facing normal
+    double offset;            ///< dot(normal, p) for every point p on the plane
+    shared_ptr<material> mat; ///< Material applied to the plane surface
+};
+
+#endif
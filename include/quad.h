@@ -0,0 +1,163 @@
+#ifndef QUAD_H
+#define QUAD_H
+
+#include "hittable.h"
+#include "rtweekend.h"
+
+#include <cmath>
+
+/**
+ * @file quad.h
+ * @brief Bounded planar primitives: quadrilaterals and disks
+ *
+ * Both primitives intersect the ray with their supporting plane first,
+ * then check whether the hit point lies inside the shape. They are flat,
+ * so an axis-aligned quad or disk has a box of zero thickness along its
+ * normal; BVH slab tests treat such boxes as hit (see aabb::hit).
+ */
+
+/**
+ * @class quad
+ * @brief Parallelogram spanned by two edge vectors from a corner
+ *
+ * Covers corner + a * u + b * v for a and b in [0, 1]. Perpendicular
+ * edges along two coordinate axes give an axis-aligned rectangle.
+ */
+class quad : public hittable
+{
+public:
+    /**
+     * @brief Constructor
+     * @param corner One corner of the quad
+     * @param u First edge from the corner
+     * @param v Second edge from the corner; the front face is toward cross(u, v)
+     * @param mat Material applied to the quad surface
+     */
+    quad(const point3 &corner, const vec3 &u, const vec3 &v, shared_ptr<material> mat)
+        : corner(corner), u(u), v(v), mat(mat)
+    {
+        vec3 n = cross(u, v);
+        normal = unit_vector(n);
+        offset = dot(normal, corner);
+        w = n / dot(n, n);
+        bbox = aabb(aabb(corner, corner + u + v), aabb(corner + u, corner + v));
+    }
+
+    /**
+     * @brief Test ray-quad intersection
+     * @param r The ray to test for intersection
+     * @param ray_t The interval along the ray to test for intersections
+     * @param rec Reference to hit_record to fill with intersection data
+     * @return True if the ray hits the quad within the interval
+     *
+     * The plane hit point is expressed in the (u, v) edge coordinates;
+     * it is inside the quad when both coordinates are in [0, 1].
+     */
+    bool hit(const ray &r, interval ray_t, hit_record &rec) const override
+    {
+        double denominator = dot(normal, r.direction());
+        if (denominator == 0)
+            return false;
+
+        double t = (offset - dot(normal, r.origin())) / denominator;
+        if (!ray_t.surrounds(t))
+            return false;
+
+        point3 p = r.at(t);
+        vec3 planar = p - corner;
+        double a = dot(w, cross(planar, v));
+        double b = dot(w, cross(u, planar));
+        if (a < 0 || a > 1 || b < 0 || b > 1)
+            return false;
+
+        rec.t = t;
+        rec.p = p;
+        rec.set_face_normal(r, normal);
+        rec.mat = mat;
+        return true;
+    }
+
+    /**
+     * @brief Get the bounding box of the quad
+     */
+    aabb bounding_box() const override { return bbox; }
+
+private:
+    point3 corner;            ///< Corner the edges start from
+    vec3 u, v;                ///< Edge vectors
+    vec3 normal;              ///< Unit front-facing normal
+    double offset;            ///< dot(normal, p) for every point p on the quad's plane
+    vec3 w;                   ///< cross(u, v) / |cross(u, v)|², maps plane points to edge coordinates
+    shared_ptr<material> mat; ///< Material applied to the quad surface
+    aabb bbox;                ///< Bounding box of the four corners
+};
+
+/**
+ * @class disk
+ * @brief Flat circular disk
+ */
+class disk : public hittable
+{
+public:
+    /**
+     * @brief Constructor
+     * @param center Center of the disk
+     * @param normal Front-facing normal (need not be unit length)
+     * @param radius Radius of the disk (must be non-negative)
+     * @param mat Material applied to the disk surface
+     */
+    disk(const point3 &center, const vec3 &normal, double radius, shared_ptr<material> mat)
+        : center(center), normal(unit_vector(normal)), radius(std::fmax(0, radius)), mat(mat)
+    {
+        offset = dot(this->normal, center);
+
+        // A disk reaches radius * sin(angle between normal and axis) along each axis
+        vec3 extent;
+        for (int axis = 0; axis < 3; axis++)
+            extent[axis] = this->radius * std::sqrt(std::fmax(0, 1 - this->normal[axis] * this->normal[axis]));
+        bbox = aabb(center - extent, center + extent);
+    }
+
+    /**
+     * @brief Test ray-disk intersection
+     * @param r The ray to test for intersection
+     * @param ray_t The interval along the ray to test for intersections
+     * @param rec Reference to hit_record to fill with intersection data
+     * @return True if the ray hits the disk within the interval
+     */
+    bool hit(const ray &r, interval ray_t, hit_record &rec) const override
+    {
+        double denominator = dot(normal, r.direction());
+        if (denominator == 0)
+            return false;
+
+        double t = (offset - dot(normal, r.origin())) / denominator;
+        if (!ray_t.surrounds(t))
+            return false;
+
+        point3 p = r.at(t);
+        if ((p - center).length_squared() > radius * radius)
+            return false;
+
+        rec.t = t;
+        rec.p = p;
+        rec.set_face_normal(r, normal);
+        rec.mat = mat;
+        return true;
+    }
+
+    /**
+     * @brief Get the bounding box of the disk
+     */
+    aabb bounding_box() const override { return bbox; }
+
+private:
+    point3 center;            ///< Center of the disk
+    vec3 normal;              ///< Unit front-facing normal
+    double radius;            ///< Radius of the disk
+    double offset;            ///< dot(normal, p) for every point p on the disk's plane
+    shared_ptr<material> mat; ///< Material applied to the disk surface
+    aabb bbox;                ///< Bounding box of the rim
+};
+
+#endif
@@ -3,6 +3,9 @@
 
 #include "vec3.h"
 
+#include <cmath>
+#include <cstdint>
+
 /**
  * @file ray.h
  * @brief Ray representation for ray tracing
@@ -18,7 +21,15 @@
  * 
  * A ray is defined by an origin point and a direction vector.
  * The ray can be parameterized as: P(t) = origin + t * direction
- * where t is the parameter along the ray.
+ * where t is the parameter along the ray. Each ray also carries the
+ * moment within the camera's exposure at which it travels, which moving
+ * objects use for motion blur.
+ *
+ * Intersection tests reuse a few quantities that depend only on the
+ * direction: its reciprocal and signs for every slab test of a BVH
+ * traversal, and its squared length for every sphere test. They are
+ * computed once when the ray is constructed, so a ray crossing hundreds
+ * of boxes and primitives pays for the divisions only once.
  */
 class ray
 {
@@ -26,14 +37,25 @@ public:
     /**
      * @brief Default constructor - creates ray at origin pointing in +Z
      */
-    ray() {}
+    ray() : tm(0) { precompute(); }
 
     /**
      * @brief Constructor with explicit origin and direction
      * @param origin Starting point of the ray
      * @param direction Direction vector (should be normalized for best results)
      */
-    ray(const point3 &origin, const vec3 &direction) : orig(origin), dir(direction) {}
+    ray(const point3 &origin, const vec3 &direction) : orig(origin), dir(direction), tm(0) { precompute(); }
+
+    /**
+     * @brief Constructor with explicit origin, direction and time
+     * @param origin Starting point of the ray
+     * @param direction Direction vector
+     * @param time Moment within the exposure, in [0, 1]
+     */
+    ray(const point3 &origin, const vec3 &direction, double time) : orig(origin), dir(direction), tm(time)
+    {
+        precompute();
+    }
 
     /**
      * @brief Get the origin point of the ray
@@ -47,6 +69,40 @@ public:
      */
     const vec3 &direction() const { return dir; }
 
+    /**
+     * @brief Get the componentwise reciprocal of the direction
+     * @return 1 / direction per axis; infinite for zero components
+     */
+    const vec3 &inverse_direction() const { return inv_dir; }
+
+    /**
+     * @brief Check whether the ray travels toward decreasing coordinates on an axis
+     * @param axis Axis index (0 = x, 1 = y, 2 = z)
+     * @return 1 if the reciprocal direction on the axis is negative, 0 otherwise
+     *
+     * Slab tests use it to pick the near and far side of a box without
+     * comparing the two distances. A component of -0 counts as negative,
+     * matching its reciprocal of -infinity.
+     */
+    int direction_sign(int axis) const { return (octant_bits >> axis) & 1; }
+
+    /**
+     * @brief Get the direction octant
+     * @return direction_sign() of x, y and z in bits 0, 1 and 2
+     */
+    int octant() const { return octant_bits; }
+
+    /**
+     * @brief Get the squared length of the direction
+     */
+    double direction_length_squared() const { return dir_length_squared; }
+
+    /**
+     * @brief Get the moment within the exposure at which the ray travels
+     * @return Time in [0, 1] (0 = shutter open, 1 = shutter close)
+     */
+    double time() const { return tm; }
+
     /**
      * @brief Calculate point on ray at parameter t
      * @param t Parameter along the ray (0 = origin, positive = forward)
@@ -60,8 +116,22 @@ public:
     }
 
 private:
-    point3 orig; ///< Origin point of the ray
-    vec3 dir;   ///< Direction vector of the ray
+    /**
+     * @brief Compute the direction-dependent members
+     */
+    void precompute()
+    {
+        inv_dir = vec3(1.0 / dir.x(), 1.0 / dir.y(), 1.0 / dir.z());
+        dir_length_squared = dir.length_squared();
+        octant_bits = uint8_t(std::signbit(inv_dir.x()) | std::signbit(inv_dir.y()) << 1 | std::signbit(inv_dir.z()) << 2);
+    }
+
+    point3 orig;               ///< Origin point of the ray
+    vec3 dir;                  ///< Direction vector of the ray
+    double tm;                 ///< Time within the exposure
+    vec3 inv_dir;              ///< Componentwise reciprocal of dir
+    double dir_length_squared; ///< dir.length_squared()
+    uint8_t octant_bits;       ///< Sign bits of inv_dir (bit i set if axis i is negative)
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,115 @@
+#ifndef RAY_SORT_H
+#define RAY_SORT_H
+
+#include "aabb.h"
+#include "morton.h"
+#include "ray.h"
+#include "rtweekend.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+/**
+ * @file ray_sort.h
+ * @brief Reordering of ray batches for coherent tracing
+ *
+ * Rays scattered by diffuse surfaces leave in random directions, so
+ * tracing them in pixel order jumps between distant parts of the scene
+ * from one ray to the next, and each ray finds little of its BVH nodes
+ * and primitives in cache. Sorting a batch by origin along a Morton curve
+ * and then by direction octant makes consecutive rays start close together
+ * and head the same way, so they traverse mostly the same nodes.
+ */
+
+/**
+ * @brief Sort key of a ray: Morton order of the origin, then direction octant
+ * @param r Ray to classify
+ * @param origin_bounds Box containing the origins of the batch
+ * @return 33-bit key; the octant is in the low three bits
+ *
+ * The Morton grid has cubic cells sized by the longest side of the box,
+ * so a flat batch (rays leaving a ground plane) is not cut into slivers
+ * along its thin axis. Rays in the same cell are grouped by octant.
+ */
+inline uint64_t ray_sort_key(const ray &r, const aabb &origin_bounds)
+{
+    double size = std::max({origin_bounds.x.size(), origin_bounds.y.size(), origin_bounds.z.size()});
+    double scale = size > 0 ? 1024 / size : 0;
+    if (!std::isfinite(scale))
+        scale = 0; // Too small to divide, or a non-finite origin: every ray in cell 0
+
+    // 10 bits per axis
+    uint64_t code = 0;
+    for (int axis = 0; axis < 3; axis++)
+    {
+        double cell = (r.origin()[axis] - origin_bounds.axis_interval(axis).min) * scale;
+        code |= morton_spread_bits(cell > 0 ? uint64_t(std::min(cell, 1023.0)) : 0) << (2 - axis);
+    }
+    return code << 3 | r.octant();
+}
+
+/// Bit at which sort_by_ray_key() places the 33-bit ray_sort_key(); the batch index fills the bits below
+constexpr int ray_key_shift = 31;
+
+/**
+ * @brief Sort 64-bit values by their upper 33 bits, keeping the order of equal keys
+ * @param values Values to sort; bits ray_key_shift and up hold a ray_sort_key()
+ *
+ * Least-significant-digit radix sort in three 11-bit passes. Batches hold
+ * tens of thousands of rays, so this runs in linear time and avoids most of
+ * the branch mispredictions of a comparison sort on random keys.
+ */
+inline void radix_sort_ray_keys(std::vector<uint64_t> &values)
+{
+    constexpr int digit_bits = 11;
+    constexpr size_t buckets = size_t(1) << digit_bits;
+    std::vector<uint64_t> scratch(values.size());
+    for (int shift = ray_key_shift; shift < ray_key_shift + 33; shift += digit_bits)
+    {
+        std::array<size_t, buckets> start{};
+        for (uint64_t value : values)
+            start[(value >> shift) & (buckets - 1)]++;
+
+        size_t total = 0;
+        for (size_t &count : start)
+        {
+            size_t bucket_size = count;
+            count = total;
+            total += bucket_size;
+        }
+
+        for (uint64_t value : values)
+            scratch[start[(value >> shift) & (buckets - 1)]++] = value;
+        values.swap(scratch);
+    }
+}
+
+/**
+ * @brief Sort a batch of items carrying rays by ray_sort_key()
+ * @param items Items to reorder (fewer than 2^31)
+ * @param ray_of Callback returning the ray of an item
+ */
+template <typename T, typename RayOf>
+void sort_by_ray_key(std::vector<T> &items, RayOf &&ray_of)
+{
+    aabb origin_bounds;
+    for (const auto &item : items)
+        origin_bounds.expand(ray_of(item).origin());
+
+    // Key in the high bits and position in the low bits, which the stable sort carries along
+    std::vector<uint64_t> keys(items.size());
+    for (size_t k = 0; k < items.size(); k++)
+        keys[k] = ray_sort_key(ray_of(items[k]), origin_bounds) << ray_key_shift | k;
+    radix_sort_ray_keys(keys);
+
+    std::vector<T> sorted;
+    sorted.reserve(items.size());
+    for (uint64_t key : keys)
+        sorted.push_back(std::move(items[key & ((uint64_t(1) << ray_key_shift) - 1)]));
+    items.swap(sorted);
+}
+
+#endif
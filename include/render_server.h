@@ -0,0 +1,550 @@
+#ifndef RENDER_SERVER_H
+#define RENDER_SERVER_H
+
+/**
+ * @file render_server.h
+ * @brief Long-running render server with a job queue and scene cache
+ *
+ * This file implements a server mode for interactive services. Starting
+ * a process, building the scene and its BVH and starting the worker
+ * threads takes longer than a small preview render, so the server does
+ * these once: it listens on a socket, accepts render jobs (a scene
+ * description plus camera overrides), keeps the most recently used
+ * scenes with their acceleration structures in memory and renders queued
+ * jobs by priority on one shared worker pool. Jobs for a cached scene
+ * start tracing immediately.
+ *
+ * Jobs are text, a list of "key value..." settings, for example
+ *
+ *     priority 5
+ *     width 400 samples 16
+ *     lookfrom 13 2 3  lookat 0 0 0  vfov 30
+ *
+ * Scene keys: extent, scene-seed, bounce, mesh (repeatable), mesh-instances,
+ * bvh-builder (sah, lbvh, lbvh-treelet or sbvh) and compact-bvh (0 or 1).
+ * Camera keys: width, samples, depth, seed, lookfrom, lookat, vfov, focus,
+ * aperture (defocus angle) and crop (x y width height). Unset keys keep
+ * the server's defaults.
+ *
+ * Jobs can name mesh files anywhere on the server's file system, so a
+ * TCP address without a host (":7000") listens on loopback only; other
+ * machines can submit jobs only if a host such as 0.0.0.0 is given.
+ *
+ * Uses the message framing of distributed.h and is available where
+ * RT_HAVE_SOCKETS is defined.
+ */
+
+#include "distributed.h"
+
+#ifdef RT_HAVE_SOCKETS
+
+#include "bvh_accel.h"
+#include "camera.h"
+#include "hittable_list.h"
+#include "rtweekend.h"
+#include "scenes.h"
+#include "trace.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <list>
+#include <mutex>
+#include <queue>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief Message types of the render server protocol
+ */
+enum server_message : uint32_t
+{
+    message_job = 16, ///< Client -> server: job text
+    message_queued,   ///< Server -> client: uint64 job id, the job was accepted
+    message_image,    ///< Server -> client: PPM image of a finished job
+    message_failed,   ///< Server -> client: error text of a rejected or failed job
+    message_shutdown  ///< Client -> server: finish the running job and exit
+};
+
+/**
+ * @struct render_job
+ * @brief One queued render request
+ */
+struct render_job
+{
+    uint64_t id = 0;         ///< Sequence number (earlier jobs first among equal priorities)
+    int priority = 0;        ///< Higher priorities are rendered first
+    scene_description scene; ///< Scene to render
+    Camera camera;           ///< Camera with the job's overrides applied
+};
+
+/**
+ * @struct render_job_limits
+ * @brief Largest settings the render server accepts from a job
+ *
+ * Jobs come from any client of the server, so settings that would
+ * exhaust its memory or occupy it for hours are rejected up front.
+ */
+struct render_job_limits
+{
+    static constexpr int max_extent = 500;            ///< Cover grid half-size ((2 * 500)² spheres)
+    static constexpr int max_mesh_instances = 100000; ///< Instances per mesh
+    static constexpr int max_width = 8192;            ///< Image width in pixels
+    static constexpr int max_samples = 65536;         ///< Samples per pixel
+    static constexpr int max_depth = 1000;            ///< Ray bounces
+};
+
+/**
+ * @brief Parse the text of a render job
+ * @param text Job settings ("key value..." tokens separated by whitespace)
+ * @param defaults Camera settings for keys the job does not set
+ * @param job Parsed job (output)
+ * @param error Description of the first error (output)
+ * @return True on success
+ *
+ * Values outside the range the renderer supports, or beyond
+ * render_job_limits, are errors.
+ */
+inline bool parse_render_job(const std::string &text, const Camera &defaults, render_job &job, std::string &error)
+{
+    job.camera = defaults;
+    std::istringstream in(text);
+    std::string key;
+    while (in >> key)
+    {
+        Camera &cam = job.camera;
+        double x, y, z;
+        bool ok = true;
+        if (key == "priority")
+            ok = bool(in >> job.priority);
+        else if (key == "extent")
+            ok = bool(in >> job.scene.extent) && job.scene.extent >= 0 &&
+                 job.scene.extent <= render_job_limits::max_extent;
+        else if (key == "scene-seed")
+            ok = bool(in >> job.scene.seed);
+        else if (key == "bounce")
+            ok = bool(in >> job.scene.bounce) && std::isfinite(job.scene.bounce);
+        else if (key == "mesh")
+        {
+            std::string path;
+            ok = bool(in >> path);
+            job.scene.mesh_paths.push_back(path);
+        }
+        else if (key == "mesh-instances")
+            ok = bool(in >> job.scene.mesh_instances) && job.scene.mesh_instances >= 0 &&
+                 job.scene.mesh_instances <= render_job_limits::max_mesh_instances;
+        else if (key == "bvh-builder")
+        {
+            std::string name;
+            ok = bool(in >> name) && parse_bvh_build_method(name, job.scene.bvh_method);
+        }
+        else if (key == "compact-bvh")
+            ok = bool(in >> job.scene.compress_bvh);
+        else if (key == "width")
+            ok = bool(in >> cam.image_width) && cam.image_width > 0 && cam.image_width <= render_job_limits::max_width;
+        else if (key == "samples")
+            ok = bool(in >> cam.samples_per_pixel) && cam.samples_per_pixel > 0 &&
+                 cam.samples_per_pixel <= render_job_limits::max_samples;
+        else if (key == "depth")
+            ok = bool(in >> cam.max_depth) && cam.max_depth >= 1 && cam.max_depth <= render_job_limits::max_depth;
+        else if (key == "seed")
+            ok = bool(in >> cam.seed);
+        else if (key == "lookfrom")
+        {
+            ok = bool(in >> x >> y >> z);
+            cam.lookfrom = point3(x, y, z);
+        }
+        else if (key == "lookat")
+        {
+            ok = bool(in >> x >> y >> z);
+            cam.lookat = point3(x, y, z);
+        }
+        else if (key == "vfov")
+            ok = bool(in >> cam.vfov) && cam.vfov > 0 && cam.vfov < 180;
+        else if (key == "focus")
+            ok = bool(in >> cam.focus_dist);
+        else if (key == "aperture")
+            ok = bool(in >> cam.defocus_angle);
+        else if (key == "crop")
+            ok = bool(in >> cam.crop_x >> cam.crop_y >> cam.crop_width >> cam.crop_height) && cam.crop_width > 0 &&
+                 cam.crop_height > 0;
+        else
+        {
+            error = "unknown job key: " + key;
+            return false;
+        }
+
+        if (!ok)
+        {
+            error = "missing or invalid value for " + key;
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @class scene_cache
+ * @brief Most recently used scenes with their acceleration structures
+ */
+class scene_cache
+{
+public:
+    size_t capacity = 4; ///< Scenes kept resident
+
+    /**
+     * @brief Get the scene of a description, building it on a miss
+     * @param scene Scene description
+     * @param error Description of the failure (output)
+     * @param warm Set to true if the scene was already resident (output)
+     * @return The scene's top-level BVH, or nullptr if it could not be built
+     */
+    shared_ptr<const bvh_accel> get(const scene_description &scene, std::string &error, bool &warm)
+    {
+        std::string key;
+        if (!resident_key(scene, key, error))
+            return nullptr;
+        for (auto entry = entries.begin(); entry != entries.end(); ++entry)
+        {
+            if (entry->key == key)
+            {
+                entries.splice(entries.begin(), entries, entry); // Mark as most recently used
+                warm = true;
+                return entries.front().accel;
+            }
+        }
+
+        warm = false;
+        trace_scope scope("build scene", "scene");
+        hittable_list world;
+        if (!scene.build(world, error))
+            return nullptr;
+
+        auto accel = make_shared<bvh_accel>(world, scene.bvh_method);
+        if (scene.compress_bvh)
+            accel->compress();
+        entries.push_front({key, accel});
+        while (entries.size() > std::max<size_t>(capacity, 1))
+            entries.pop_back();
+        return entries.front().accel;
+    }
+
+private:
+    /**
+     * @brief Key of a resident scene
+     *
+     * Hashes the contents of the mesh files like result_cache does, so a
+     * mesh edited on disk is rebuilt. Unlike the result cache key it
+     * includes the BVH settings: they leave the image unchanged but
+     * select the acceleration structure that is built and kept resident.
+     *
+     * @return False if a mesh file could not be read
+     */
+    static bool resident_key(const scene_description &scene, std::string &key, std::string &error)
+    {
+        content_hash hash;
+        if (!scene.add_contents(hash, error))
+            return false;
+        hash.add(uint64_t(scene.bvh_method));
+        hash.add(uint64_t(scene.compress_bvh));
+        key = hash.hex();
+        return true;
+    }
+
+    /**
+     * @brief Resident scene
+     */
+    struct entry
+    {
+        std::string key;                   ///< resident_key() of the scene
+        shared_ptr<const bvh_accel> accel; ///< The scene's objects and top-level BVH
+    };
+
+    std::list<entry> entries; ///< Resident scenes, most recently used first
+};
+
+/**
+ * @class render_server
+ * @brief Accepts render jobs on a socket and renders them by priority
+ *
+ * One thread handles the connections while another renders the queued
+ * jobs one after the other on a shared worker pool, so new jobs are
+ * accepted (and can overtake queued ones) during a render.
+ */
+class render_server
+{
+public:
+    size_t scene_cache_size = 4; ///< Scenes kept resident between jobs
+    std::string error;           ///< Description of the failure, if run() returned false
+
+    /**
+     * @brief Serve jobs until a client requests shutdown
+     * @param address Address to listen on ("host:port" or "unix:/path")
+     * @param defaults Camera settings for keys a job does not set
+     * @return False if the server could not start
+     */
+    bool run(const std::string &address, const Camera &defaults)
+    {
+        int listen_fd = socket_address::listen_on(address, error);
+        if (listen_fd < 0)
+            return false;
+        socket_connection listener(listen_fd);
+
+        base = defaults;
+        base.show_progress = false;
+        base.resume = false;
+        base.checkpoint_path.clear();
+        base.heatmap_prefix.clear();
+        base.stats_path.clear();
+        base.scheduler_report = false;
+        if (!base.pool)
+            base.pool = make_shared<thread_pool>(base.thread_count);
+        scenes.capacity = scene_cache_size;
+
+        std::clog << "Render server listening on " << address << '\n';
+        std::thread renderer([this] { render_loop(); });
+
+        std::vector<shared_ptr<client>> clients;
+        uint64_t next_id = 1;
+        bool shutdown = false;
+        while (!shutdown)
+        {
+            std::vector<pollfd> fds(1 + clients.size());
+            fds[0] = {listener.fd(), POLLIN, 0};
+            for (size_t c = 0; c < clients.size(); c++)
+                fds[c + 1] = {clients[c]->connection.fd(), POLLIN, 0};
+            ::poll(fds.data(), fds.size(), -1);
+
+            if (fds[0].revents & POLLIN)
+            {
+                int fd = ::accept(listener.fd(), nullptr, nullptr);
+                if (fd >= 0)
+                {
+                    socket_address::configure(fd);
+                    clients.push_back(make_shared<client>(fd));
+                }
+            }
+
+            for (size_t c = 0; c + 1 < fds.size(); c++)
+            {
+                client &peer = *clients[c];
+                if (fds[c + 1].revents == 0)
+                    continue;
+                if (!peer.connection.read_available())
+                {
+                    peer.alive = false;
+                    continue;
+                }
+
+                uint32_t type;
+                message_buffer payload;
+                while (peer.alive && peer.connection.pop_message(type, payload))
+                {
+                    if (type == message_shutdown)
+                    {
+                        shutdown = true;
+                        continue;
+                    }
+                    if (type != message_job)
+                    {
+                        peer.alive = false;
+                        continue;
+                    }
+
+                    queued_job queued{make_shared<render_job>(), clients[c]};
+                    std::string job_error;
+                    if (!parse_render_job(std::string(payload.data.begin(), payload.data.end()), base, *queued.job,
+                                          job_error))
+                    {
+                        peer.send(message_failed, text_message(job_error));
+                        continue;
+                    }
+                    queued.job->id = next_id++;
+
+                    message_buffer accepted;
+                    accepted.put(queued.job->id);
+                    peer.send(message_queued, accepted);
+                    {
+                        std::lock_guard<std::mutex> lock(queue_mutex);
+                        jobs.push(queued);
+                    }
+                    queue_changed.notify_one();
+                }
+            }
+
+            // Connections of disconnected clients close once their queued jobs are dropped
+            clients.erase(std::remove_if(clients.begin(), clients.end(),
+                                         [](const shared_ptr<client> &peer) { return !peer->alive; }),
+                          clients.end());
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(queue_mutex);
+            stopping = true;
+        }
+        queue_changed.notify_one();
+        renderer.join();
+
+        while (!jobs.empty())
+        {
+            jobs.top().owner->send(message_failed, text_message("server shutting down"));
+            jobs.pop();
+        }
+        return true;
+    }
+
+private:
+    /**
+     * @brief Connection to a client
+     */
+    struct client
+    {
+        explicit client(int fd) : connection(fd) {}
+
+        socket_connection connection;  ///< Connection to the client
+        std::atomic<bool> alive{true}; ///< False once the connection failed
+        std::mutex send_mutex;         ///< Serializes replies of the two server threads
+
+        void send(uint32_t type, const message_buffer &payload)
+        {
+            std::lock_guard<std::mutex> lock(send_mutex);
+            if (!connection.send_message(type, payload))
+                alive = false;
+        }
+    };
+
+    /**
+     * @brief Job waiting in the queue with the client to reply to
+     */
+    struct queued_job
+    {
+        shared_ptr<render_job> job; ///< The job
+        shared_ptr<client> owner;   ///< Client that submitted it
+
+        /**
+         * @brief Queue order: lower priority, then later submission, comes last
+         */
+        bool operator<(const queued_job &other) const
+        {
+            if (job->priority != other.job->priority)
+                return job->priority < other.job->priority;
+            return job->id > other.job->id;
+        }
+    };
+
+    Camera base;                           ///< Default job settings and the shared worker pool
+    scene_cache scenes;                    ///< Resident scenes (used by the render thread only)
+    std::priority_queue<queued_job> jobs;  ///< Jobs waiting to be rendered
+    std::mutex queue_mutex;                ///< Guards jobs and stopping
+    std::condition_variable queue_changed; ///< Signals a new job or shutdown
+    bool stopping = false;                 ///< Set when the server shuts down
+
+    static message_buffer text_message(const std::string &text)
+    {
+        message_buffer message;
+        message.data.assign(text.begin(), text.end());
+        return message;
+    }
+
+    /**
+     * @brief Render queued jobs until the server stops
+     */
+    void render_loop()
+    {
+        trace_recorder::instance().set_thread_name("render server");
+        while (true)
+        {
+            queued_job queued;
+            {
+                std::unique_lock<std::mutex> lock(queue_mutex);
+                queue_changed.wait(lock, [this] { return stopping || !jobs.empty(); });
+                if (stopping)
+                    return;
+                queued = jobs.top();
+                jobs.pop();
+            }
+            if (!queued.owner->alive)
+                continue; // Nobody is waiting for the result
+
+            render_job &job = *queued.job;
+            auto start = std::chrono::steady_clock::now();
+            std::string scene_error;
+            bool warm = false;
+            auto accel = scenes.get(job.scene, scene_error, warm);
+            if (!accel)
+            {
+                queued.owner->send(message_failed, text_message(scene_error));
+                continue;
+            }
+
+            job.camera.pool = base.pool;
+            std::ostringstream image;
+            job.camera.render(*accel, image);
+            queued.owner->send(message_image, text_message(image.str()));
+
+            double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            std::clog << "Job " << job.id << " (priority " << job.priority << ", " << (warm ? "warm" : "cold")
+                      << " scene): " << ms << " ms\n";
+        }
+    }
+};
+
+/**
+ * @brief Submit a job to a render server and wait for its image
+ * @param address Address of the server
+ * @param job_text Job settings
+ * @param out Output stream for the PPM image
+ * @param error Description of the failure (output)
+ * @return True if the image was written
+ */
+inline bool submit_render_job(const std::string &address, const std::string &job_text, std::ostream &out,
+                              std::string &error)
+{
+    socket_connection connection(socket_address::connect_to(address, error));
+    if (connection.fd() < 0)
+        return false;
+
+    message_buffer job;
+    job.data.assign(job_text.begin(), job_text.end());
+    if (!connection.send_message(message_job, job))
+    {
+        error = "lost connection to the server";
+        return false;
+    }
+
+    uint32_t type;
+    message_buffer reply;
+    while (connection.receive_message(type, reply))
+    {
+        if (type == message_queued)
+            continue;
+        std::string text(reply.data.begin(), reply.data.end());
+        if (type == message_image)
+        {
+            out << text;
+            return true;
+        }
+        error = type == message_failed ? text : "unexpected reply from the server";
+        return false;
+    }
+    error = "lost connection to the server";
+    return false;
+}
+
+/**
+ * @brief Ask a render server to shut down
+ * @param address Address of the server
+ * @param error Description of the failure (output)
+ * @return True if the request was sent
+ */
+inline bool shutdown_render_server(const std::string &address, std::string &error)
+{
+    socket_connection connection(socket_address::connect_to(address, error));
+    return connection.fd() >= 0 && connection.send_message(message_shutdown);
+}
+
+#endif
+
+#endif
@@ -0,0 +1,205 @@
+#ifndef RENDER_STATS_H
+#define RENDER_STATS_H
+
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <vector>
+
+/**
+ * @file render_stats.h
+ * @brief Per-thread ray statistics counters
+ *
+ * This file implements low-overhead counters that record what the renderer
+ * does per frame: rays traced, intersection tests, scatter events per
+ * material and how paths end. Counters are only compiled in when the
+ * RT_ENABLE_STATS macro is defined (CMake option RAYTRACER_STATS);
+ * otherwise RT_STAT_INC expands to nothing.
+ */
+
+#ifdef RT_ENABLE_STATS
+#define RT_STAT_INC(counter) (++ray_stats::local()[ray_stats::counter])
+#else
+#define RT_STAT_INC(counter) ((void)0)
+#endif
+
+/**
+ * @class ray_stats
+ * @brief Registry of per-thread ray counters
+ *
+ * Each thread increments its own counter block without synchronization.
+ * Blocks register themselves on first use and fold their values into a
+ * shared total when their thread exits, so aggregate() sees every ray.
+ * aggregate() and reset() must only be called while no thread renders.
+ */
+class ray_stats
+{
+public:
+    /**
+     * @brief Identifiers of the individual counters
+     */
+    enum counter
+    {
+        primary_rays,       ///< Camera rays
+        secondary_rays,     ///< Rays produced by material scattering
+        sphere_tests,       ///< Ray-sphere intersection tests
+        sphere_hits,        ///< Ray-sphere tests that found an intersection
+        triangle_tests,     ///< Ray-triangle intersection tests
+        triangle_hits,      ///< Ray-triangle tests that found an intersection
+        bvh_nodes,          ///< BVH node bounds tested during traversal
+        scatter_lambertian, ///< Scatter calls on lambertian surfaces
+        scatter_metal,      ///< Scatter calls on metal surfaces
+        scatter_dielectric, ///< Scatter calls on dielectric surfaces
+        paths_depth_limit,  ///< Paths ended by reaching max_depth
+        paths_escaped,      ///< Paths ended by leaving the scene
+        paths_absorbed,     ///< Paths ended by a surface absorbing the ray
+        counter_count
+    };
+
+    /**
+     * @brief Block of counter values
+     */
+    struct counters
+    {
+        unsigned long long value[counter_count] = {};
+
+        unsigned long long &operator[](counter c) { return value[c]; }
+        unsigned long long operator[](counter c) const { return value[c]; }
+
+        void add(const counters &other)
+        {
+            for (int c = 0; c < counter_count; c++)
+                value[c] += other.value[c];
+        }
+    };
+
+    /**
+     * @brief Access the counter block of the calling thread
+     * @return Reference to the thread's counters
+     */
+    static counters &local()
+    {
+        thread_local registration block;
+        return block.values;
+    }
+
+    /**
+     * @brief Reset the counters of all threads to zero
+     */
+    static void reset()
+    {
+        std::lock_guard<std::mutex> lock(registry_mutex());
+        retired() = counters();
+        for (auto *block : registry())
+            *block = counters();
+    }
+
+    /**
+     * @brief Sum the counters of all threads
+     * @return Totals since the last reset()
+     */
+    static counters aggregate()
+    {
+        std::lock_guard<std::mutex> lock(registry_mutex());
+        counters total = retired();
+        for (auto *block : registry())
+            total.add(*block);
+        return total;
+    }
+
+    /**
+     * @brief Print counters as a human readable table
+     * @param out Output stream
+     * @param totals Counter values to print
+     */
+    static void print_table(std::ostream &out, const counters &totals)
+    {
+        out << "Ray statistics\n";
+        for (int c = 0; c < counter_count; c++)
+            out << "  " << std::left << std::setw(22) << name(counter(c)) << std::right << std::setw(16)
+                << totals.value[c] << '\n';
+        out << "  " << std::left << std::setw(22) << "average_path_length" << std::right << std::setw(16)
+            << average_path_length(totals) << '\n';
+    }
+
+    /**
+     * @brief Write counters as a JSON object
+     * @param out Output stream
+     * @param totals Counter values to write
+     */
+    static void write_json(std::ostream &out, const counters &totals)
+    {
+        out << "{";
+        for (int c = 0; c < counter_count; c++)
+            out << "\"" << name(counter(c)) << "\": " << totals.value[c] << ", ";
+        out << "\"average_path_length\": " << average_path_length(totals) << "}\n";
+    }
+
+    /**
+     * @brief Average number of ray segments per camera path
+     * @param totals Counter values
+     * @return (primary + secondary rays) / primary rays
+     */
+    static double average_path_length(const counters &totals)
+    {
+        if (totals[primary_rays] == 0)
+            return 0;
+        return double(totals[primary_rays] + totals[secondary_rays]) / totals[primary_rays];
+    }
+
+    /**
+     * @brief Name of a counter as used in reports
+     */
+    static const char *name(counter c)
+    {
+        static const char *names[counter_count] = {
+            "primary_rays", "secondary_rays", "sphere_tests", "sphere_hits", "triangle_tests",
+            "triangle_hits", "bvh_nodes", "scatter_lambertian", "scatter_metal", "scatter_dielectric",
+            "paths_depth_limit", "paths_escaped", "paths_absorbed"};
+        return names[c];
+    }
+
+private:
+    /**
+     * @brief Thread-local counter block that registers itself for aggregation
+     */
+    struct registration
+    {
+        counters values;
+
+        registration()
+        {
+            std::lock_guard<std::mutex> lock(registry_mutex());
+            registry().push_back(&values);
+        }
+
+        ~registration()
+        {
+            std::lock_guard<std::mutex> lock(registry_mutex());
+            retired().add(values);
+            auto &blocks = registry();
+            blocks.erase(std::find(blocks.begin(), blocks.end(), &values));
+        }
+    };
+
+    static std::mutex &registry_mutex()
+    {
+        static std::mutex mutex;
+        return mutex;
+    }
+
+    static std::vector<counters *> &registry()
+    {
+        static std::vector<counters *> blocks;
+        return blocks;
+    }
+
+    static counters &retired()
+    {
+        static counters totals;
+        return totals;
+    }
+};
+
+#endif
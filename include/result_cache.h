@@ -0,0 +1,232 @@
+#ifndef RESULT_CACHE_H
+#define RESULT_CACHE_H
+
+#include "camera.h"
+#include "checkpoint.h"
+#include "content_hash.h"
+#include "rtweekend.h"
+#include "scenes.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define RT_HAVE_FILE_LOCKS 1
+#include <fcntl.h>
+#include <sys/file.h>
+#include <unistd.h>
+#endif
+
+/**
+ * @file result_cache.h
+ * @brief Content-addressed cache of finished and partial renders
+ *
+ * This file implements an on-disk cache for renders that are submitted
+ * again with the same settings. A render is identified by a hash of
+ * everything that determines its pixels: the scene description (including
+ * the contents of mesh files), the camera and the sampler settings with
+ * the seed. The sample count is left out of the key, because a render
+ * with more samples continues one with fewer: every sample is seeded from
+ * its pixel and index, so sample n of a pixel is the same whichever run
+ * takes it.
+ *
+ * Per key the cache holds the accumulation buffer of the most-sampled
+ * render as a checkpoint, and the finished image of every sample count
+ * that was requested. An identical request is answered from the image;
+ * a request for more samples resumes the checkpoint and traces only the
+ * missing samples.
+ *
+ * Only one process at a time continues the checkpoint of a key; it holds
+ * an advisory lock on <key>.lock (where RT_HAVE_FILE_LOCKS is defined),
+ * which the operating system drops when the process exits.
+ */
+
+/**
+ * @class result_cache
+ * @brief Directory of cached renders keyed by their content hash
+ */
+class result_cache
+{
+public:
+    std::string directory; ///< Cache directory (created on first store)
+    std::string error;     ///< Description of the last failure
+
+    /**
+     * @brief Constructor
+     * @param directory Cache directory
+     */
+    explicit result_cache(std::string directory) : directory(std::move(directory)) {}
+
+    result_cache(const result_cache &) = delete;
+    result_cache &operator=(const result_cache &) = delete;
+
+    /**
+     * @brief Destructor, releases the lock taken by prepare()
+     */
+    ~result_cache()
+    {
+#ifdef RT_HAVE_FILE_LOCKS
+        if (lock_fd >= 0)
+            ::close(lock_fd);
+#endif
+    }
+
+    /**
+     * @brief Compute the key of a render
+     * @param scene Scene description; the contents of its mesh files and field manifest are hashed too
+     * @param cam Camera with all render settings except the sample count
+     * @param key Cache key (output)
+     * @return False if a mesh file could not be read
+     */
+    bool make_key(const scene_description &scene, const Camera &cam, std::string &key)
+    {
+        content_hash hash;
+        hash.add(uint64_t(format_version));
+
+        if (!scene.add_contents(hash, error))
+            return false;
+
+        cam.add_settings(hash);
+
+        key = hash.hex();
+        return true;
+    }
+
+    /**
+     * @brief Write a cached finished image
+     * @param key Cache key
+     * @param samples_per_pixel Requested sample count
+     * @param out Output stream for the PPM image
+     * @return True if the image was cached and written
+     */
+    bool find_image(const std::string &key, int samples_per_pixel, std::ostream &out) const
+    {
+        std::ifstream in(image_path(key, samples_per_pixel), std::ios::binary);
+        if (!in)
+            return false;
+        out << in.rdbuf();
+        return bool(out);
+    }
+
+    /**
+     * @brief Let a camera continue the cached partial render of a key
+     * @param cam Camera to configure (checkpoint path and resume flag)
+     * @param key Cache key
+     * @return Samples per pixel already available in the cache (0 if none),
+     *         or -1 if another process is rendering the same key
+     *
+     * The camera checkpoints into the cache, so the accumulation buffer is
+     * kept for later requests and an interrupted render resumes as well.
+     * A cached render with more samples than requested cannot be reduced;
+     * it is kept and the camera renders without checkpointing instead.
+     * While another process holds the key, the camera renders without
+     * checkpointing too, so the two never write the same checkpoint.
+     */
+    int prepare(Camera &cam, const std::string &key)
+    {
+        cam.checkpoint_path.clear();
+        cam.resume = false;
+        if (!lock(key))
+            return -1;
+        cam.checkpoint_path = checkpoint_path(key);
+
+        render_checkpoint saved;
+        if (!saved.load(cam.checkpoint_path))
+            return 0;
+        int cached = saved.sample_counts.empty()
+                         ? 0
+                         : *std::max_element(saved.sample_counts.begin(), saved.sample_counts.end());
+        if (cached > cam.samples_per_pixel)
+            cam.checkpoint_path.clear();
+        else
+            cam.resume = true;
+        return cached;
+    }
+
+    /**
+     * @brief Store a finished image
+     * @param key Cache key
+     * @param samples_per_pixel Sample count of the image
+     * @param image PPM image
+     * @return False if the image could not be written
+     */
+    bool store_image(const std::string &key, int samples_per_pixel, const std::string &image)
+    {
+        std::string path = image_path(key, samples_per_pixel), temp_path = temporary_path(path);
+        {
+            std::ofstream out(temp_path, std::ios::binary | std::ios::trunc);
+            out << image;
+            if (!out)
+            {
+                out.close();
+                std::remove(temp_path.c_str());
+                error = "cannot write " + temp_path;
+                return false;
+            }
+        }
+        if (std::rename(temp_path.c_str(), path.c_str()) != 0)
+        {
+            std::remove(temp_path.c_str());
+            error = "cannot write " + path;
+            return false;
+        }
+        return true;
+    }
+
+    /**
+     * @brief Create the cache directory if needed
+     * @return False if it could not be created
+     */
+    bool create_directory()
+    {
+        std::error_code code;
+        std::filesystem::create_directories(directory, code);
+        if (code)
+            error = "cannot create " + directory + ": " + code.message();
+        return !code;
+    }
+
+private:
+    static constexpr uint32_t format_version = 2; ///< Bump when a renderer change alters pixel values
+
+#ifdef RT_HAVE_FILE_LOCKS
+    int lock_fd = -1; ///< Open lock file of the prepared key (-1 if none)
+#endif
+
+    /**
+     * @brief Take the exclusive lock of a key without waiting
+     * @return False if another process holds it
+     */
+    bool lock(const std::string &key)
+    {
+#ifdef RT_HAVE_FILE_LOCKS
+        if (lock_fd >= 0)
+            ::close(lock_fd);
+        lock_fd = ::open((directory + "/" + key + ".lock").c_str(), O_RDWR | O_CREAT, 0644);
+        if (lock_fd < 0)
+            return false;
+        if (::flock(lock_fd, LOCK_EX | LOCK_NB) != 0)
+        {
+            ::close(lock_fd);
+            lock_fd = -1;
+            return false;
+        }
+#else
+        (void)key;
+#endif
+        return true;
+    }
+
+    std::string checkpoint_path(const std::string &key) const { return directory + "/" + key + ".ckpt"; }
+
+    std::string image_path(const std::string &key, int samples_per_pixel) const
+    {
+        return directory + "/" + key + "." + std::to_string(samples_per_pixel) + "spp.ppm";
+    }
+};
+
+#endif
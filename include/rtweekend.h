@@ -2,7 +2,7 @@
 #define RTWEEKEND_H
 
 #include <cmath>
-#include <random>
+#include <cstdint>
 #include <iostream>
 #include <limits>
 #include <memory>
@@ -58,18 +58,95 @@ inline double degrees_to_radians(double degrees)
     return degrees * pi / 180.0;
 }
 
+/**
+ * @brief Scramble the bits of a 64-bit value (SplitMix64 finalizer)
+ * @param x Value to scramble
+ * @return Well-mixed 64-bit value
+ *
+ * Used to derive independent random streams from small integers such
+ * as pixel and sample indices.
+ */
+inline uint64_t mix_bits(uint64_t x)
+{
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+/**
+ * @class random_generator
+ * @brief Small, fast pseudo-random number generator (SplitMix64)
+ *
+ * The whole generator state is a single 64-bit integer, which makes it
+ * cheap to reseed per sample and trivial to save in render checkpoints.
+ */
+class random_generator
+{
+public:
+    uint64_t state; ///< Current generator state
+
+    /**
+     * @brief Constructor with explicit seed
+     * @param seed Initial state of the generator
+     */
+    explicit random_generator(uint64_t seed = 0) : state(seed) {}
+
+    /**
+     * @brief Generate the next 64 random bits
+     * @return Random 64-bit value
+     */
+    uint64_t next_u64()
+    {
+        return mix_bits(state += 0x9e3779b97f4a7c15ULL);
+    }
+
+    /**
+     * @brief Generate random double in range [0, 1)
+     * @return Random double value with 53 bits of precision
+     */
+    double next_double()
+    {
+        return (next_u64() >> 11) * 0x1.0p-53;
+    }
+};
+
+/**
+ * @brief Access the random generator of the calling thread
+ * @return Reference to the thread-local generator
+ *
+ * Every thread owns its own generator, so sampling code never shares
+ * state between threads. The renderer reseeds it before every sample.
+ */
+inline random_generator &thread_random_generator()
+{
+    thread_local random_generator generator;
+    return generator;
+}
+
+/**
+ * @brief Derive the random seed for one pixel sample
+ * @param seed Base seed of the render
+ * @param pixel_index Linear pixel index (row * width + column)
+ * @param sample Sample index within the pixel
+ * @return Seed for the random stream of that sample
+ *
+ * Each sample gets its own stream, so the value of a pixel does not
+ * depend on the order in which pixels or samples are rendered.
+ */
+inline uint64_t sample_seed(uint64_t seed, uint64_t pixel_index, uint64_t sample)
+{
+    return mix_bits(seed ^ mix_bits((pixel_index << 20) + sample));
+}
+
 /**
  * @brief Generate random double in range [0, 1)
  * @return Random double value
- * 
- * Uses a static Mersenne Twister generator with uniform distribution
- * for consistent random number generation across the application.
+ *
+ * Draws from the calling thread's generator, see thread_random_generator().
  */
 inline double random_double()
 {
-    static std::uniform_real_distribution<double> distribution(0.0, 1.0);
-    static std::mt19937 generator;
-    return distribution(generator);
+    return thread_random_generator().next_double();
 }
 
 /**
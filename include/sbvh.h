@@ -0,0 +1,466 @@
+#ifndef SBVH_H
+#define SBVH_H
+
+#include "aabb.h"
+#include "bvh.h"
+#include "rtweekend.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+/**
+ * @file sbvh.h
+ * @brief BVH construction with spatial splits (SBVH)
+ *
+ * This file implements the split BVH of Stich, Friedrich and Dietrich
+ * (2009) for scenes with large primitives that overlap many others, such
+ * as a giant ground sphere or long thin triangles.
+ * An object split cannot separate such a primitive from its neighbours,
+ * so its box ends up high in the tree and nearly every ray tests it.
+ *
+ * Where the children of the best object split overlap, the builder also
+ * tries spatial splits: the node is cut by a plane and primitives that
+ * straddle it are referenced from both sides, each reference clipped to
+ * its side. Leaves may therefore share primitives, and the leaf order
+ * returned by the build can list a primitive more than once. Spatial
+ * splits stop when the number of references reaches a growth cap.
+ */
+
+/**
+ * @class sbvh_builder
+ * @brief Binned SAH builder with object and spatial splits
+ */
+class sbvh_builder
+{
+public:
+    /**
+     * @brief Clips a primitive at an axis-aligned plane
+     *
+     * Called as clip(primitive, axis, position, left, right); left and
+     * right receive the bounds of the parts of the primitive below and
+     * above the plane (empty if there is none).
+     */
+    using clip_function = std::function<void(uint32_t, int, double, aabb &, aabb &)>;
+
+    double overlap_threshold = 1e-5; ///< Try spatial splits where object-split children overlap by this fraction of the root area
+    double max_growth = 1.0;         ///< References may grow to (1 + max_growth) times the number of primitives
+    clip_function clip;              ///< Exact primitive clipping; if unset, primitive bounds are clipped
+
+    /**
+     * @brief Build the hierarchy
+     * @param tree Tree to fill (its max_leaf_size is honoured)
+     * @param bounds Bounding box of every primitive
+     * @return Primitive indices in leaf order; split primitives appear once per leaf that references them
+     */
+    std::vector<uint32_t> build(bvh_tree &tree, const std::vector<aabb> &bounds)
+    {
+        trace_scope scope("SBVH build", "accel");
+
+        built.clear();
+        order.clear();
+        if (bounds.empty())
+        {
+            built.push_back({aabb::empty, 0, 0, 0});
+            tree.assign(std::move(built));
+            return {};
+        }
+
+        std::vector<reference> refs(bounds.size());
+        aabb root;
+        for (size_t i = 0; i < bounds.size(); i++)
+        {
+            refs[i] = {bounds[i], uint32_t(i)};
+            root = aabb(root, bounds[i]);
+        }
+
+        max_leaf_size = std::max(1, tree.max_leaf_size);
+        source_bounds = &bounds;
+        root_area = root.surface_area();
+        reference_budget = size_t(double(bounds.size()) * (1 + std::max(0.0, max_growth)));
+        reference_count = bounds.size();
+
+        built.reserve(2 * bounds.size());
+        order.reserve(bounds.size());
+        build_recursive(std::move(refs), 0);
+
+        tree.assign(std::move(built));
+        return std::move(order);
+    }
+
+private:
+    static constexpr int object_bins = 16;           ///< Centroid bins per axis for object splits
+    static constexpr int spatial_bins = 16;          ///< Bins per axis for spatial splits
+    static constexpr int max_spatial_depth = 48;     ///< No spatial splits below this depth (keeps the tree shallow)
+    static constexpr double traversal_cost = 1.0;    ///< Relative cost of a box test (as in bvh_tree)
+    static constexpr double intersection_cost = 1.0; ///< Relative cost of a primitive test (as in bvh_tree)
+
+    /**
+     * @brief Primitive reference, possibly clipped to part of the primitive
+     */
+    struct reference
+    {
+        aabb bbox;      ///< Bounds of the referenced part
+        uint32_t index; ///< Primitive index
+    };
+
+    /**
+     * @brief Best split found for a node
+     */
+    struct split
+    {
+        double cost = infinity; ///< Sum of area times count over both sides
+        int axis = -1;          ///< Split axis (-1 if none was found)
+        int bin = 0;            ///< First bin on the right side
+        aabb left, right;       ///< Bounds of both sides
+    };
+
+    std::vector<bvh_node> built;                      ///< Nodes in depth-first order
+    std::vector<uint32_t> order;                      ///< Primitive indices in leaf order
+    const std::vector<aabb> *source_bounds = nullptr; ///< Unclipped primitive bounds
+    int max_leaf_size = 4;                            ///< Largest leaf
+    double root_area = 0;                             ///< Surface area of the root
+    size_t reference_budget = 0;                      ///< Largest total number of references
+    size_t reference_count = 0;                       ///< Current total number of references
+
+    /**
+     * @brief Build the subtree over a set of references
+     * @return Index of the subtree's root node
+     */
+    uint32_t build_recursive(std::vector<reference> refs, int depth)
+    {
+        uint32_t node_index = uint32_t(built.size());
+        built.push_back({});
+
+        aabb bbox, centroid_bounds;
+        for (const auto &ref : refs)
+        {
+            bbox = aabb(bbox, ref.bbox);
+            centroid_bounds.expand(ref.bbox.centroid());
+        }
+
+        size_t count = refs.size();
+        if (count <= size_t(max_leaf_size) || (depth >= bvh_tree::max_build_depth - 16 && count <= 0xffff))
+            return make_leaf(node_index, bbox, refs);
+
+        // Below the depth limit of bvh_tree::build(), halve what is too large for one leaf
+        if (depth >= bvh_tree::max_build_depth - 16)
+        {
+            auto middle = refs.begin() + std::ptrdiff_t(count / 2);
+            std::vector<reference> left(refs.begin(), middle), right(middle, refs.end());
+            refs.clear();
+            refs.shrink_to_fit();
+            build_recursive(std::move(left), depth + 1);
+            uint32_t right_index = build_recursive(std::move(right), depth + 1);
+            built[node_index] = {bbox, right_index, 0, 0};
+            return node_index;
+        }
+
+        split object = find_object_split(refs, centroid_bounds);
+        // Small nodes are left to object splits: their references span most
+        // bins, so chopping them costs much and duplicates them for little gain
+        split spatial;
+        if (object.axis >= 0 && count > size_t(max_leaf_size) * 4 && depth < max_spatial_depth &&
+            reference_count < reference_budget && overlap_area(object.left, object.right) > overlap_threshold * root_area)
+            spatial = find_spatial_split(refs, bbox);
+
+        // The SAH may prefer a leaf for a few primitives
+        double area = bbox.surface_area();
+        double best_cost = std::min(object.cost, spatial.cost);
+        if (count <= size_t(max_leaf_size) * 4 && count <= 0xffff &&
+            (best_cost == infinity ||
+             (area > 0 && traversal_cost + intersection_cost * best_cost / area >= intersection_cost * count)))
+            return make_leaf(node_index, bbox, refs);
+
+        std::vector<reference> left, right;
+        int axis = 0;
+        if (spatial.cost < object.cost)
+        {
+            axis = spatial.axis;
+            split_spatially(refs, bbox, spatial, left, right);
+        }
+        if (left.empty() || right.empty())
+        {
+            left.clear();
+            right.clear();
+            if (object.axis >= 0)
+            {
+                axis = object.axis;
+                const interval &extent = centroid_bounds.axis_interval(axis);
+                double scale = object_bins / extent.size();
+                for (auto &ref : refs)
+                    (object_bin(ref.bbox.centroid()[axis], extent.min, scale) < object.bin ? left : right)
+                        .push_back(ref);
+            }
+            else if (count <= 0xffff)
+                return make_leaf(node_index, bbox, refs);
+            else
+            {
+                // Too many coincident references for one leaf: split them in half
+                auto middle = refs.begin() + std::ptrdiff_t(count / 2);
+                left.assign(refs.begin(), middle);
+                right.assign(middle, refs.end());
+            }
+        }
+        refs.clear();
+        refs.shrink_to_fit();
+
+        build_recursive(std::move(left), depth + 1);
+        uint32_t right_index = build_recursive(std::move(right), depth + 1);
+        built[node_index] = {bbox, right_index, 0, uint16_t(axis)};
+        return node_index;
+    }
+
+    /**
+     * @brief Fill a leaf node and append its primitives to the leaf order
+     */
+    uint32_t make_leaf(uint32_t node_index, const aabb &bbox, const std::vector<reference> &refs)
+    {
+        built[node_index] = {bbox, uint32_t(order.size()), uint16_t(refs.size()), 0};
+        for (const auto &ref : refs)
+            order.push_back(ref.index);
+        return node_index;
+    }
+
+    /**
+     * @brief Centroid bin of an object split, clamped to [0, object_bins - 1]
+     */
+    static int object_bin(double centroid, double min, double scale)
+    {
+        double position = (centroid - min) * scale;
+        return position > 0 ? int(std::min(position, double(object_bins - 1))) : 0;
+    }
+
+    /**
+     * @brief Surface area of the intersection of two boxes (0 if disjoint)
+     */
+    static double overlap_area(const aabb &a, const aabb &b)
+    {
+        interval x(std::max(a.x.min, b.x.min), std::min(a.x.max, b.x.max));
+        interval y(std::max(a.y.min, b.y.min), std::min(a.y.max, b.y.max));
+        interval z(std::max(a.z.min, b.z.min), std::min(a.z.max, b.z.max));
+        if (x.size() < 0 || y.size() < 0 || z.size() < 0)
+            return 0;
+        return aabb(x, y, z).surface_area();
+    }
+
+    /**
+     * @brief Best binned SAH partition of the references by centroid
+     */
+    split find_object_split(const std::vector<reference> &refs, const aabb &centroid_bounds) const
+    {
+        split best;
+        for (int a = 0; a < 3; a++)
+        {
+            const interval &extent = centroid_bounds.axis_interval(a);
+            if (extent.size() <= 0)
+                continue;
+
+            // A denormal extent overflows the scale; such an axis cannot be binned
+            double scale = object_bins / extent.size();
+            if (!std::isfinite(scale))
+                continue;
+
+            aabb bin_bounds[object_bins];
+            size_t bin_counts[object_bins] = {};
+            for (const auto &ref : refs)
+            {
+                int b = object_bin(ref.bbox.centroid()[a], extent.min, scale);
+                bin_counts[b]++;
+                bin_bounds[b] = aabb(bin_bounds[b], ref.bbox);
+            }
+            sweep(bin_bounds, bin_counts, bin_counts, object_bins, a, best);
+        }
+        return best;
+    }
+
+    /**
+     * @brief Best binned SAH plane, counting straddling references on both sides
+     *
+     * Every reference is chopped at the bin planes it crosses; each piece
+     * extends the bounds of its bin. Counts come from the bins where
+     * references enter and exit.
+     */
+    split find_spatial_split(const std::vector<reference> &refs, const aabb &bbox) const
+    {
+        split best;
+        for (int a = 0; a < 3; a++)
+        {
+            const interval &extent = bbox.axis_interval(a);
+            if (extent.size() <= 0)
+                continue;
+
+            double width = extent.size() / spatial_bins;
+            if (!(width > 0))
+                continue;
+
+            aabb bin_bounds[spatial_bins];
+            size_t entries[spatial_bins] = {}, exits[spatial_bins] = {};
+            for (const auto &ref : refs)
+            {
+                const interval &span = ref.bbox.axis_interval(a);
+                int first = spatial_bin(span.min, extent.min, width);
+                int last = std::max(first, spatial_bin(span.max, extent.min, width));
+                aabb rest = ref.bbox;
+                for (int b = first; b < last; b++)
+                {
+                    aabb left, right;
+                    clip_reference(ref, rest, a, extent.min + (b + 1) * width, left, right);
+                    bin_bounds[b] = aabb(bin_bounds[b], left);
+                    rest = right;
+                }
+                bin_bounds[last] = aabb(bin_bounds[last], rest);
+                entries[first]++;
+                exits[last]++;
+            }
+            sweep(bin_bounds, entries, exits, spatial_bins, a, best);
+        }
+        return best;
+    }
+
+    /**
+     * @brief Bin of a position in a spatial split
+     */
+    static int spatial_bin(double position, double min, double width)
+    {
+        double bin = (position - min) / width;
+        return bin > 0 ? int(std::min(bin, double(spatial_bins - 1))) : 0;
+    }
+
+    /**
+     * @brief Evaluate every plane between bins and keep the cheapest
+     * @param left_counts References that start in each bin (count on the left side)
+     * @param right_counts References that end in each bin (count on the right side)
+     */
+    static void sweep(const aabb *bin_bounds, const size_t *left_counts, const size_t *right_counts, int bins, int axis,
+                      split &best)
+    {
+        std::vector<aabb> right_bounds(bins);
+        std::vector<size_t> right_total(bins);
+        aabb accumulated;
+        size_t accumulated_count = 0;
+        for (int b = bins - 1; b > 0; b--)
+        {
+            accumulated = aabb(accumulated, bin_bounds[b]);
+            accumulated_count += right_counts[b];
+            right_bounds[b] = accumulated;
+            right_total[b] = accumulated_count;
+        }
+
+        accumulated = aabb();
+        accumulated_count = 0;
+        for (int b = 1; b < bins; b++)
+        {
+            accumulated = aabb(accumulated, bin_bounds[b - 1]);
+            accumulated_count += left_counts[b - 1];
+            if (accumulated_count == 0 || right_total[b] == 0)
+                continue;
+            double cost = accumulated.surface_area() * accumulated_count + right_bounds[b].surface_area() * right_total[b];
+            if (cost < best.cost)
+            {
+                best.cost = cost;
+                best.axis = axis;
+                best.bin = b;
+                best.left = accumulated;
+                best.right = right_bounds[b];
+            }
+        }
+    }
+
+    /**
+     * @brief Clip the part of a reference inside box at a plane
+     */
+    void clip_reference(const reference &ref, const aabb &box, int axis, double position, aabb &left,
+                        aabb &right) const
+    {
+        if (clip)
+            clip(ref.index, axis, position, left, right);
+        else
+        {
+            left = right = (*source_bounds)[ref.index];
+            interval &left_span = axis == 0 ? left.x : (axis == 1 ? left.y : left.z);
+            interval &right_span = axis == 0 ? right.x : (axis == 1 ? right.y : right.z);
+            left_span.max = std::min(left_span.max, position);
+            right_span.min = std::max(right_span.min, position);
+        }
+        left = intersection(left, box);
+        right = intersection(right, box);
+    }
+
+    /**
+     * @brief Intersection of two boxes (empty if disjoint)
+     */
+    static aabb intersection(const aabb &a, const aabb &b)
+    {
+        interval x(std::max(a.x.min, b.x.min), std::min(a.x.max, b.x.max));
+        interval y(std::max(a.y.min, b.y.min), std::min(a.y.max, b.y.max));
+        interval z(std::max(a.z.min, b.z.min), std::min(a.z.max, b.z.max));
+        if (x.size() < 0 || y.size() < 0 || z.size() < 0)
+            return aabb::empty;
+        return aabb(x, y, z);
+    }
+
+    /**
+     * @brief Distribute references at a spatial split plane
+     *
+     * A straddling reference is split into both sides unless putting it
+     * whole on one side is cheaper (reference unsplitting) or the growth
+     * cap has been reached.
+     */
+    void split_spatially(const std::vector<reference> &refs, const aabb &bbox, const split &plane,
+                         std::vector<reference> &left, std::vector<reference> &right)
+    {
+        const interval &extent = bbox.axis_interval(plane.axis);
+        double position = extent.min + plane.bin * (extent.size() / spatial_bins);
+
+        size_t left_count = 0, right_count = 0;
+        for (const auto &ref : refs)
+        {
+            const interval &span = ref.bbox.axis_interval(plane.axis);
+            left_count += span.min < position;
+            right_count += span.max > position;
+        }
+        double left_area = plane.left.surface_area(), right_area = plane.right.surface_area();
+
+        for (const auto &ref : refs)
+        {
+            const interval &span = ref.bbox.axis_interval(plane.axis);
+            if (span.max <= position && span.min < position)
+                left.push_back(ref);
+            else if (span.min >= position)
+                right.push_back(ref);
+            else
+            {
+                // Compare splitting with keeping the reference whole on either side
+                double split_cost = left_area * left_count + right_area * right_count;
+                double all_left = aabb(plane.left, ref.bbox).surface_area() * left_count + right_area * (right_count - 1);
+                double all_right = left_area * (left_count - 1) + aabb(plane.right, ref.bbox).surface_area() * right_count;
+                if (reference_count >= reference_budget)
+                    split_cost = infinity;
+
+                if (split_cost < all_left && split_cost < all_right)
+                {
+                    aabb left_part, right_part;
+                    clip_reference(ref, ref.bbox, plane.axis, position, left_part, right_part);
+                    if (left_part.is_empty() || right_part.is_empty())
+                        (left_part.is_empty() ? right : left).push_back(ref);
+                    else
+                    {
+                        left.push_back({left_part, ref.index});
+                        right.push_back({right_part, ref.index});
+                        reference_count++;
+                    }
+                }
+                else if (all_left <= all_right)
+                    left.push_back(ref);
+                else
+                    right.push_back(ref);
+            }
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,135 @@
+#ifndef SCENE_ARENA_H
+#define SCENE_ARENA_H
+
+#include "rtweekend.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+/**
+ * @file scene_arena.h
+ * @brief Bump allocation for scene objects and materials
+ *
+ * This file implements an arena that places the primitives and materials
+ * of a scene next to each other in build order. Objects are still held by
+ * shared_ptr, so the rest of the renderer is unchanged: they are created
+ * with make_in(), which allocates the object together with its control
+ * block from the arena. Every control block keeps the arena alive, and
+ * the arena releases all of its memory in one step when the last object
+ * is gone.
+ */
+
+/**
+ * @class scene_arena
+ * @brief Monotonic allocator handing out memory from large blocks
+ *
+ * Allocation is a pointer bump; individual deallocation does nothing.
+ * An arena is filled by one thread while a scene is built; afterwards
+ * only the objects in it are used.
+ */
+class scene_arena
+{
+public:
+    /**
+     * @brief Constructor
+     * @param block_size Size of the blocks requested from the system
+     */
+    explicit scene_arena(size_t block_size = size_t(1) << 20) : block_size(block_size) {}
+
+    scene_arena(const scene_arena &) = delete;
+    scene_arena &operator=(const scene_arena &) = delete;
+
+    /**
+     * @brief Allocate memory
+     * @param bytes Size of the allocation
+     * @param alignment Required alignment (a power of two, at most alignof(std::max_align_t))
+     * @return Pointer to uninitialized memory owned by the arena
+     */
+    void *allocate(size_t bytes, size_t alignment)
+    {
+        // Blocks start at max_align_t boundaries, so aligning the offset aligns the address
+        size_t offset = (used + alignment - 1) & ~(alignment - 1);
+        if (blocks.empty() || offset + bytes > capacity)
+        {
+            capacity = std::max(block_size, bytes);
+            blocks.emplace_back(new std::max_align_t[(capacity + sizeof(std::max_align_t) - 1) / sizeof(std::max_align_t)]);
+            offset = 0;
+        }
+        used = offset + bytes;
+        total += bytes;
+        return reinterpret_cast<char *>(blocks.back().get()) + offset;
+    }
+
+    /**
+     * @brief Bytes handed out so far
+     */
+    size_t bytes_allocated() const { return total; }
+
+private:
+    std::vector<std::unique_ptr<std::max_align_t[]>> blocks; ///< Memory blocks, the last one being filled
+    size_t block_size;                                       ///< Size of new blocks
+    size_t capacity = 0;                                     ///< Size of the last block
+    size_t used = 0;                                         ///< Bytes used in the last block
+    size_t total = 0;                                        ///< Bytes handed out in all blocks
+};
+
+/**
+ * @class arena_allocator
+ * @brief Standard allocator drawing from a scene_arena
+ *
+ * Holds a reference to the arena, so a shared_ptr control block created
+ * with std::allocate_shared keeps the arena alive as long as its object.
+ */
+template <typename T>
+class arena_allocator
+{
+public:
+    using value_type = T;
+
+    explicit arena_allocator(shared_ptr<scene_arena> arena) : arena(std::move(arena)) {}
+
+    template <typename U>
+    arena_allocator(const arena_allocator<U> &other) : arena(other.arena)
+    {
+    }
+
+    T *allocate(size_t count)
+    {
+        static_assert(alignof(T) <= alignof(std::max_align_t), "over-aligned types are not supported");
+        return static_cast<T *>(arena->allocate(count * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T *, size_t) noexcept {} // Memory is released with the arena
+
+    template <typename U>
+    bool operator==(const arena_allocator<U> &other) const
+    {
+        return arena == other.arena;
+    }
+
+    template <typename U>
+    bool operator!=(const arena_allocator<U> &other) const
+    {
+        return arena != other.arena;
+    }
+
+    shared_ptr<scene_arena> arena; ///< Arena the memory comes from
+};
+
+/**
+ * @brief Create a shared object in an arena
+ * @param arena Arena to allocate from; without one the object is created with make_shared
+ * @param args Constructor arguments
+ * @return Shared pointer to the new object
+ */
+template <typename T, typename... Args>
+shared_ptr<T> make_in(const shared_ptr<scene_arena> &arena, Args &&...args)
+{
+    if (!arena)
+        return make_shared<T>(std::forward<Args>(args)...);
+    return std::allocate_shared<T>(arena_allocator<T>(arena), std::forward<Args>(args)...);
+}
+
+#endif
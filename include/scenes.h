@@ -0,0 +1,350 @@
+#ifndef SCENES_H
+#define SCENES_H
+
+#include "bvh_cache.h"
+#include "camera.h"
+#include "chunked_scene.h"
+#include "hittable_list.h"
+#include "instance.h"
+#include "material.h"
+#include "obj_loader.h"
+#include "plane.h"
+#include "scene_arena.h"
+#include "sphere.h"
+#include "transform.h"
+#include "triangle_mesh.h"
+
+#include <sstream>
+#include <string>
+#include <vector>
+
+/**
+ * @file scenes.h
+ * @brief Standard scenes shared by the renderer and the benchmarks
+ *
+ * Scenes are generated from a fixed random seed so that every process
+ * building the same scene gets exactly the same geometry.
+ */
+
+/**
+ * @brief Build the "Ray Tracing in One Weekend" cover scene
+ * @param extent Half-size of the grid of small spheres (11 for the cover image)
+ * @param seed Seed for the random sphere placement and materials
+ * @param bounce Largest upward motion of the diffuse spheres during the
+ *        exposure ("The Next Week" bouncing spheres); 0 keeps them still
+ * @return Scene with a ground plane, a grid of small spheres and three large spheres
+ *
+ * The grid contains (2 * extent)² candidate spheres, so larger extents give
+ * scaled-up variants of the same scene for benchmarking. Spheres and
+ * materials are allocated from a scene_arena in build order.
+ */
+inline hittable_list cover_scene(int extent = 11, uint64_t seed = 0, double bounce = 0)
+{
+    thread_random_generator().state = seed;
+
+    // Create the world/scene container; objects and materials are packed in one arena
+    hittable_list world;
+    auto arena = make_shared<scene_arena>();
+
+    auto ground_material = make_in<lambertian>(arena, color(0.5, 0.5, 0.5));
+    world.add(make_in<plane>(arena, point3(0, 0, 0), vec3(0, 1, 0), ground_material));
+
+    for (int a = -extent; a < extent; a++)
+    {
+        for (int b = -extent; b < extent; b++)
+        {
+            auto choose_mat = random_double();
+            point3 center(a + 0.9 * random_double(), 0.2, b + 0.9 * random_double());
+
+            if ((center - point3(4, 0.2, 0)).length() > 0.9)
+            {
+                shared_ptr<material> sphere_material;
+
+                if (choose_mat < 0.8)
+                {
+                    // diffuse
+                    auto albedo = color::random() * color::random();
+                    sphere_material = make_in<lambertian>(arena, albedo);
+                    if (bounce > 0)
+                    {
+                        auto center2 = center + vec3(0, random_double(0, bounce), 0);
+                        world.add(make_in<sphere>(arena, center, center2, 0.2, sphere_material));
+                    }
+                    else
+                        world.add(make_in<sphere>(arena, center, 0.2, sphere_material));
+                }
+                else if (choose_mat < 0.95)
+                {
+                    // metal
+                    auto albedo = color::random(0.5, 1);
+                    auto fuzz = random_double(0, 0.5);
+                    sphere_material = make_in<metal>(arena, albedo, fuzz);
+                    world.add(make_in<sphere>(arena, center, 0.2, sphere_material));
+                }
+                else
+                {
+                    // glass
+                    sphere_material = make_in<dielectric>(arena, 1.5);
+                    world.add(make_in<sphere>(arena, center, 0.2, sphere_material));
+                }
+            }
+        }
+    }
+
+    auto material1 = make_in<dielectric>(arena, 1.5);
+    world.add(make_in<sphere>(arena, point3(0, 1, 0), 1.0, material1));
+
+    auto material2 = make_in<lambertian>(arena, color(0.4, 0.2, 0.1));
+    world.add(make_in<sphere>(arena, point3(-4, 1, 0), 1.0, material2));
+
+    auto material3 = make_in<metal>(arena, color(0.7, 0.6, 0.5), 0.0);
+    world.add(make_in<sphere>(arena, point3(4, 1, 0), 1.0, material3));
+
+    return world;
+}
+
+/**
+ * @brief Build the cover scene around a streamed sphere field
+ * @param field Small spheres, typically a chunked_scene
+ * @return Scene with the ground plane, the field and the three large spheres
+ */
+inline hittable_list streamed_cover_scene(shared_ptr<hittable> field)
+{
+    hittable_list world;
+    world.add(make_shared<plane>(point3(0, 0, 0), vec3(0, 1, 0), make_shared<lambertian>(color(0.5, 0.5, 0.5))));
+    world.add(field);
+    world.add(make_shared<sphere>(point3(0, 1, 0), 1.0, make_shared<dielectric>(1.5)));
+    world.add(make_shared<sphere>(point3(-4, 1, 0), 1.0, make_shared<lambertian>(color(0.4, 0.2, 0.1))));
+    world.add(make_shared<sphere>(point3(4, 1, 0), 1.0, make_shared<metal>(color(0.7, 0.6, 0.5), 0.0)));
+    return world;
+}
+
+/**
+ * @brief Build a triangulated unit sphere
+ * @param rows Number of latitude bands (the mesh has 4 * rows * (rows - 1) triangles)
+ * @param mat Material of the mesh
+ * @return Sphere mesh of radius 1 centered at the origin
+ *
+ * Gives benchmarks a mesh of any size without reading files.
+ */
+inline shared_ptr<triangle_mesh> uv_sphere_mesh(int rows, shared_ptr<material> mat)
+{
+    int columns = 2 * rows;
+    std::vector<point3> vertices;
+    std::vector<uint32_t> indices;
+
+    // Poles plus (rows - 1) rings of vertices
+    vertices.push_back(point3(0, 1, 0));
+    for (int i = 1; i < rows; i++)
+    {
+        double theta = pi * i / rows;
+        for (int j = 0; j < columns; j++)
+        {
+            double phi = 2 * pi * j / columns;
+            vertices.push_back(point3(std::sin(theta) * std::cos(phi), std::cos(theta), std::sin(theta) * std::sin(phi)));
+        }
+    }
+    vertices.push_back(point3(0, -1, 0));
+
+    auto ring = [&](int i, int j) { return uint32_t(1 + (i - 1) * columns + j % columns); };
+    uint32_t bottom = uint32_t(vertices.size() - 1);
+    for (int j = 0; j < columns; j++)
+    {
+        indices.insert(indices.end(), {0, ring(1, j + 1), ring(1, j)});
+        for (int i = 1; i + 1 < rows; i++)
+        {
+            indices.insert(indices.end(), {ring(i, j), ring(i, j + 1), ring(i + 1, j + 1)});
+            indices.insert(indices.end(), {ring(i, j), ring(i + 1, j + 1), ring(i + 1, j)});
+        }
+        indices.insert(indices.end(), {ring(rows - 1, j), ring(rows - 1, j + 1), bottom});
+    }
+
+    return make_shared<triangle_mesh>(std::move(vertices), std::move(indices), mat);
+}
+
+/**
+ * @brief Scatter instances of shared geometry over the cover scene ground
+ * @param world Scene to add the instances to
+ * @param object Geometry shared by all instances
+ * @param count Number of instances
+ * @param extent Half-size of the square the instances are placed in
+ * @param seed Seed for the random placement
+ *
+ * The geometry is fitted to a unit box, then every instance gets a random
+ * position, rotation around the vertical axis and scale, resting on y = 0.
+ */
+inline void scatter_instances(hittable_list &world, shared_ptr<hittable> object, int count, double extent = 11,
+                              uint64_t seed = 0)
+{
+    random_generator rng(seed);
+    aabb box = object->bounding_box();
+    double size = std::max({box.x.size(), box.y.size(), box.z.size()});
+    if (box.is_empty() || size <= 0)
+        return;
+
+    // Move the center of the bottom face to the origin and scale to unit size
+    transform fit = transform::scale(1.0 / size) *
+                    transform::translate(-point3(0.5 * (box.x.min + box.x.max), box.y.min, 0.5 * (box.z.min + box.z.max)));
+
+    auto arena = make_shared<scene_arena>();
+    for (int k = 0; k < count; k++)
+    {
+        double x = extent * (2 * rng.next_double() - 1);
+        double z = extent * (2 * rng.next_double() - 1);
+        double yaw = 360 * rng.next_double();
+        double scale = 0.2 + 0.4 * rng.next_double();
+        transform placement = transform::translate(vec3(x, 0, z)) * transform::rotate(vec3(0, 1, 0), yaw) *
+                              transform::scale(scale) * fit;
+        world.add(make_in<instance>(arena, object, placement));
+    }
+}
+
+/**
+ * @struct scene_description
+ * @brief Parameters from which a scene is built
+ *
+ * Two descriptions with the same key() build the same scene, which lets
+ * long-running processes reuse a scene that was built before.
+ */
+struct scene_description
+{
+    int extent = 11;                         ///< Half-size of the cover scene sphere grid
+    uint64_t seed = 0;                       ///< Seed of the cover scene
+    double bounce = 0;                       ///< Motion blur bounce height of the diffuse spheres
+    std::vector<std::string> mesh_paths;     ///< OBJ files added with a neutral diffuse material
+    int mesh_instances = 0;                  ///< Scatter this many instances of each mesh (0 adds it once)
+    std::string bvh_cache_directory;         ///< Load meshes through a bvh_cache here (does not change the scene)
+    std::string field_directory;             ///< Stream the small spheres from this chunked_scene instead
+    size_t field_budget = size_t(1) << 30;   ///< Resident bytes of the streamed field (does not change the scene)
+    bool compress_bvh = false;               ///< Use compact_bvh layouts for meshes and the top level (does not change the image)
+    bvh_build_method bvh_method = sah_build; ///< Algorithm for mesh and top-level BVHs (does not change the image)
+
+    /**
+     * @brief Canonical text form of the description
+     */
+    std::string key() const
+    {
+        std::ostringstream out;
+        out.precision(17);
+        if (field_directory.empty())
+            out << "cover " << extent << ' ' << seed << ' ' << bounce;
+        else
+            out << "field " << field_directory.size() << ':' << field_directory;
+        out << " instances " << mesh_instances;
+        for (const auto &path : mesh_paths)
+            out << " mesh " << path.size() << ':' << path;
+        return out.str();
+    }
+
+    /**
+     * @brief Hash everything the scene is built from
+     * @param hash Hash to add to
+     * @param error Description of the failure (output)
+     * @return False if a mesh file or the field manifest could not be read
+     *
+     * Adds key() and the contents of the mesh files and field manifest,
+     * so edited files give a different hash under the same paths.
+     */
+    bool add_contents(content_hash &hash, std::string &error) const
+    {
+        hash.add(key());
+        if (!field_directory.empty() && !hash.add_file(field_directory + "/manifest.bin"))
+        {
+            error = "cannot read the manifest of " + field_directory;
+            return false;
+        }
+        for (const auto &path : mesh_paths)
+        {
+            if (!hash.add_file(path))
+            {
+                error = "cannot read " + path;
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /**
+     * @brief Build the scene
+     * @param world Scene to fill (output)
+     * @param error Description of the failure (output)
+     * @return False if a mesh could not be loaded
+     */
+    bool build(hittable_list &world, std::string &error) const
+    {
+        if (field_directory.empty())
+            world = cover_scene(extent, seed, bounce);
+        else
+        {
+            auto field = make_shared<chunked_scene>();
+            field->resident_budget = field_budget;
+            if (!field->open(field_directory))
+            {
+                error = field->error;
+                return false;
+            }
+            std::clog << "Streaming " << field->sphere_count() << " spheres in " << field->chunk_count()
+                      << " chunks from " << field_directory << '\n';
+            world = streamed_cover_scene(field);
+        }
+
+        for (size_t m = 0; m < mesh_paths.size(); m++)
+        {
+            const std::string &path = mesh_paths[m];
+            auto mat = make_shared<lambertian>(color(0.6, 0.6, 0.6));
+            shared_ptr<triangle_mesh> mesh;
+            bool cached = false;
+            if (bvh_cache_directory.empty())
+            {
+                obj_loader loader;
+                if (loader.load(path))
+                    mesh = loader.make_mesh(mat, bvh_method);
+                else
+                    error = loader.error;
+            }
+            else
+            {
+                bvh_cache cache(bvh_cache_directory);
+                mesh = cache.load_obj(path, mat, cached, bvh_method);
+                if (!mesh)
+                    error = cache.error;
+            }
+            if (!mesh)
+            {
+                error = "failed to load mesh " + path + ": " + error;
+                return false;
+            }
+            std::clog << (cached ? "Mapped " : "Loaded ") << path << " (" << mesh->triangle_count() << " triangles)\n";
+            if (compress_bvh)
+                mesh->compress();
+            // Every mesh gets its own placements, so the instances of several meshes do not coincide
+            if (mesh_instances > 0)
+                scatter_instances(world, mesh, mesh_instances, 11, mix_bits(seed + m));
+            else
+                world.add(mesh);
+        }
+        return true;
+    }
+};
+
+/**
+ * @brief Configure a camera with the cover scene view
+ * @param cam Camera to configure
+ *
+ * Sets the viewpoint and lens of the cover image. Resolution and sampling
+ * parameters are left to the caller.
+ */
+inline void cover_camera(Camera &cam)
+{
+    cam.aspect_ratio = 16.0 / 9.0; // Widescreen aspect ratio
+
+    cam.vfov = 30;
+    cam.lookfrom = point3(13, 2, 3);
+    cam.lookat = point3(0, 0, 0);
+    cam.vup = vec3(0, 1, 0);
+
+    cam.defocus_angle = 0.6;
+    cam.focus_dist = 10.0;
+}
+
+#endif
@@ -0,0 +1,250 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include "trace.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * @file scheduler.h
+ * @brief Thread pool and work-stealing task scheduler
+ *
+ * This file implements the parallel execution layer of the renderer:
+ * a persistent pool of worker threads, and a scheduler that distributes
+ * a list of prioritized tasks (image tiles) over per-worker deques.
+ * Idle workers steal from the other end of their peers' deques, so the
+ * frame finishes with all cores busy even when task costs vary widely.
+ */
+
+/**
+ * @struct render_tile
+ * @brief Rectangular block of pixels rendered as one task
+ */
+struct render_tile
+{
+    int x0, y0;      ///< Top-left pixel (inclusive)
+    int x1, y1;      ///< Bottom-right pixel (exclusive)
+    double cost = 0; ///< Estimated render cost, used to order tiles
+};
+
+/**
+ * @class thread_pool
+ * @brief Fixed set of worker threads that run jobs in lockstep
+ *
+ * Threads are created once and reused for every job, so repeated renders
+ * do not pay thread start-up costs.
+ */
+class thread_pool
+{
+public:
+    /**
+     * @brief Start the worker threads
+     * @param thread_count Number of workers (0 = number of hardware threads)
+     */
+    explicit thread_pool(int thread_count = 0)
+    {
+        if (thread_count <= 0)
+            thread_count = std::max(1u, std::thread::hardware_concurrency());
+
+        for (int worker = 0; worker < thread_count; worker++)
+            threads.emplace_back([this, worker] { worker_loop(worker); });
+    }
+
+    /**
+     * @brief Stop and join all workers
+     */
+    ~thread_pool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto &thread : threads)
+            thread.join();
+    }
+
+    thread_pool(const thread_pool &) = delete;
+    thread_pool &operator=(const thread_pool &) = delete;
+
+    /**
+     * @brief Number of worker threads
+     */
+    int size() const { return int(threads.size()); }
+
+    /**
+     * @brief Run a job on every worker and wait for all of them
+     * @param job Function called once per worker with the worker index
+     */
+    void run(const std::function<void(int worker)> &job)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        current_job = &job;
+        pending = size();
+        generation++;
+        wake.notify_all();
+        done.wait(lock, [this] { return pending == 0; });
+        current_job = nullptr;
+    }
+
+private:
+    std::vector<std::thread> threads;                       ///< Worker threads
+    std::mutex mutex;                                       ///< Guards the job state below
+    std::condition_variable wake;                           ///< Signals a new job or shutdown
+    std::condition_variable done;                           ///< Signals job completion
+    const std::function<void(int)> *current_job = nullptr; ///< Job being run
+    unsigned long generation = 0;                           ///< Incremented for every job
+    int pending = 0;                                        ///< Workers still running the job
+    bool stopping = false;                                  ///< Set when the pool shuts down
+
+    void worker_loop(int worker)
+    {
+        trace_recorder::instance().set_thread_name("worker " + std::to_string(worker));
+
+        unsigned long seen = 0;
+        while (true)
+        {
+            const std::function<void(int)> *job;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [&] { return stopping || generation != seen; });
+                if (stopping)
+                    return;
+                seen = generation;
+                job = current_job;
+            }
+
+            (*job)(worker);
+
+            std::lock_guard<std::mutex> lock(mutex);
+            if (--pending == 0)
+                done.notify_one();
+        }
+    }
+};
+
+/**
+ * @struct worker_report
+ * @brief Scheduling statistics of one worker for one run
+ */
+struct worker_report
+{
+    double busy_seconds = 0; ///< Time spent executing tasks
+    double idle_seconds = 0; ///< Time spent looking for work or waiting for the run to end
+    int tasks = 0;           ///< Tasks executed
+    int steals = 0;          ///< Tasks taken from other workers
+};
+
+/**
+ * @class work_stealing_scheduler
+ * @brief Distributes prioritized tasks over per-worker deques
+ *
+ * Tasks are dealt round-robin in priority order, so the front of every
+ * deque holds that worker's most expensive tasks. A worker pops from the
+ * front of its own deque; when it runs dry it steals from the back of
+ * another worker's deque, taking the cheap tasks that fill the tail of
+ * the frame best.
+ */
+class work_stealing_scheduler
+{
+public:
+    /**
+     * @brief Execute tasks on a thread pool
+     * @param pool Worker threads to use
+     * @param order Task indices, most expensive first
+     * @param task Function called as task(index, worker) for every task
+     * @return Per-worker busy/idle report
+     */
+    std::vector<worker_report> run(thread_pool &pool, const std::vector<int> &order,
+                                   const std::function<void(int task, int worker)> &task)
+    {
+        int workers = pool.size();
+        std::vector<worker_queue> queues(workers);
+        for (size_t k = 0; k < order.size(); k++)
+            queues[k % workers].tasks.push_back(order[k]);
+
+        std::vector<worker_report> reports(workers);
+        auto start = std::chrono::steady_clock::now();
+
+        pool.run([&](int worker) {
+            auto &report = reports[worker];
+            int next;
+            bool stolen;
+            while (take(queues, worker, next, stolen))
+            {
+                auto task_start = std::chrono::steady_clock::now();
+                task(next, worker);
+                report.busy_seconds += seconds_since(task_start);
+                report.tasks++;
+                report.steals += stolen;
+            }
+        });
+
+        double wall = seconds_since(start);
+        for (auto &report : reports)
+            report.idle_seconds = std::max(0.0, wall - report.busy_seconds);
+        return reports;
+    }
+
+private:
+    /**
+     * @brief Task deque of one worker
+     */
+    struct worker_queue
+    {
+        std::mutex mutex;
+        std::deque<int> tasks;
+    };
+
+    /**
+     * @brief Take the next task for a worker, stealing if necessary
+     * @return False when no tasks are left anywhere
+     */
+    static bool take(std::vector<worker_queue> &queues, int worker, int &task, bool &stolen)
+    {
+        {
+            auto &own = queues[worker];
+            std::lock_guard<std::mutex> lock(own.mutex);
+            if (!own.tasks.empty())
+            {
+                task = own.tasks.front();
+                own.tasks.pop_front();
+                stolen = false;
+                return true;
+            }
+        }
+
+        // No task is ever added during a run, so one empty sweep means we are done
+        int workers = int(queues.size());
+        for (int k = 1; k < workers; k++)
+        {
+            auto &victim = queues[(worker + k) % workers];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (!victim.tasks.empty())
+            {
+                task = victim.tasks.back();
+                victim.tasks.pop_back();
+                stolen = true;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    static double seconds_since(std::chrono::steady_clock::time_point start)
+    {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+};
+
+#endif
@@ -2,6 +2,7 @@
 #define SPHERE_H
 
 #include "hittable.h"
+#include "render_stats.h"
 #include "rtweekend.h"
 
 /**
@@ -19,7 +20,9 @@
  * 
  * A sphere is defined by a center point and radius. The intersection
  * algorithm uses the quadratic formula to find intersection points
- * between rays and spheres efficiently.
+ * between rays and spheres efficiently. A sphere may move linearly
+ * during the exposure; its center is then evaluated at the ray's time
+ * and its bounding box covers the whole motion.
  */
 class sphere : public hittable
 {
@@ -31,9 +34,23 @@ public:
      * @param mat Material applied to the sphere surface
      */
     sphere(const point3 &center, double radius, shared_ptr<material> mat) 
-        : center(center), radius(std::fmax(0, radius)), mat(mat)
+        : center(center), motion(0, 0, 0), radius(std::fmax(0, radius)), mat(mat)
     {
         // Material pointer is initialized via member initializer list
+        update_bounds();
+    }
+
+    /**
+     * @brief Constructor for a moving sphere
+     * @param center0 Center point when the shutter opens (time 0)
+     * @param center1 Center point when the shutter closes (time 1)
+     * @param radius Radius of the sphere (must be non-negative)
+     * @param mat Material applied to the sphere surface
+     */
+    sphere(const point3 &center0, const point3 &center1, double radius, shared_ptr<material> mat)
+        : center(center0), motion(center1 - center0), radius(std::fmax(0, radius)), mat(mat)
+    {
+        update_bounds();
     }
 
     /**
@@ -59,8 +76,11 @@ public:
      */
     bool hit(const ray &r, interval ray_t, hit_record &rec) const override
     {
-        vec3 oc = center - r.origin();
-        auto a = r.direction().length_squared();
+        RT_STAT_INC(sphere_tests);
+
+        point3 current_center = center + r.time() * motion;
+        vec3 oc = current_center - r.origin();
+        auto a = r.direction_length_squared();
         auto h = dot(r.direction(), oc);
         auto c = oc.length_squared() - radius * radius;
 
@@ -82,17 +102,48 @@ public:
         // Fill hit record with intersection information
         rec.t = root;
         rec.p = r.at(rec.t);
-        vec3 outward_normal = (rec.p - center) / radius;
+        vec3 outward_normal = (rec.p - current_center) / radius;
         rec.set_face_normal(r, outward_normal);
         rec.mat = mat;
 
+        RT_STAT_INC(sphere_hits);
         return true;
     }
 
+    /**
+     * @brief Move the sphere (for animation)
+     * @param new_center New center point at time 0; the motion during the exposure is kept
+     *
+     * Containers holding the sphere in a BVH must be updated afterwards
+     * (see bvh_accel::update).
+     */
+    void set_center(const point3 &new_center)
+    {
+        center = new_center;
+        update_bounds();
+    }
+
+    /**
+     * @brief Get the bounding box of the sphere
+     * @return Box around the sphere at the start and end of its motion
+     */
+    aabb bounding_box() const override { return bbox; }
+
 private:
-    point3 center;                    ///< Center point of the sphere
+    point3 center;                    ///< Center point of the sphere at time 0
+    vec3 motion;                      ///< Displacement of the center from time 0 to time 1
     double radius;                    ///< Radius of the sphere
     shared_ptr<material> mat;        ///< Material applied to the sphere surface
+    aabb bbox;                       ///< Bounding box of the sphere over the exposure
+
+    /**
+     * @brief Recompute the bounding box from center, motion and radius
+     */
+    void update_bounds()
+    {
+        auto rvec = vec3(radius, radius, radius);
+        bbox = aabb(aabb(center - rvec, center + rvec), aabb(center + motion - rvec, center + motion + rvec));
+    }
 };
 
 #endif
\ No newline at end of file
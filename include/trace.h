@@ -0,0 +1,201 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/**
+ * @file trace.h
+ * @brief Timeline tracing of render phases in Chrome trace-event format
+ *
+ * This file implements scoped timing instrumentation. Each thread records
+ * complete ("X") events into its own buffer; the buffers are merged and
+ * written as Chrome trace-event JSON, which can be opened in Perfetto
+ * (ui.perfetto.dev) or chrome://tracing. Each thread appears as its own
+ * track. Tracing is off by default and costs one atomic load per scope.
+ */
+
+/**
+ * @class trace_recorder
+ * @brief Process-wide collector of trace events
+ */
+class trace_recorder
+{
+public:
+    /**
+     * @brief A single timed event
+     */
+    struct event
+    {
+        const char *name;     ///< Event name (must be a string literal)
+        const char *category; ///< Event category (must be a string literal)
+        long index;           ///< Optional index argument (-1 if unused)
+        double start_us;      ///< Start time in microseconds since enable()
+        double duration_us;   ///< Duration in microseconds
+    };
+
+    /**
+     * @brief Access the process-wide recorder
+     */
+    static trace_recorder &instance()
+    {
+        static trace_recorder recorder;
+        return recorder;
+    }
+
+    /**
+     * @brief Start recording events
+     */
+    void enable()
+    {
+        epoch = std::chrono::steady_clock::now();
+        active.store(true, std::memory_order_release);
+    }
+
+    /**
+     * @brief Check whether events are being recorded
+     */
+    bool enabled() const { return active.load(std::memory_order_relaxed); }
+
+    /**
+     * @brief Microseconds elapsed since enable()
+     */
+    double now_us() const
+    {
+        return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - epoch).count();
+    }
+
+    /**
+     * @brief Name the track of the calling thread
+     * @param name Display name, e.g. "main" or "worker 3"
+     */
+    void set_thread_name(const std::string &name)
+    {
+        thread_buffer &buffer = local();
+        std::lock_guard<std::mutex> lock(mutex);
+        buffer.name = name;
+    }
+
+    /**
+     * @brief Record an event on the calling thread's track
+     */
+    void record(const event &e)
+    {
+        local().events.push_back(e);
+    }
+
+    /**
+     * @brief Write all recorded events as Chrome trace-event JSON
+     * @param path Destination file
+     * @return True on success
+     *
+     * Must be called while no thread is recording.
+     */
+    bool write(const std::string &path)
+    {
+        std::ofstream out(path);
+        if (!out)
+            return false;
+
+        std::lock_guard<std::mutex> lock(mutex);
+        out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+        bool first = true;
+        for (const auto &buffer : buffers)
+        {
+            out << (first ? "" : ",\n") << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": "
+                << buffer->tid << ", \"args\": {\"name\": \"" << buffer->name << "\"}}";
+            first = false;
+
+            for (const auto &e : buffer->events)
+            {
+                out << ",\n{\"name\": \"" << e.name << "\", \"cat\": \"" << e.category << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": "
+                    << buffer->tid << ", \"ts\": " << e.start_us << ", \"dur\": " << e.duration_us;
+                if (e.index >= 0)
+                    out << ", \"args\": {\"index\": " << e.index << "}";
+                out << "}";
+            }
+        }
+        out << "\n]}\n";
+        return bool(out);
+    }
+
+private:
+    /**
+     * @brief Events of one thread
+     */
+    struct thread_buffer
+    {
+        int tid;                   ///< Track id
+        std::string name;          ///< Track name
+        std::vector<event> events; ///< Recorded events
+    };
+
+    std::atomic<bool> active{false};                    ///< Whether recording is on
+    std::chrono::steady_clock::time_point epoch;        ///< Time origin of the trace
+    std::mutex mutex;                                   ///< Guards buffers and names
+    std::vector<std::unique_ptr<thread_buffer>> buffers; ///< One buffer per thread that recorded
+
+    /**
+     * @brief Buffer of the calling thread, created on first use
+     *
+     * Buffers are owned by the recorder so events survive thread exit.
+     */
+    thread_buffer &local()
+    {
+        thread_local thread_buffer *buffer = nullptr;
+        if (!buffer)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            int tid = int(buffers.size()) + 1;
+            buffers.push_back(std::unique_ptr<thread_buffer>(new thread_buffer{tid, "thread " + std::to_string(tid), {}}));
+            buffer = buffers.back().get();
+        }
+        return *buffer;
+    }
+};
+
+/**
+ * @class trace_scope
+ * @brief Records the lifetime of a scope as a trace event
+ *
+ * Usage: `trace_scope scope("render tile", "render", tile_index);`
+ */
+class trace_scope
+{
+public:
+    /**
+     * @brief Start timing a scope
+     * @param name Event name (string literal)
+     * @param category Event category (string literal)
+     * @param index Optional index shown in the event arguments
+     */
+    trace_scope(const char *name, const char *category = "render", long index = -1)
+        : name(name), category(category), index(index),
+          start_us(trace_recorder::instance().enabled() ? trace_recorder::instance().now_us() : -1)
+    {
+    }
+
+    ~trace_scope()
+    {
+        if (start_us < 0)
+            return;
+        auto &recorder = trace_recorder::instance();
+        recorder.record({name, category, index, start_us, recorder.now_us() - start_us});
+    }
+
+    trace_scope(const trace_scope &) = delete;
+    trace_scope &operator=(const trace_scope &) = delete;
+
+private:
+    const char *name;
+    const char *category;
+    long index;
+    double start_us; ///< Start time, or -1 when tracing is disabled
+};
+
+#endif
@@ -0,0 +1,179 @@
+#ifndef TRANSFORM_H
+#define TRANSFORM_H
+
+#include "aabb.h"
+#include "rtweekend.h"
+
+/**
+ * @file transform.h
+ * @brief Affine transformations of points, vectors and boxes
+ *
+ * This file defines the transform class, a 3x3 linear part plus a
+ * translation, together with factory functions for the common
+ * transformations. Instances use it to move rays between world space and
+ * the object space of shared geometry.
+ */
+
+/**
+ * @class transform
+ * @brief Affine transformation p' = M p + t
+ */
+class transform
+{
+public:
+    double m[3][3]; ///< Linear part, row major
+    vec3 t;         ///< Translation
+
+    /**
+     * @brief Default constructor - creates the identity transformation
+     */
+    transform() : m{{1, 0, 0}, {0, 1, 0}, {0, 0, 1}}, t(0, 0, 0) {}
+
+    /**
+     * @brief Translation by an offset
+     */
+    static transform translate(const vec3 &offset)
+    {
+        transform result;
+        result.t = offset;
+        return result;
+    }
+
+    /**
+     * @brief Scaling along the coordinate axes
+     */
+    static transform scale(const vec3 &factors)
+    {
+        transform result;
+        for (int i = 0; i < 3; i++)
+            result.m[i][i] = factors[i];
+        return result;
+    }
+
+    /**
+     * @brief Uniform scaling
+     */
+    static transform scale(double factor) { return scale(vec3(factor, factor, factor)); }
+
+    /**
+     * @brief Rotation around an axis through the origin
+     * @param axis Rotation axis (need not be normalized)
+     * @param degrees Counter-clockwise angle when looking down the axis
+     */
+    static transform rotate(const vec3 &axis, double degrees)
+    {
+        vec3 a = unit_vector(axis);
+        double theta = degrees_to_radians(degrees);
+        double c = std::cos(theta), s = std::sin(theta), k = 1 - c;
+
+        // Rodrigues' rotation formula
+        transform result;
+        result.m[0][0] = c + a.x() * a.x() * k;
+        result.m[0][1] = a.x() * a.y() * k - a.z() * s;
+        result.m[0][2] = a.x() * a.z() * k + a.y() * s;
+        result.m[1][0] = a.y() * a.x() * k + a.z() * s;
+        result.m[1][1] = c + a.y() * a.y() * k;
+        result.m[1][2] = a.y() * a.z() * k - a.x() * s;
+        result.m[2][0] = a.z() * a.x() * k - a.y() * s;
+        result.m[2][1] = a.z() * a.y() * k + a.x() * s;
+        result.m[2][2] = c + a.z() * a.z() * k;
+        return result;
+    }
+
+    /**
+     * @brief Transform a point (applies the translation)
+     */
+    point3 apply_point(const point3 &p) const { return apply_vector(p) + t; }
+
+    /**
+     * @brief Transform a direction (ignores the translation)
+     */
+    vec3 apply_vector(const vec3 &v) const
+    {
+        return vec3(m[0][0] * v[0] + m[0][1] * v[1] + m[0][2] * v[2],
+                    m[1][0] * v[0] + m[1][1] * v[1] + m[1][2] * v[2],
+                    m[2][0] * v[0] + m[2][1] * v[1] + m[2][2] * v[2]);
+    }
+
+    /**
+     * @brief Multiply a vector by the transposed linear part
+     *
+     * Called on the inverse of a transformation, this maps surface
+     * normals, which must stay perpendicular to transformed tangents.
+     */
+    vec3 apply_transposed(const vec3 &v) const
+    {
+        return vec3(m[0][0] * v[0] + m[1][0] * v[1] + m[2][0] * v[2],
+                    m[0][1] * v[0] + m[1][1] * v[1] + m[2][1] * v[2],
+                    m[0][2] * v[0] + m[1][2] * v[1] + m[2][2] * v[2]);
+    }
+
+    /**
+     * @brief Bounding box of a transformed box
+     *
+     * Each output extent is accumulated from the linear part's columns,
+     * which gives the tight box around all eight transformed corners.
+     */
+    aabb apply_box(const aabb &box) const
+    {
+        if (box.is_empty())
+            return box;
+
+        interval axes[3];
+        for (int i = 0; i < 3; i++)
+        {
+            double lo = t[i], hi = t[i];
+            for (int j = 0; j < 3; j++)
+            {
+                const interval &extent = box.axis_interval(j);
+                double a = m[i][j] * extent.min, b = m[i][j] * extent.max;
+                lo += std::min(a, b);
+                hi += std::max(a, b);
+            }
+            axes[i] = interval(lo, hi);
+        }
+        return aabb(axes[0], axes[1], axes[2]);
+    }
+
+    /**
+     * @brief Inverse transformation
+     *
+     * The linear part must be invertible (no zero scale factors).
+     */
+    transform inverse() const
+    {
+        double det = m[0][0] * (m[1][1] * m[2][2] - m[1][2] * m[2][1]) -
+                     m[0][1] * (m[1][0] * m[2][2] - m[1][2] * m[2][0]) +
+                     m[0][2] * (m[1][0] * m[2][1] - m[1][1] * m[2][0]);
+        double inv_det = 1.0 / det;
+
+        transform result;
+        result.m[0][0] = (m[1][1] * m[2][2] - m[1][2] * m[2][1]) * inv_det;
+        result.m[0][1] = (m[0][2] * m[2][1] - m[0][1] * m[2][2]) * inv_det;
+        result.m[0][2] = (m[0][1] * m[1][2] - m[0][2] * m[1][1]) * inv_det;
+        result.m[1][0] = (m[1][2] * m[2][0] - m[1][0] * m[2][2]) * inv_det;
+        result.m[1][1] = (m[0][0] * m[2][2] - m[0][2] * m[2][0]) * inv_det;
+        result.m[1][2] = (m[0][2] * m[1][0] - m[0][0] * m[1][2]) * inv_det;
+        result.m[2][0] = (m[1][0] * m[2][1] - m[1][1] * m[2][0]) * inv_det;
+        result.m[2][1] = (m[0][1] * m[2][0] - m[0][0] * m[2][1]) * inv_det;
+        result.m[2][2] = (m[0][0] * m[1][1] - m[0][1] * m[1][0]) * inv_det;
+        result.t = -result.apply_vector(t);
+        return result;
+    }
+};
+
+/**
+ * @brief Compose two transformations
+ * @return Transformation that applies b first, then a
+ */
+inline transform operator*(const transform &a, const transform &b)
+{
+    transform result;
+    for (int i = 0; i < 3; i++)
+        for (int j = 0; j < 3; j++)
+            result.m[i][j] = a.m[i][0] * b.m[0][j] + a.m[i][1] * b.m[1][j] + a.m[i][2] * b.m[2][j];
+    result.t = a.apply_point(b.t);
+    return result;
+}
+
+#endif
@@ -0,0 +1,366 @@
+#ifndef TRIANGLE_MESH_H
+#define TRIANGLE_MESH_H
+
+#include "bvh.h"
+#include "bvh_build.h"
+#include "compact_bvh.h"
+#include "hittable.h"
+#include "mapped_file.h"
+#include "render_stats.h"
+#include "rtweekend.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+/**
+ * @file triangle_mesh.h
+ * @brief Indexed triangle mesh primitive with its own BVH
+ *
+ * This file implements a triangle mesh that stores all vertex positions
+ * and triangle indices in two flat arrays instead of one object per
+ * triangle. The mesh builds a private BVH over its triangles and uses the
+ * watertight ray/triangle test of Woop, Benthin and Wald (2013), which
+ * never lets a ray slip through the shared edge of two triangles.
+ */
+
+/**
+ * @class triangle_mesh
+ * @brief Hittable made of many triangles sharing one material
+ */
+class triangle_mesh : public hittable
+{
+public:
+    /**
+     * @brief Constructor from vertex and index buffers
+     * @param vertices Vertex positions
+     * @param indices Three vertex indices per triangle
+     * @param mat Material applied to the whole mesh
+     * @param method Build algorithm, also used for rebuilds of a deforming mesh
+     *
+     * Builds the triangle BVH and reorders the triangles into leaf order.
+     */
+    triangle_mesh(std::vector<point3> vertices, std::vector<uint32_t> indices, shared_ptr<material> mat,
+                  bvh_build_method method = sah_build)
+        : vertices(std::move(vertices)), indices(std::move(indices)), mat(mat), method(method)
+    {
+        triangles = this->indices.size() / 3;
+        build_bvh();
+    }
+
+    /**
+     * @brief Constructor from prebuilt buffers, such as a loaded cache file
+     * @param vertices Vertex positions
+     * @param indices Three vertex indices per triangle, in the leaf order of the BVH
+     * @param bvh Hierarchy over the triangles
+     * @param mat Material applied to the whole mesh
+     * @param distinct_triangles Number of different triangles (0 if no triangle is repeated in indices)
+     * @param references Distinct triangle of every entry of indices (empty if no triangle is repeated)
+     */
+    triangle_mesh(mapped_array<point3> vertices, mapped_array<uint32_t> indices, bvh_tree bvh, shared_ptr<material> mat,
+                  size_t distinct_triangles = 0, mapped_array<uint32_t> references = {})
+        : vertices(std::move(vertices)), indices(std::move(indices)), mat(mat), bvh(std::move(bvh)),
+          references(std::move(references))
+    {
+        triangles = distinct_triangles > 0 ? distinct_triangles : this->indices.size() / 3;
+    }
+
+    /**
+     * @brief Number of triangles in the mesh
+     *
+     * A BVH with spatial splits references some triangles from several
+     * leaves; they are counted once.
+     */
+    size_t triangle_count() const { return triangles; }
+
+    /**
+     * @brief Replace the vertex positions of a deforming mesh
+     * @param new_vertices Positions in the same order as the original vertices
+     *
+     * The connectivity is unchanged, so the BVH is refit instead of being
+     * rebuilt, unless refitting has degraded it past the rebuild threshold.
+     */
+    void set_vertices(std::vector<point3> new_vertices)
+    {
+        vertices = std::move(new_vertices);
+
+        if (!compact.empty())
+        {
+            // Quantized nodes cannot be refit
+            build_bvh();
+            compress();
+            return;
+        }
+
+        trace_scope scope("refit mesh BVH", "accel");
+        bvh.refit(triangle_bounds());
+        if (bvh.needs_rebuild())
+            build_bvh();
+    }
+
+    /**
+     * @brief Test ray intersection against all triangles
+     * @param r The ray to test for intersection
+     * @param ray_t The interval along the ray to test for intersections
+     * @param rec Reference to hit_record to fill with the closest hit
+     * @return True if a triangle is hit within the interval
+     */
+    bool hit(const ray &r, interval ray_t, hit_record &rec) const override
+    {
+        const watertight_ray wr(r);
+        uint32_t hit_triangle = 0;
+
+        auto intersect = [&](uint32_t triangle, interval &t_range) {
+            double t;
+            if (!intersect_triangle(wr, triangle, t_range, t))
+                return false;
+            t_range.max = t;
+            hit_triangle = triangle;
+            return true;
+        };
+        bool hit_anything =
+            compact.empty() ? bvh.traverse(r, ray_t, intersect) : compact.traverse(r, ray_t, intersect);
+
+        if (!hit_anything)
+            return false;
+
+        const point3 &v0 = vertices[indices[3 * hit_triangle]];
+        const point3 &v1 = vertices[indices[3 * hit_triangle + 1]];
+        const point3 &v2 = vertices[indices[3 * hit_triangle + 2]];
+
+        rec.t = ray_t.max;
+        rec.p = r.at(rec.t);
+        rec.set_face_normal(r, unit_vector(cross(v1 - v0, v2 - v0)));
+        rec.mat = mat;
+        return true;
+    }
+
+    /**
+     * @brief Get the bounding box of the mesh
+     */
+    aabb bounding_box() const override { return compact.empty() ? bvh.bounds() : compact.bounds(); }
+
+    /**
+     * @brief Replace the triangle BVH by its quantized four-wide form (see compact_bvh)
+     *
+     * The full-precision nodes are released; deforming the mesh afterwards
+     * rebuilds the tree from scratch.
+     */
+    void compress()
+    {
+        trace_scope scope("compress mesh BVH", "accel");
+        compact.build(bvh);
+        bvh = bvh_tree();
+    }
+
+    /**
+     * @brief Bytes used by the nodes of the triangle BVH, in whichever layout is active
+     */
+    size_t hierarchy_bytes() const { return compact.empty() ? bvh.memory_bytes() : compact.memory_bytes(); }
+
+    /**
+     * @brief Vertex positions
+     */
+    const mapped_array<point3> &vertex_array() const { return vertices; }
+
+    /**
+     * @brief Triangle vertex indices in BVH leaf order
+     */
+    const mapped_array<uint32_t> &index_array() const { return indices; }
+
+    /**
+     * @brief Distinct triangle of every stored triangle, in BVH leaf order
+     *
+     * Empty unless spatial splits made the BVH reference some triangles
+     * from several leaves.
+     */
+    const mapped_array<uint32_t> &reference_array() const { return references; }
+
+    /**
+     * @brief Full-precision hierarchy over the triangles (empty after compress())
+     */
+    const bvh_tree &tree() const { return bvh; }
+
+private:
+    mapped_array<point3> vertices;       ///< Vertex positions
+    mapped_array<uint32_t> indices;      ///< Three vertex indices per triangle, in BVH leaf order
+    shared_ptr<material> mat;            ///< Material of the mesh
+    bvh_tree bvh;                        ///< Hierarchy over the triangles
+    compact_bvh compact;                 ///< Quantized hierarchy (replaces bvh after compress())
+    bvh_build_method method = sah_build; ///< Algorithm used to build bvh
+    size_t triangles = 0;                ///< Number of distinct triangles
+    mapped_array<uint32_t> references;   ///< Distinct triangle of every stored one (see reference_array())
+
+    /**
+     * @brief Per-ray constants of the watertight intersection test
+     *
+     * The ray is transformed so that it points along +z: the dominant
+     * axis becomes z and the other two are sheared by the direction.
+     */
+    struct watertight_ray
+    {
+        point3 origin;
+        int kx, ky, kz;
+        double sx, sy, sz;
+
+        explicit watertight_ray(const ray &r) : origin(r.origin())
+        {
+            const vec3 &d = r.direction();
+            kz = std::fabs(d[0]) > std::fabs(d[1]) ? (std::fabs(d[0]) > std::fabs(d[2]) ? 0 : 2)
+                                                   : (std::fabs(d[1]) > std::fabs(d[2]) ? 1 : 2);
+            kx = (kz + 1) % 3;
+            ky = (kx + 1) % 3;
+            if (d[kz] < 0)
+                std::swap(kx, ky); // Keep the winding of the projected triangle
+
+            sx = d[kx] / d[kz];
+            sy = d[ky] / d[kz];
+            sz = r.inverse_direction()[kz];
+        }
+    };
+
+    /**
+     * @brief Watertight ray/triangle intersection
+     * @param wr Precomputed ray constants
+     * @param triangle Triangle index (in leaf order)
+     * @param ray_t Accepted interval along the ray
+     * @param t Ray parameter of the hit (output)
+     * @return True if the triangle is hit within ray_t
+     */
+    bool intersect_triangle(const watertight_ray &wr, uint32_t triangle, const interval &ray_t, double &t) const
+    {
+        RT_STAT_INC(triangle_tests);
+
+        const vec3 a = vertices[indices[3 * triangle]] - wr.origin;
+        const vec3 b = vertices[indices[3 * triangle + 1]] - wr.origin;
+        const vec3 c = vertices[indices[3 * triangle + 2]] - wr.origin;
+
+        // Shear and scale the vertices into ray space
+        const double ax = a[wr.kx] - wr.sx * a[wr.kz], ay = a[wr.ky] - wr.sy * a[wr.kz];
+        const double bx = b[wr.kx] - wr.sx * b[wr.kz], by = b[wr.ky] - wr.sy * b[wr.kz];
+        const double cx = c[wr.kx] - wr.sx * c[wr.kz], cy = c[wr.ky] - wr.sy * c[wr.kz];
+
+        // Scaled barycentric coordinates; a hit needs all of them on one side
+        const double u = cx * by - cy * bx;
+        const double v = ax * cy - ay * cx;
+        const double w = bx * ay - by * ax;
+        if ((u < 0 || v < 0 || w < 0) && (u > 0 || v > 0 || w > 0))
+            return false;
+
+        const double det = u + v + w;
+        if (det == 0)
+            return false;
+
+        const double scaled_t = u * wr.sz * a[wr.kz] + v * wr.sz * b[wr.kz] + w * wr.sz * c[wr.kz];
+        t = scaled_t / det;
+        if (!ray_t.surrounds(t))
+            return false;
+
+        RT_STAT_INC(triangle_hits);
+        return true;
+    }
+
+    /**
+     * @brief Bounding box of every triangle, in storage order
+     */
+    std::vector<aabb> triangle_bounds() const
+    {
+        size_t count = indices.size() / 3;
+        std::vector<aabb> bounds(count);
+        for (size_t k = 0; k < count; k++)
+        {
+            bounds[k] = aabb(vertices[indices[3 * k]], vertices[indices[3 * k + 1]]);
+            bounds[k].expand(vertices[indices[3 * k + 2]]);
+        }
+        return bounds;
+    }
+
+    /**
+     * @brief Build the BVH and store triangles in leaf order
+     */
+    void build_bvh()
+    {
+        trace_scope scope("build mesh BVH", "accel");
+
+        if (indices.size() / 3 > triangles)
+            remove_repeated_triangles();
+        auto order = ::build_bvh(bvh, triangle_bounds(), method,
+                                 [this](uint32_t triangle, int axis, double position, aabb &left, aabb &right) {
+                                     clip_triangle(triangle, axis, position, left, right);
+                                 });
+
+        std::vector<uint32_t> ordered(3 * order.size());
+        for (size_t k = 0; k < order.size(); k++)
+            for (int corner = 0; corner < 3; corner++)
+                ordered[3 * k + corner] = indices[3 * size_t(order[k]) + corner];
+        indices = std::move(ordered);
+
+        // Remember which stored triangles are copies, so rebuilds can tell them from duplicates in the source
+        if (order.size() > triangles)
+            references = std::move(order);
+        else
+            references = mapped_array<uint32_t>();
+    }
+
+    /**
+     * @brief Bounds of the parts of a triangle below and above an axis-aligned plane
+     * @param triangle Triangle index (in storage order)
+     * @param axis Axis of the plane normal
+     * @param position Position of the plane along the axis
+     * @param left Bounds of the part below the plane (output)
+     * @param right Bounds of the part above the plane (output)
+     */
+    void clip_triangle(uint32_t triangle, int axis, double position, aabb &left, aabb &right) const
+    {
+        left = right = aabb();
+        for (int corner = 0; corner < 3; corner++)
+        {
+            const point3 &a = vertices[indices[3 * size_t(triangle) + corner]];
+            const point3 &b = vertices[indices[3 * size_t(triangle) + (corner + 1) % 3]];
+            if (a[axis] <= position)
+                left.expand(a);
+            if (a[axis] >= position)
+                right.expand(a);
+
+            // An edge crossing the plane adds its crossing point to both parts
+            if ((a[axis] < position && b[axis] > position) || (a[axis] > position && b[axis] < position))
+            {
+                point3 crossing = a + (b - a) * ((position - a[axis]) / (b[axis] - a[axis]));
+                left.expand(crossing);
+                right.expand(crossing);
+            }
+        }
+    }
+
+    /**
+     * @brief Keep one copy of every triangle before a rebuild
+     *
+     * A BVH with spatial splits stores a triangle once per leaf that
+     * references it. The copies are found by their entry in references,
+     * not by their vertices, so triangles that the source mesh itself
+     * repeats are kept. Triangles return to their order before the build.
+     */
+    void remove_repeated_triangles()
+    {
+        size_t count = indices.size() / 3;
+        if (references.size() != count)
+            return; // Without the references copies cannot be told apart; rebuild over all of them
+
+        std::vector<uint32_t> distinct(3 * triangles);
+        std::vector<bool> seen(triangles, false);
+        for (size_t k = 0; k < count; k++)
+        {
+            uint32_t triangle = references[k];
+            if (triangle >= triangles || seen[triangle])
+                continue;
+            seen[triangle] = true;
+            for (int corner = 0; corner < 3; corner++)
+                distinct[3 * size_t(triangle) + corner] = indices[3 * k + corner];
+        }
+        indices = std::move(distinct);
+        references = mapped_array<uint32_t>();
+    }
+};
+
+#endif
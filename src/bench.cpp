@@ -0,0 +1,537 @@
+/**
+ * @file bench.cpp
+ * @brief Deterministic performance benchmarks for the ray tracer
+ *
+ * Runs microbenchmarks of the hot functions (intersection, vector math,
+ * material scattering, random sampling) and end-to-end renders of the
+ * cover scene, its scaled variants, a motion-blurred variant and an
+ * instanced mesh scene, and compares the memory and trace speed of the
+ * BVH node layouts and the build time and trace speed of the BVH builders.
+ * Ray sorting between bounces is measured by render speed and by the BVH
+ * nodes that scattered rays touch in pixel and in sorted order. All inputs
+ * come from fixed seeds, so results are comparable between commits. The
+ * report is written as JSON to standard output.
+ *
+ * Command line options:
+ * - --quick: use fewer iterations and smaller images (for smoke tests)
+ * - --threads <n>: worker threads for the scene renders (default: all cores)
+ */
+
+#include "rtweekend.h"
+
+#include "bvh.h"
+#include "bvh_accel.h"
+#include "camera.h"
+#include "hittable.h"
+#include "hittable_list.h"
+#include "material.h"
+#include "ray_sort.h"
+#include "scenes.h"
+#include "sphere.h"
+
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+/**
+ * @class counting_hittable
+ * @brief Wraps a scene and counts the rays traced against it
+ *
+ * Every ray the camera traces (primary or scattered) queries the world
+ * exactly once, so the number of hit() calls is the number of rays.
+ * Counts are kept per thread to avoid contention; collect() gathers them
+ * from the workers of a thread pool.
+ */
+class counting_hittable : public hittable
+{
+public:
+    counting_hittable(const hittable &world) : world(world) {}
+
+    bool hit(const ray &r, interval ray_t, hit_record &rec) const override
+    {
+        thread_rays()++;
+        return world.hit(r, ray_t, rec);
+    }
+
+    aabb bounding_box() const override { return world.bounding_box(); }
+
+    /**
+     * @brief Sum and clear the ray counts of all pool workers
+     * @param pool Pool whose workers traced the rays
+     * @return Rays traced since the last collect()
+     */
+    static unsigned long long collect(thread_pool &pool)
+    {
+        std::mutex mutex;
+        unsigned long long total = 0;
+        pool.run([&](int) {
+            std::lock_guard<std::mutex> lock(mutex);
+            total += thread_rays();
+            thread_rays() = 0;
+        });
+        return total;
+    }
+
+private:
+    static unsigned long long &thread_rays()
+    {
+        thread_local unsigned long long rays = 0;
+        return rays;
+    }
+
+    const hittable &world; ///< Wrapped scene
+};
+
+/**
+ * @brief BVH node footprint of tracing rays in a given order
+ * @param tree Hierarchy over the objects
+ * @param objects Objects in the leaf order of tree
+ * @param rays Rays in tracing order
+ * @param window Number of consecutive rays whose distinct nodes are counted
+ * @return Nodes visited per ray, and distinct nodes visited per window of rays
+ *
+ * Follows bvh_tree::traverse() node by node so that the nodes of every ray
+ * can be recorded. Nodes that consecutive rays share are found in cache,
+ * so fewer distinct nodes per window means more coherent tracing, whether
+ * or not the scene is large enough for that to show in the timings.
+ */
+std::pair<double, double> node_footprint(const bvh_tree &tree, const std::vector<shared_ptr<hittable>> &objects,
+                                         const std::vector<ray> &rays, size_t window)
+{
+    std::vector<size_t> last_window(tree.nodes.size(), size_t(-1));
+    std::vector<uint32_t> stack;
+    size_t visits = 0, distinct = 0;
+    hit_record rec;
+    for (size_t k = 0; k < rays.size(); k++)
+    {
+        const ray &r = rays[k];
+        interval ray_t(0.001, infinity);
+        stack.assign(1, 0);
+        while (!stack.empty())
+        {
+            uint32_t current = stack.back();
+            stack.pop_back();
+            visits++;
+            if (last_window[current] != k / window)
+            {
+                last_window[current] = k / window;
+                distinct++;
+            }
+
+            const bvh_node &node = tree.nodes[current];
+            if (!node.bbox.hit(r, ray_t))
+                continue;
+            if (node.is_leaf())
+            {
+                for (uint32_t p = node.offset; p < node.offset + node.count; p++)
+                    if (objects[p]->hit(r, ray_t, rec))
+                        ray_t.max = rec.t;
+                continue;
+            }
+            bool right_first = r.direction_sign(node.axis);
+            stack.push_back(right_first ? current + 1 : node.offset);
+            stack.push_back(right_first ? node.offset : current + 1);
+        }
+    }
+    size_t windows = (rays.size() + window - 1) / window;
+    return {double(visits) / rays.size(), double(distinct) / windows};
+}
+
+/**
+ * @brief Value sink that keeps benchmark results from being optimized away
+ */
+static volatile double benchmark_sink = 0;
+
+/**
+ * @brief Time a benchmark body
+ * @param iterations Number of calls to make
+ * @param body Function called once per iteration with the iteration index
+ * @return Average nanoseconds per call
+ */
+template <typename Body>
+double time_ns_per_op(long iterations, Body &&body)
+{
+    auto start = std::chrono::steady_clock::now();
+    for (long i = 0; i < iterations; i++)
+        body(i);
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::nano>(end - start).count() / iterations;
+}
+
+/**
+ * @brief Write one microbenchmark result as a JSON object
+ */
+void report_micro(bool &first, const std::string &name, long iterations, double ns_per_op)
+{
+    std::cout << (first ? "" : ",\n") << "    {\"name\": \"" << name << "\", \"iterations\": " << iterations
+              << ", \"ns_per_op\": " << ns_per_op << "}";
+    first = false;
+}
+
+int main(int argc, char *argv[])
+{
+    bool quick = false;
+    int threads = 0;
+    for (int arg = 1; arg < argc; arg++)
+    {
+        std::string option = argv[arg];
+        if (option == "--quick")
+            quick = true;
+        else if (option == "--threads" && arg + 1 < argc)
+            threads = std::stoi(argv[++arg]);
+        else
+        {
+            std::cerr << "Unknown option: " << option << '\n';
+            return 1;
+        }
+    }
+
+    const long iterations = quick ? 20000 : 2000000;
+    const int input_count = 4096;
+
+    // Fixed inputs shared by the microbenchmarks
+    hittable_list world = cover_scene();
+    bvh_accel world_bvh(world);
+    thread_random_generator().state = 12345;
+
+    std::vector<ray> rays;
+    std::vector<vec3> vectors;
+    for (int i = 0; i < input_count; i++)
+    {
+        point3 origin(random_double(-10, 10), random_double(0.1, 3), random_double(-10, 10));
+        rays.push_back(ray(origin, point3(random_double(-4, 4), random_double(0, 1), random_double(-4, 4)) - origin));
+        vectors.push_back(vec3::random(-1, 1));
+    }
+
+    auto big_sphere = sphere(point3(0, 1, 0), 1.0, make_shared<lambertian>(color(0.5, 0.5, 0.5)));
+    auto diffuse = lambertian(color(0.5, 0.5, 0.5));
+    auto mirror = metal(color(0.7, 0.6, 0.5), 0.3);
+    auto glass = dielectric(1.5);
+
+    hit_record surface;
+    surface.p = point3(0, 1, 0);
+    surface.normal = vec3(0, 1, 0);
+    surface.t = 1;
+    surface.front_face = true;
+
+    std::cout << "{\n  \"micro\": [\n";
+    bool first = true;
+    hit_record rec;
+
+    report_micro(first, "sphere::hit", iterations, time_ns_per_op(iterations, [&](long i) {
+                     benchmark_sink = benchmark_sink + big_sphere.hit(rays[i % input_count], interval(0.001, infinity), rec);
+                 }));
+
+    // Slab test against the precomputed reciprocal direction, and the cost of that precomputation
+    aabb unit_box(point3(-1, 0, -1), point3(1, 2, 1));
+    report_micro(first, "aabb::hit", iterations, time_ns_per_op(iterations, [&](long i) {
+                     benchmark_sink = benchmark_sink + unit_box.hit(rays[i % input_count], interval(0.001, infinity));
+                 }));
+
+    report_micro(first, "ray construction", iterations, time_ns_per_op(iterations, [&](long i) {
+                     ray r(vectors[i % input_count], vectors[(i + 1) % input_count]);
+                     benchmark_sink = benchmark_sink + r.inverse_direction().x();
+                 }));
+
+    long list_iterations = iterations / 100;
+    report_micro(first, "hittable_list::hit (cover scene)", list_iterations, time_ns_per_op(list_iterations, [&](long i) {
+                     benchmark_sink = benchmark_sink + world.hit(rays[i % input_count], interval(0.001, infinity), rec);
+                 }));
+
+    report_micro(first, "bvh_accel::hit (cover scene)", iterations, time_ns_per_op(iterations, [&](long i) {
+                     benchmark_sink = benchmark_sink + world_bvh.hit(rays[i % input_count], interval(0.001, infinity), rec);
+                 }));
+
+    // Acceleration structure maintenance for animated scenes: a full build
+    // against a refit after a tenth of the spheres moved
+    hittable_list large_world = cover_scene(22);
+    std::vector<shared_ptr<sphere>> moving;
+    for (size_t k = 0; k < large_world.objects.size(); k += 10)
+        if (auto s = std::dynamic_pointer_cast<sphere>(large_world.objects[k]))
+            moving.push_back(s);
+    std::vector<point3> rest_centers;
+    for (const auto &s : moving)
+        rest_centers.push_back(s->bounding_box().centroid());
+
+    long build_iterations = quick ? 5 : 200;
+    report_micro(first, "cover_scene build + destroy (cover_large)", build_iterations,
+                 time_ns_per_op(build_iterations, [&](long) {
+                     hittable_list scene = cover_scene(22);
+                     benchmark_sink = benchmark_sink + double(scene.objects.size());
+                 }));
+    report_micro(first, "bvh_accel build (cover_large)", build_iterations, time_ns_per_op(build_iterations, [&](long) {
+                     bvh_accel accel(large_world);
+                     benchmark_sink = benchmark_sink + accel.object_count();
+                 }));
+
+    bvh_accel large_bvh(large_world);
+    long update_iterations = quick ? 50 : 2000;
+    report_micro(first, "bvh_accel::update (cover_large, 10% moved)", update_iterations,
+                 time_ns_per_op(update_iterations, [&](long i) {
+                     double offset = (i % 2 == 0) ? 0.3 : 0.0;
+                     for (size_t k = 0; k < moving.size(); k++)
+                         moving[k]->set_center(rest_centers[k] + vec3(offset, 0, 0));
+                     benchmark_sink = benchmark_sink + large_bvh.update();
+                 }));
+
+    report_micro(first, "vec3::dot", iterations, time_ns_per_op(iterations, [&](long i) {
+                     benchmark_sink = benchmark_sink + dot(vectors[i % input_count], vectors[(i + 1) % input_count]);
+                 }));
+
+    report_micro(first, "vec3::cross", iterations, time_ns_per_op(iterations, [&](long i) {
+                     benchmark_sink = benchmark_sink + cross(vectors[i % input_count], vectors[(i + 1) % input_count]).x();
+                 }));
+
+    report_micro(first, "vec3::unit_vector", iterations, time_ns_per_op(iterations, [&](long i) {
+                     benchmark_sink = benchmark_sink + unit_vector(vectors[i % input_count]).x();
+                 }));
+
+    report_micro(first, "random_unit_vector", iterations, time_ns_per_op(iterations, [&](long) {
+                     benchmark_sink = benchmark_sink + random_unit_vector().x();
+                 }));
+
+    const std::pair<const char *, const material *> materials[] = {
+        {"lambertian::scatter", &diffuse}, {"metal::scatter", &mirror}, {"dielectric::scatter", &glass}};
+    for (const auto &[name, mat] : materials)
+    {
+        report_micro(first, name, iterations, time_ns_per_op(iterations, [&](long i) {
+                         color attenuation;
+                         ray scattered;
+                         benchmark_sink = benchmark_sink + mat->scatter(rays[i % input_count], surface, attenuation, scattered);
+                     }));
+    }
+
+    std::cout << "\n  ],\n  \"scenes\": [\n";
+
+    // End-to-end renders of the cover scene, scaled and motion-blurred variants and instanced meshes
+    struct scene_config
+    {
+        const char *name;
+        int extent;
+        int mesh_instances;
+        double bounce;
+    };
+    const scene_config scenes[] = {{"cover_small", 5, 0, 0},
+                                   {"cover", 11, 0, 0},
+                                   {"cover_large", 22, 0, 0},
+                                   {"cover_motion_blur", 11, 0, 0.5},
+                                   {"mesh_instances", 0, 1000, 0}};
+
+    first = true;
+    for (const auto &config : scenes)
+    {
+        hittable_list scene = cover_scene(config.extent, 0, config.bounce);
+        if (config.mesh_instances > 0)
+            scatter_instances(scene, uv_sphere_mesh(32, make_shared<metal>(color(0.8, 0.8, 0.8), 0.1)),
+                              config.mesh_instances);
+        bvh_accel accel(scene);
+        counting_hittable counted(accel);
+
+        Camera cam;
+        cover_camera(cam);
+        cam.image_width = quick ? 64 : 320;
+        cam.samples_per_pixel = quick ? 2 : 8;
+        cam.max_depth = 50;
+        cam.show_progress = false;
+        cam.thread_count = threads;
+
+        std::ostream discard(nullptr);
+        auto start = std::chrono::steady_clock::now();
+        cam.render(counted, discard);
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        unsigned long long rays = counting_hittable::collect(*cam.pool);
+
+        std::cout << (first ? "" : ",\n") << "    {\"name\": \"" << config.name << "\", \"objects\": " << scene.objects.size()
+                  << ", \"width\": " << cam.image_width << ", \"samples_per_pixel\": " << cam.samples_per_pixel
+                  << ", \"max_depth\": " << cam.max_depth << ", \"threads\": " << cam.pool->size() << ", \"rays\": " << rays
+                  << ", \"seconds\": " << seconds << ", \"rays_per_sec\": " << rays / seconds
+                  << ", \"ns_per_ray\": " << seconds * 1e9 * cam.pool->size() / rays
+                  << "}";
+        first = false;
+    }
+
+    std::cout << "\n  ],\n  \"bvh_layouts\": [\n";
+
+    // Node memory and trace speed of the full-precision and compact BVH layouts
+    first = true;
+    long probe_iterations = quick ? 20000 : 1000000;
+    auto time_probes = [&](const hittable &object, const aabb &box) {
+        // Rays from a sphere around the box towards points inside it
+        random_generator rng(777);
+        point3 center = box.centroid();
+        double radius = 0.5 * std::sqrt(box.x.size() * box.x.size() + box.y.size() * box.y.size() +
+                                         box.z.size() * box.z.size());
+        std::vector<ray> probes;
+        for (int i = 0; i < input_count; i++)
+        {
+            vec3 from(rng.next_double() - 0.5, rng.next_double() - 0.5, rng.next_double() - 0.5);
+            vec3 to(rng.next_double() - 0.5, rng.next_double() - 0.5, rng.next_double() - 0.5);
+            probes.push_back(ray(center + 4 * radius * unit_vector(from), radius * to - 4 * radius * unit_vector(from)));
+        }
+        return time_ns_per_op(probe_iterations, [&](long i) {
+            benchmark_sink = benchmark_sink + object.hit(probes[i % input_count], interval(0.001, infinity), rec);
+        });
+    };
+    auto report_layouts = [&](const char *name, hittable &object, const aabb &box, size_t primitives, auto &&bytes,
+                              auto &&compress) {
+        for (const char *layout : {"full", "compact"})
+        {
+            if (std::string(layout) == "compact")
+                compress();
+            double ns = time_probes(object, box);
+            std::cout << (first ? "" : ",\n") << "    {\"name\": \"" << name << "\", \"layout\": \"" << layout
+                      << "\", \"primitives\": " << primitives << ", \"bytes_per_primitive\": "
+                      << double(bytes()) / primitives << ", \"ns_per_ray\": " << ns << "}";
+            first = false;
+        }
+    };
+
+    bvh_accel layout_scene(cover_scene(quick ? 22 : 150));
+    report_layouts("cover_scene", layout_scene, layout_scene.hierarchy_bounds(), layout_scene.object_count(),
+                   [&] { return layout_scene.hierarchy_bytes(); }, [&] { layout_scene.compress(); });
+
+    auto layout_mesh = uv_sphere_mesh(quick ? 64 : 512, make_shared<lambertian>(color(0.5, 0.5, 0.5)));
+    report_layouts("uv_sphere_mesh", *layout_mesh, layout_mesh->bounding_box(), layout_mesh->triangle_count(),
+                   [&] { return layout_mesh->hierarchy_bytes(); }, [&] { layout_mesh->compress(); });
+
+    std::cout << "\n  ],\n  \"bvh_builders\": [\n";
+
+    // Build time against trace speed of the BVH build algorithms on the same mesh
+    first = true;
+    auto builder_mesh = uv_sphere_mesh(quick ? 64 : 512, make_shared<lambertian>(color(0.5, 0.5, 0.5)));
+    const std::pair<const char *, bvh_build_method> builders[] = {
+        {"sah", sah_build}, {"lbvh", lbvh_build}, {"lbvh-treelet", lbvh_treelet_build}, {"sbvh", sbvh_build}};
+    for (const auto &[name, method] : builders)
+    {
+        const auto &vertices = builder_mesh->vertex_array();
+        const auto &indices = builder_mesh->index_array();
+        std::vector<point3> vertex_copy(vertices.begin(), vertices.end());
+        std::vector<uint32_t> index_copy(indices.begin(), indices.end());
+
+        auto start = std::chrono::steady_clock::now();
+        triangle_mesh mesh(std::move(vertex_copy), std::move(index_copy), nullptr, method);
+        double build_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+        std::cout << (first ? "" : ",\n") << "    {\"name\": \"uv_sphere_mesh\", \"builder\": \"" << name
+                  << "\", \"primitives\": " << mesh.triangle_count()
+                  << ", \"references\": " << mesh.index_array().size() / 3 << ", \"build_ms\": " << build_ms
+                  << ", \"sah_cost\": " << mesh.tree().sah_cost() << ", \"ns_per_ray\": " << time_probes(mesh, mesh.bounding_box()) << "}";
+        first = false;
+    }
+
+    // Top-level builds over the cover scene's spheres
+    hittable_list builder_scene = cover_scene(quick ? 22 : 150);
+    for (const auto &[name, method] : builders)
+    {
+        auto start = std::chrono::steady_clock::now();
+        bvh_accel accel(builder_scene, method);
+        double build_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+        std::cout << ",\n    {\"name\": \"cover_scene\", \"builder\": \"" << name
+                  << "\", \"primitives\": " << accel.object_count() << ", \"build_ms\": " << build_ms
+                  << ", \"ns_per_ray\": " << time_probes(accel, accel.hierarchy_bounds()) << "}";
+    }
+
+    std::cout << "\n  ],\n  \"ray_sorting\": [\n";
+
+    // Renders in pixel order against batches sorted by ray origin and direction between bounces
+    first = true;
+    const std::pair<const char *, int> sorting_scenes[] = {{"cover_large", 22}, {"cover_huge", quick ? 44 : 150}};
+    for (const auto &[name, extent] : sorting_scenes)
+    {
+        bvh_accel accel(cover_scene(extent));
+        counting_hittable counted(accel);
+        for (bool sort_rays : {false, true})
+        {
+            Camera cam;
+            cover_camera(cam);
+            cam.image_width = quick ? 64 : 320;
+            cam.samples_per_pixel = quick ? 2 : 8;
+            cam.max_depth = 50;
+            cam.show_progress = false;
+            cam.thread_count = threads;
+            cam.sort_rays = sort_rays;
+
+            std::ostream discard(nullptr);
+            auto start = std::chrono::steady_clock::now();
+            cam.render(counted, discard);
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            unsigned long long rays = counting_hittable::collect(*cam.pool);
+
+            std::cout << (first ? "" : ",\n") << "    {\"name\": \"" << name << "\", \"sort_rays\": "
+                      << (sort_rays ? "true" : "false") << ", \"objects\": " << accel.object_count()
+                      << ", \"rays\": " << rays << ", \"seconds\": " << seconds << ", \"rays_per_sec\": " << rays / seconds;
+#ifdef RT_ENABLE_STATS
+            std::cout << ", \"bvh_nodes_per_ray\": " << double(ray_stats::aggregate()[ray_stats::bvh_nodes]) / rays;
+#endif
+            std::cout << "}";
+            first = false;
+        }
+    }
+
+    std::cout << "\n  ],\n  \"ray_order\": [\n";
+
+    // Node footprint of the first scattered rays of every pixel, in pixel order and sorted as the renderer does
+    first = true;
+    const size_t footprint_window = 64;
+    for (const auto &[name, extent] : sorting_scenes)
+    {
+        hittable_list scene = cover_scene(extent);
+        bvh_accel accel(scene);
+
+        // The ground plane is unbounded and stays outside the hierarchy, as in bvh_accel
+        std::vector<shared_ptr<hittable>> bounded;
+        std::vector<aabb> bounds;
+        for (const auto &object : scene.objects)
+        {
+            if (!object->is_bounded())
+                continue;
+            bounded.push_back(object);
+            bounds.push_back(object->bounding_box());
+        }
+        bvh_tree tree;
+        auto order = tree.build(bounds);
+        std::vector<shared_ptr<hittable>> leaf_objects;
+        for (uint32_t index : order)
+            leaf_objects.push_back(bounded[index]);
+
+        Camera cam;
+        cover_camera(cam);
+        int width = quick ? 64 : 320, height = int(width / cam.aspect_ratio);
+        vec3 w = unit_vector(cam.lookfrom - cam.lookat), u = unit_vector(cross(cam.vup, w)), v = cross(w, u);
+        double half_height = std::tan(degrees_to_radians(cam.vfov) / 2), half_width = half_height * width / height;
+
+        std::vector<ray> scattered_rays;
+        for (int j = 0; j < height; j++)
+        {
+            for (int i = 0; i < width; i++)
+            {
+                thread_random_generator().state = sample_seed(0, size_t(j) * width + i, 0);
+                vec3 direction = -w + (2 * (i + 0.5) / width - 1) * half_width * u +
+                                 (1 - 2 * (j + 0.5) / height) * half_height * v;
+                ray primary(cam.lookfrom, direction);
+                color attenuation;
+                ray scattered;
+                if (accel.hit(primary, interval(0.001, infinity), rec) &&
+                    rec.mat->scatter(primary, rec, attenuation, scattered))
+                    scattered_rays.push_back(scattered);
+            }
+        }
+
+        for (const char *ray_order : {"pixel", "sorted"})
+        {
+            if (std::string(ray_order) == "sorted")
+                sort_by_ray_key(scattered_rays, [](const ray &r) -> const ray & { return r; });
+            auto [nodes_per_ray, distinct_nodes] = node_footprint(tree, leaf_objects, scattered_rays, footprint_window);
+            std::cout << (first ? "" : ",\n") << "    {\"name\": \"" << name << "\", \"order\": \"" << ray_order
+                      << "\", \"rays\": " << scattered_rays.size() << ", \"nodes_per_ray\": " << nodes_per_ray
+                      << ", \"distinct_nodes_per_" << footprint_window << "_rays\": " << distinct_nodes << "}";
+            first = false;
+        }
+    }
+
+    std::cout << "\n  ]\n}\n";
+    return 0;
+}
@@ -13,11 +13,25 @@
 
 #include "rtweekend.h"
 
+#include "bvh_accel.h"
 #include "camera.h"
+#include "camera_path.h"
+#include "distributed.h"
 #include "hittable.h"
 #include "hittable_list.h"
 #include "material.h"
+#include "render_server.h"
+#include "result_cache.h"
+#include "scenes.h"
 #include "sphere.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
 
 /**
  * @brief Main function that sets up and renders a simple ray-traced scene
@@ -36,81 +50,455 @@
  * - Maximum ray depth: 50 (for realistic reflections)
  * - Vertical field of view: 90 degrees
  *
+ * Command line options:
+ * - --checkpoint <file>: periodically save render progress to <file>
+ * - --checkpoint-interval <seconds>: time between checkpoints (default 60)
+ * - --resume: continue the render stored in the checkpoint file
+ * - --stats-json <file>: write ray statistics as JSON (RAYTRACER_STATS builds)
+ * - --heatmap <prefix>: write per-pixel render time as <prefix>.ppm / <prefix>.pfm
+ * - --heatmap-intersections: measure sphere and triangle tests instead of time (RAYTRACER_STATS builds)
+ * - --trace <file>: write a Chrome trace-event timeline of the render phases
+ * - --threads <n>: number of worker threads (default: all hardware threads)
+ * - --tile-size <n>: edge length of the render tiles in pixels (default 16)
+ * - --scheduler-report: print per-worker busy and idle time
+ * - --sort-rays: trace bounces in batches sorted by ray origin and direction (same image)
+ * - --mesh <file.obj>: add a triangle mesh loaded from a Wavefront OBJ file
+ * - --mesh-instances <n>: scatter n instances of each mesh instead of adding it once
+ * - --bvh-cache <directory>: store meshes with their built BVH and map them on later runs
+ * - --bvh-builder <sah|lbvh|lbvh-treelet|sbvh>: BVH build algorithm (default sah; lbvh builds fastest,
+ *   sbvh splits large overlapping primitives such as long thin triangles)
+ * - --compact-bvh: store the BVHs as quantized four-wide nodes (less memory, same image)
+ * - --field <directory>: stream the small spheres from a sphere field on disk
+ * - --field-budget <MiB>: memory for resident chunks of the field (default 1024)
+ * - --write-field <directory>: generate a sphere field and exit; its size is set with
+ *   --field-extent <n> (grid half-size, default 1000) and --field-chunk <n> (chunk edge in cells, default 64)
+ * - --motion-blur: let the diffuse spheres bounce during the exposure
+ * - --sequence <path-file>: render an animation along a keyframed camera path
+ * - --frames <n>: number of frames of the sequence (default 24)
+ * - --output <pattern>: frame file names of the sequence (default frame_%04d.ppm);
+ *   checkpoint, heatmap and statistics files get the frame number appended
+ * - --view <lookfrom.x,y,z,lookat.x,y,z,vfov,focus_dist,output.ppm>: add a view;
+ *   all views are rendered in one pass, each to its own file (repeatable)
+ * - --crop <x,y,width,height>: trace only this pixel rectangle and output it alone
+ * - --crop-full-frame: output the full-size image with only the crop rectangle filled
+ * - --width <n>, --samples <n>, --depth <n>: image width, samples per pixel and maximum bounce depth
+ * - --coordinator <address>: hand the tiles of the frame to worker processes connecting to
+ *   <address> ("host:port" or "unix:/path"; ":port" listens on loopback only) and write the image to stdout
+ * - --worker <address>: trace tiles for the coordinator at <address>; must be started with the
+ *   same scene and camera options as the coordinator
+ * - --cache <directory>: answer repeated renders from a content-addressed cache of images, and
+ *   extend cached renders with fewer samples instead of starting over
+ * - --server <address>: run as a render server; the other options set the job defaults
+ * - --submit <address>: send the job read from standard input to a server and write its image to stdout
+ * - --shutdown <address>: stop a render server after its current job
+ *
+ * @param argc Number of command line arguments
+ * @param argv Command line arguments
  * @return int Exit status (0 for success)
  */
-int main()
+int main(int argc, char *argv[])
 {
-    // Create the world/scene container
-    hittable_list world;
+    // Create and configure the camera
+    Camera cam;
+    cover_camera(cam);
+
+    // Set camera parameters for high-quality rendering
+    cam.image_width = 1200;      // Image width in pixels
+    cam.samples_per_pixel = 100; // Anti-aliasing samples per pixel
+    cam.max_depth = 50;          // Maximum ray bounce depth for reflections
 
-    auto ground_material = make_shared<lambertian>(color(0.5, 0.5, 0.5));
-    world.add(make_shared<sphere>(point3(0, -1000, 0), 1000, ground_material));
+    std::string trace_path;
+    scene_description scene;
+    std::string sequence_path;
+    int frame_count = 24;
+    std::string output_pattern = "frame_%04d.ppm";
+    std::vector<std::string> view_specs;
+    std::string coordinator_address, worker_address;
+    std::string server_address, submit_address, shutdown_address;
+    std::string cache_directory;
+    std::string write_field_directory;
+    int field_extent = 1000, field_chunk = 64;
 
-    for (int a = -11; a < 11; a++)
+    // Parse command line options
+    for (int arg = 1; arg < argc; arg++)
     {
-        for (int b = -11; b < 11; b++)
+        std::string option = argv[arg];
+        if (option == "--checkpoint" && arg + 1 < argc)
+            cam.checkpoint_path = argv[++arg];
+        else if (option == "--checkpoint-interval" && arg + 1 < argc)
+            cam.checkpoint_interval = std::stod(argv[++arg]);
+        else if (option == "--resume")
+            cam.resume = true;
+        else if (option == "--stats-json" && arg + 1 < argc)
+            cam.stats_path = argv[++arg];
+        else if (option == "--heatmap" && arg + 1 < argc)
+            cam.heatmap_prefix = argv[++arg];
+        else if (option == "--heatmap-intersections")
+            cam.heatmap_intersections = true;
+        else if (option == "--trace" && arg + 1 < argc)
+            trace_path = argv[++arg];
+        else if (option == "--threads" && arg + 1 < argc)
+            cam.thread_count = std::stoi(argv[++arg]);
+        else if (option == "--tile-size" && arg + 1 < argc)
+            cam.tile_size = std::stoi(argv[++arg]);
+        else if (option == "--scheduler-report")
+            cam.scheduler_report = true;
+        else if (option == "--sort-rays")
+            cam.sort_rays = true;
+        else if (option == "--mesh" && arg + 1 < argc)
+            scene.mesh_paths.push_back(argv[++arg]);
+        else if (option == "--mesh-instances" && arg + 1 < argc)
+            scene.mesh_instances = std::stoi(argv[++arg]);
+        else if (option == "--bvh-cache" && arg + 1 < argc)
+            scene.bvh_cache_directory = argv[++arg];
+        else if (option == "--bvh-builder" && arg + 1 < argc)
         {
-            auto choose_mat = random_double();
-            point3 center(a + 0.9 * random_double(), 0.2, b + 0.9 * random_double());
-
-            if ((center - point3(4, 0.2, 0)).length() > 0.9)
+            if (!parse_bvh_build_method(argv[++arg], scene.bvh_method))
+            {
+                std::cerr << "Unknown BVH builder: " << argv[arg] << '\n';
+                return 1;
+            }
+        }
+        else if (option == "--compact-bvh")
+            scene.compress_bvh = true;
+        else if (option == "--field" && arg + 1 < argc)
+            scene.field_directory = argv[++arg];
+        else if (option == "--field-budget" && arg + 1 < argc)
+            scene.field_budget = size_t(std::stod(argv[++arg]) * (1 << 20));
+        else if (option == "--write-field" && arg + 1 < argc)
+            write_field_directory = argv[++arg];
+        else if (option == "--field-extent" && arg + 1 < argc)
+            field_extent = std::stoi(argv[++arg]);
+        else if (option == "--field-chunk" && arg + 1 < argc)
+            field_chunk = std::stoi(argv[++arg]);
+        else if (option == "--motion-blur")
+            scene.bounce = 0.5;
+        else if (option == "--sequence" && arg + 1 < argc)
+            sequence_path = argv[++arg];
+        else if (option == "--frames" && arg + 1 < argc)
+            frame_count = std::stoi(argv[++arg]);
+        else if (option == "--output" && arg + 1 < argc)
+            output_pattern = argv[++arg];
+        else if (option == "--view" && arg + 1 < argc)
+            view_specs.push_back(argv[++arg]);
+        else if (option == "--crop" && arg + 1 < argc)
+        {
+            std::string spec = argv[++arg];
+            std::replace(spec.begin(), spec.end(), ',', ' ');
+            std::istringstream fields(spec);
+            if (!(fields >> cam.crop_x >> cam.crop_y >> cam.crop_width >> cam.crop_height) || cam.crop_width <= 0 ||
+                cam.crop_height <= 0)
             {
-                shared_ptr<material> sphere_material;
-
-                if (choose_mat < 0.8)
-                {
-                    // diffuse
-                    auto albedo = color::random() * color::random();
-                    sphere_material = make_shared<lambertian>(albedo);
-                    world.add(make_shared<sphere>(center, 0.2, sphere_material));
-                }
-                else if (choose_mat < 0.95)
-                {
-                    // metal
-                    auto albedo = color::random(0.5, 1);
-                    auto fuzz = random_double(0, 0.5);
-                    sphere_material = make_shared<metal>(albedo, fuzz);
-                    world.add(make_shared<sphere>(center, 0.2, sphere_material));
-                }
-                else
-                {
-                    // glass
-                    sphere_material = make_shared<dielectric>(1.5);
-                    world.add(make_shared<sphere>(center, 0.2, sphere_material));
-                }
+                std::cerr << "Malformed crop rectangle: " << argv[arg] << '\n';
+                return 1;
             }
         }
+        else if (option == "--crop-full-frame")
+            cam.crop_full_frame = true;
+        else if (option == "--width" && arg + 1 < argc)
+            cam.image_width = std::stoi(argv[++arg]);
+        else if (option == "--samples" && arg + 1 < argc)
+            cam.samples_per_pixel = std::stoi(argv[++arg]);
+        else if (option == "--depth" && arg + 1 < argc)
+            cam.max_depth = std::stoi(argv[++arg]);
+        else if (option == "--coordinator" && arg + 1 < argc)
+            coordinator_address = argv[++arg];
+        else if (option == "--worker" && arg + 1 < argc)
+            worker_address = argv[++arg];
+        else if (option == "--cache" && arg + 1 < argc)
+            cache_directory = argv[++arg];
+        else if (option == "--server" && arg + 1 < argc)
+            server_address = argv[++arg];
+        else if (option == "--submit" && arg + 1 < argc)
+            submit_address = argv[++arg];
+        else if (option == "--shutdown" && arg + 1 < argc)
+            shutdown_address = argv[++arg];
+        else
+        {
+            std::cerr << "Unknown option: " << option << '\n';
+            return 1;
+        }
+    }
+#ifndef RT_ENABLE_STATS
+    // Ray statistics are compiled out, so the options reading them would silently do nothing
+    if (!cam.stats_path.empty())
+    {
+        std::cerr << "--stats-json needs a build with ray statistics (cmake -DRAYTRACER_STATS=ON)\n";
+        return 1;
     }
+    if (cam.heatmap_intersections)
+    {
+        std::cerr << "--heatmap-intersections needs a build with ray statistics (cmake -DRAYTRACER_STATS=ON)\n";
+        return 1;
+    }
+#endif
 
-    auto material1 = make_shared<dielectric>(1.5);
-    world.add(make_shared<sphere>(point3(0, 1, 0), 1.0, material1));
+    if (!write_field_directory.empty())
+    {
+        std::string error;
+        if (!chunked_scene::write_sphere_field(write_field_directory, field_extent, scene.seed, field_chunk, error))
+        {
+            std::cerr << "Failed to write sphere field: " << error << '\n';
+            return 1;
+        }
+        return 0;
+    }
 
-    auto material2 = make_shared<lambertian>(color(0.4, 0.2, 0.1));
-    world.add(make_shared<sphere>(point3(-4, 1, 0), 1.0, material2));
+    // Views copy the camera after all other options have been applied. Each view is given as
+    // "lookfrom.x,y,z,lookat.x,y,z,vfov,focus_dist,output"
+    std::vector<Camera> views;
+    std::vector<std::string> view_outputs;
+    auto add_view = [&](std::string spec, const Camera &base) {
+        std::replace(spec.begin(), spec.end(), ',', ' ');
+        std::istringstream fields(spec);
+        Camera view = base;
+        double fx, fy, fz, ax, ay, az;
+        std::string output;
+        if (!(fields >> fx >> fy >> fz >> ax >> ay >> az >> view.vfov >> view.focus_dist >> output))
+            return false;
+        view.lookfrom = point3(fx, fy, fz);
+        view.lookat = point3(ax, ay, az);
+        views.push_back(view);
+        view_outputs.push_back(output);
+        return true;
+    };
 
-    auto material3 = make_shared<metal>(color(0.7, 0.6, 0.5), 0.0);
-    world.add(make_shared<sphere>(point3(4, 1, 0), 1.0, material3));
+    for (const auto &spec : view_specs)
+    {
+        if (!add_view(spec, cam))
+        {
+            std::cerr << "Malformed view: " << spec << '\n';
+            return 1;
+        }
+    }
+    if (!views.empty() && !sequence_path.empty())
+    {
+        std::cerr << "--view cannot be combined with --sequence\n";
+        return 1;
+    }
+    bool distributed = !coordinator_address.empty() || !worker_address.empty();
+    if (distributed &&
+        (!views.empty() || !sequence_path.empty() || (!coordinator_address.empty() && !worker_address.empty())))
+    {
+        std::cerr << "--coordinator and --worker render a single frame and cannot be combined with each other,\n"
+                     "--view or --sequence\n";
+        return 1;
+    }
+#ifdef RT_HAVE_SOCKETS
+    std::string server_error;
+    if (!server_address.empty())
+    {
+        // Scenes are built per job by the server, which keeps them resident
+        render_server server;
+        if (!server.run(server_address, cam))
+        {
+            std::cerr << "Server failed: " << server.error << '\n';
+            return 1;
+        }
+        return 0;
+    }
+    if (!submit_address.empty())
+    {
+        std::ostringstream job;
+        job << std::cin.rdbuf();
+        if (!submit_render_job(submit_address, job.str(), std::cout, server_error))
+        {
+            std::cerr << "Job failed: " << server_error << '\n';
+            return 1;
+        }
+        return 0;
+    }
+    if (!shutdown_address.empty())
+    {
+        if (!shutdown_render_server(shutdown_address, server_error))
+        {
+            std::cerr << "Shutdown failed: " << server_error << '\n';
+            return 1;
+        }
+        return 0;
+    }
+#else
+    bool served = !server_address.empty() || !submit_address.empty() || !shutdown_address.empty();
+    if (distributed || served)
+    {
+        std::cerr << "Distributed and server rendering are not available on this platform\n";
+        return 1;
+    }
+#endif
 
-    // Create and configure the camera
-    Camera cam;
+    camera_path path;
+    if (!sequence_path.empty() && !path.load(sequence_path))
+    {
+        std::cerr << "Failed to load camera path: " << path.error << '\n';
+        return 1;
+    }
 
-    // Set camera parameters for high-quality rendering
-    cam.aspect_ratio = 16.0 / 9.0; // Widescreen aspect ratio
-    cam.image_width = 1200;        // Image width in pixels
-    cam.samples_per_pixel = 100;   // Anti-aliasing samples per pixel
-    cam.max_depth = 50;            // Maximum ray bounce depth for reflections
-
-    // Set vertical field of view (90 degrees for wide-angle view)
-    cam.vfov = 30;
-    cam.lookfrom = point3(13, 2, 3);
-    cam.lookat = point3(0, 0, 0);
-    cam.vup = vec3(0, 1, 0);
-
-    cam.defocus_angle = 0.6;
-    cam.focus_dist = 10.0;
-
-    // Render the scene and output to PPM format
-    cam.render(world);
+    // A cached image is returned before any scene setup
+    result_cache cache(cache_directory);
+    std::string cache_key;
+    if (!cache_directory.empty())
+    {
+        if (!views.empty() || !sequence_path.empty() || distributed || !cam.checkpoint_path.empty())
+        {
+            std::cerr << "--cache renders a single frame and cannot be combined with --view, --sequence,\n"
+                         "--coordinator, --worker or --checkpoint\n";
+            return 1;
+        }
+        if (!cache.create_directory() || !cache.make_key(scene, cam, cache_key))
+        {
+            std::cerr << "Result cache failed: " << cache.error << '\n';
+            return 1;
+        }
+        if (cache.find_image(cache_key, cam.samples_per_pixel, std::cout))
+        {
+            std::clog << "Cached result " << cache_key << '\n';
+            return 0;
+        }
+        int cached = cache.prepare(cam, cache_key);
+        if (cached < 0)
+            std::clog << "Cached render " << cache_key << " is in progress in another process, rendering without "
+                         "checkpoints\n";
+        if (cached > 0 && cached < cam.samples_per_pixel)
+            std::clog << "Extending cached render " << cache_key << " from " << cached << " to "
+                      << cam.samples_per_pixel << " samples per pixel\n";
+    }
+
+    if (!trace_path.empty())
+    {
+        trace_recorder::instance().enable();
+        trace_recorder::instance().set_thread_name("main");
+    }
+
+    // Create the world/scene container, including any meshes
+    hittable_list world;
+    {
+        trace_scope scope("build scene", "scene");
+        std::string error;
+        if (!scene.build(world, error))
+        {
+            std::cerr << "Failed to build scene: " << error << '\n';
+            return 1;
+        }
+    }
+
+    // Render through a top-level BVH over all objects
+    bvh_accel accel(world, scene.bvh_method);
+    if (scene.compress_bvh)
+        accel.compress();
+
+    // Coordinator and workers refuse each other, and checkpoints are not resumed, unless the
+    // scene inputs hash the same
+    bool checkpointing = !cam.checkpoint_path.empty();
+    for (const auto &view : views)
+        checkpointing = checkpointing || !view.checkpoint_path.empty();
+    content_hash scene_hash;
+    std::string scene_hash_error;
+    if ((distributed || checkpointing) && !scene.add_contents(scene_hash, scene_hash_error))
+    {
+        std::cerr << "Failed to hash the scene: " << scene_hash_error << '\n';
+        return 1;
+    }
+    cam.scene_hash = scene_hash.value();
+    for (auto &view : views)
+        view.scene_hash = scene_hash.value();
+
+#ifdef RT_HAVE_SOCKETS
+
+    if (!coordinator_address.empty())
+    {
+        // Hand out tiles to worker processes and assemble the image
+        render_coordinator coordinator;
+        if (!coordinator.run(cam, scene_hash.value(), coordinator_address, std::cout))
+        {
+            std::cerr << "Coordinator failed: " << coordinator.error << '\n';
+            return 1;
+        }
+    }
+    else if (!worker_address.empty())
+    {
+        // Trace tiles for a coordinator until the frame is done
+        render_worker worker;
+        if (!worker.run(cam, accel, scene_hash.value(), worker_address))
+        {
+            std::cerr << "Worker failed: " << worker.error << '\n';
+            return 1;
+        }
+    }
+    else
+#endif
+    if (!views.empty())
+    {
+        // Render all views in one pass over a shared worker pool
+        std::vector<Camera *> view_cameras;
+        std::vector<std::unique_ptr<std::ofstream>> files;
+        std::vector<std::ostream *> outputs;
+        for (size_t k = 0; k < views.size(); k++)
+        {
+            auto per_view = [&](const std::string &base) {
+                return base.empty() ? base : base + "." + std::to_string(k);
+            };
+            views[k].checkpoint_path = per_view(views[k].checkpoint_path);
+            views[k].heatmap_prefix = per_view(views[k].heatmap_prefix);
+            views[k].stats_path = per_view(views[k].stats_path);
+
+            files.push_back(std::make_unique<std::ofstream>(view_outputs[k], std::ios::binary));
+            if (!*files.back())
+            {
+                std::cerr << "Failed to open " << view_outputs[k] << '\n';
+                return 1;
+            }
+            view_cameras.push_back(&views[k]);
+            outputs.push_back(files.back().get());
+        }
+        Camera::render_views(view_cameras, accel, outputs);
+    }
+    else if (sequence_path.empty())
+    {
+        // Render the scene and output to PPM format
+        if (cache_directory.empty())
+            cam.render(accel);
+        else
+        {
+            std::ostringstream image;
+            cam.render(accel, image);
+            if (!cache.store_image(cache_key, cam.samples_per_pixel, image.str()))
+                std::cerr << "Result cache failed: " << cache.error << '\n';
+            std::cout << image.str();
+        }
+    }
+    else
+    {
+        // Render every frame against the same world, BVH and worker pool
+        const std::string checkpoint_base = cam.checkpoint_path, heatmap_base = cam.heatmap_prefix,
+                          stats_base = cam.stats_path;
+        auto per_frame = [](const std::string &base, int frame) {
+            return base.empty() ? base : base + "." + std::to_string(frame);
+        };
+
+        for (int frame = 0; frame < frame_count; frame++)
+        {
+            path.apply(cam, path.frame_time(frame, frame_count));
+            cam.checkpoint_path = per_frame(checkpoint_base, frame);
+            cam.heatmap_prefix = per_frame(heatmap_base, frame);
+            cam.stats_path = per_frame(stats_base, frame);
+
+            std::string file_name = frame_file_name(output_pattern, frame);
+            std::ofstream out(file_name, std::ios::binary);
+            if (!out)
+            {
+                std::cerr << "Failed to open " << file_name << '\n';
+                return 1;
+            }
+            std::clog << "Frame " << frame + 1 << "/" << frame_count << " -> " << file_name << '\n';
+            cam.render(accel, out);
+        }
+    }
+
+    if (!trace_path.empty() && !trace_recorder::instance().write(trace_path))
+    {
+        std::cerr << "Failed to write trace " << trace_path << '\n';
+        return 1;
+    }
 
     return 0;
 }